@@ -0,0 +1,413 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <wayland-client.h>
+
+#include "shared/config-parser.h"
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "shared/zalloc.h"
+#include "weston-stats-client-protocol.h"
+
+/* Prints the performance counters of a compositor started with
+ * performance-stats=true, with rates over a sampling interval. */
+
+#define HISTOGRAM_BUCKETS 10
+
+struct output_sample {
+	struct wl_list link;
+	char *name;
+	int32_t refresh;
+	uint32_t repaints;
+	uint32_t frames_presented;
+	uint32_t vblanks_missed;
+	uint32_t views;
+	uint32_t plane_views;
+	uint32_t plane_cache_hits;
+	uint32_t plane_cache_misses;
+	uint32_t histogram[HISTOGRAM_BUCKETS];
+};
+
+struct client_sample {
+	struct wl_list link;
+	int32_t pid;
+	uint32_t commits;
+};
+
+struct sample {
+	struct timespec time;
+	uint64_t upload_bytes;
+	uint32_t commits;
+	struct wl_list output_list;
+	struct wl_list client_list;
+	bool done;
+};
+
+static int32_t option_interval = 1000;
+static int32_t option_count = 1;
+static int32_t option_help;
+
+static const struct weston_option stats_options[] = {
+	{ WESTON_OPTION_INTEGER, "interval", 'i', &option_interval },
+	{ WESTON_OPTION_INTEGER, "count", 'n', &option_count },
+	{ WESTON_OPTION_BOOLEAN, "help", 'h', &option_help },
+};
+
+static void
+report_compositor(void *data, struct weston_stats_report *report,
+		  uint32_t upload_bytes_hi, uint32_t upload_bytes_lo,
+		  uint32_t commits)
+{
+	struct sample *sample = data;
+
+	sample->upload_bytes = (uint64_t) upload_bytes_hi << 32 |
+			       upload_bytes_lo;
+	sample->commits = commits;
+}
+
+static void
+report_output(void *data, struct weston_stats_report *report,
+	      const char *name, int32_t refresh, uint32_t repaints,
+	      uint32_t frames_presented, uint32_t vblanks_missed,
+	      uint32_t views, uint32_t plane_views,
+	      uint32_t plane_cache_hits, uint32_t plane_cache_misses,
+	      struct wl_array *histogram)
+{
+	struct sample *sample = data;
+	struct output_sample *output;
+
+	output = xzalloc(sizeof *output);
+	output->name = xstrdup(name);
+	output->refresh = refresh;
+	output->repaints = repaints;
+	output->frames_presented = frames_presented;
+	output->vblanks_missed = vblanks_missed;
+	output->views = views;
+	output->plane_views = plane_views;
+	output->plane_cache_hits = plane_cache_hits;
+	output->plane_cache_misses = plane_cache_misses;
+	memcpy(output->histogram, histogram->data,
+	       MIN(histogram->size, sizeof output->histogram));
+
+	wl_list_insert(sample->output_list.prev, &output->link);
+}
+
+static void
+report_client(void *data, struct weston_stats_report *report,
+	      int32_t pid, uint32_t commits)
+{
+	struct sample *sample = data;
+	struct client_sample *client;
+
+	client = xzalloc(sizeof *client);
+	client->pid = pid;
+	client->commits = commits;
+
+	wl_list_insert(sample->client_list.prev, &client->link);
+}
+
+static void
+report_done(void *data, struct weston_stats_report *report)
+{
+	struct sample *sample = data;
+
+	sample->done = true;
+}
+
+static const struct weston_stats_report_listener report_listener = {
+	report_compositor,
+	report_output,
+	report_client,
+	report_done
+};
+
+static void
+sample_init(struct sample *sample)
+{
+	memset(sample, 0, sizeof *sample);
+	wl_list_init(&sample->output_list);
+	wl_list_init(&sample->client_list);
+}
+
+static void
+sample_release(struct sample *sample)
+{
+	struct output_sample *output, *onext;
+	struct client_sample *client, *cnext;
+
+	wl_list_for_each_safe(output, onext, &sample->output_list, link) {
+		free(output->name);
+		free(output);
+	}
+
+	wl_list_for_each_safe(client, cnext, &sample->client_list, link)
+		free(client);
+
+	sample_init(sample);
+}
+
+static int
+take_sample(struct wl_display *display, struct weston_stats *stats,
+	    struct sample *sample)
+{
+	struct weston_stats_report *report;
+	int ret = 0;
+
+	sample_release(sample);
+
+	report = weston_stats_sample(stats);
+	weston_stats_report_add_listener(report, &report_listener, sample);
+	clock_gettime(CLOCK_MONOTONIC, &sample->time);
+
+	while (!sample->done && ret >= 0)
+		ret = wl_display_dispatch(display);
+
+	/* The compositor destroyed its side after the done event. */
+	weston_stats_report_destroy(report);
+
+	return ret < 0 ? -1 : 0;
+}
+
+static struct output_sample *
+find_output(struct sample *sample, const char *name)
+{
+	struct output_sample *output;
+
+	wl_list_for_each(output, &sample->output_list, link)
+		if (strcmp(output->name, name) == 0)
+			return output;
+
+	return NULL;
+}
+
+static struct client_sample *
+find_client(struct sample *sample, int32_t pid)
+{
+	struct client_sample *client;
+
+	wl_list_for_each(client, &sample->client_list, link)
+		if (client->pid == pid)
+			return client;
+
+	return NULL;
+}
+
+static void
+print_output(struct output_sample *output, struct output_sample *prev,
+	     double seconds)
+{
+	static const char *const bucket_names[HISTOGRAM_BUCKETS] = {
+		"<0.25", "<0.5", "<1", "<2", "<4",
+		"<8", "<16", "<32", "<64", ">=64"
+	};
+	uint32_t repaints, frames, missed, views, plane_views;
+	uint32_t hits, misses;
+	int i;
+
+	printf("output %s, %.3f Hz\n", output->name,
+	       output->refresh / 1000.0);
+
+	/* Counters are 32 bits and wrap, differences do not care. */
+	repaints = output->repaints - prev->repaints;
+	frames = output->frames_presented - prev->frames_presented;
+	missed = output->vblanks_missed - prev->vblanks_missed;
+	views = output->views - prev->views;
+	plane_views = output->plane_views - prev->plane_views;
+	hits = output->plane_cache_hits - prev->plane_cache_hits;
+	misses = output->plane_cache_misses - prev->plane_cache_misses;
+
+	printf("\tframes presented: %u, %.1f/s\n",
+	       output->frames_presented, frames / seconds);
+	printf("\tvblanks missed: %u, %.1f/s\n",
+	       output->vblanks_missed, missed / seconds);
+	printf("\trepaints: %u, %.1f/s\n", output->repaints,
+	       repaints / seconds);
+	if (repaints > 0)
+		printf("\tper repaint: %.1f views, %.1f on planes\n",
+		       (double) views / repaints,
+		       (double) plane_views / repaints);
+	if (hits + misses > 0)
+		printf("\tplane assignments reused: %.1f%%\n",
+		       100.0 * hits / (hits + misses));
+
+	printf("\trepaint time (ms):");
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++)
+		printf(" %s: %u", bucket_names[i],
+		       output->histogram[i] - prev->histogram[i]);
+	printf("\n");
+}
+
+static void
+print_sample(struct sample *sample, struct sample *prev)
+{
+	struct output_sample *output, *prev_output, zero_output;
+	struct client_sample *client, *prev_client;
+	uint32_t commits;
+	double seconds;
+
+	seconds = (sample->time.tv_sec - prev->time.tv_sec) +
+		  (sample->time.tv_nsec - prev->time.tv_nsec) / 1e9;
+	if (seconds <= 0.0)
+		seconds = 1.0;
+
+	printf("compositor\n");
+	printf("\tuploaded: %.1f MiB, %.1f MiB/s\n",
+	       sample->upload_bytes / 1048576.0,
+	       (sample->upload_bytes - prev->upload_bytes) /
+	       1048576.0 / seconds);
+	printf("\tcommits: %u, %.1f/s\n", sample->commits,
+	       (uint32_t) (sample->commits - prev->commits) / seconds);
+
+	memset(&zero_output, 0, sizeof zero_output);
+	wl_list_for_each(output, &sample->output_list, link) {
+		prev_output = find_output(prev, output->name);
+		print_output(output, prev_output ? prev_output : &zero_output,
+			     seconds);
+	}
+
+	wl_list_for_each(client, &sample->client_list, link) {
+		prev_client = find_client(prev, client->pid);
+		commits = client->commits;
+		if (prev_client)
+			commits -= prev_client->commits;
+		printf("client %d\n\tcommits: %u, %.1f/s\n",
+		       client->pid, client->commits, commits / seconds);
+	}
+}
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct weston_stats **stats = data;
+
+	if (strcmp(interface, "weston_stats") == 0)
+		*stats = wl_registry_bind(registry, name,
+					  &weston_stats_interface, 1);
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static void
+usage(int error_code)
+{
+	fprintf(error_code ? stderr : stdout,
+		"Usage: weston-stats [OPTIONS]\n\n"
+		"Prints the performance counters of the compositor, which\n"
+		"needs performance-stats=true in the [core] section of\n"
+		"weston.ini.\n\n"
+		"  -i, --interval=MS\tsampling interval, default 1000\n"
+		"  -n, --count=N\t\treports to print, 0 for no limit, "
+		"default 1\n"
+		"  -h, --help\t\tthis help text\n");
+
+	exit(error_code);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct weston_stats *stats = NULL;
+	struct sample samples[2], *sample, *prev;
+	struct timespec interval;
+	int i, ret = 0;
+
+	if (parse_options(stats_options, ARRAY_LENGTH(stats_options),
+			  &argc, argv) > 1 || option_help)
+		usage(option_help ? EXIT_SUCCESS : EXIT_FAILURE);
+
+	if (option_interval <= 0 || option_count < 0)
+		usage(EXIT_FAILURE);
+
+	display = wl_display_connect(NULL);
+	if (!display) {
+		fprintf(stderr, "failed to create display: %m\n");
+		return -1;
+	}
+
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &stats);
+	wl_display_roundtrip(display);
+
+	if (!stats) {
+		fprintf(stderr, "weston_stats not available, set "
+			"performance-stats=true in weston.ini\n");
+		return -1;
+	}
+
+	sample_init(&samples[0]);
+	sample_init(&samples[1]);
+	interval.tv_sec = option_interval / 1000;
+	interval.tv_nsec = (option_interval % 1000) * 1000000;
+
+	if (take_sample(display, stats, &samples[0]) < 0)
+		ret = -1;
+
+	for (i = 1; ret == 0 && (option_count == 0 || i <= option_count);
+	     i++) {
+		sample = &samples[i % 2];
+		prev = &samples[(i + 1) % 2];
+
+		nanosleep(&interval, NULL);
+		if (take_sample(display, stats, sample) < 0) {
+			ret = -1;
+			break;
+		}
+
+		if (i > 1)
+			printf("\n");
+		print_sample(sample, prev);
+		fflush(stdout);
+	}
+
+	if (ret < 0)
+		fprintf(stderr, "lost the connection to the compositor\n");
+
+	sample_release(&samples[0]);
+	sample_release(&samples[1]);
+	weston_stats_destroy(stats);
+	wl_registry_destroy(registry);
+	wl_display_disconnect(display);
+
+	return ret;
+}
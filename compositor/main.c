@@ -584,6 +584,12 @@ usage(int error_code)
 		"  --transform=TR\tThe output transformation, TR is one of:\n"
 		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
 		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n"
+		"  --refresh=MHZ\t\tRefresh rate of the outputs in mHz (default: 60000)\n"
+		"  --unthrottled\t\tFinish frames as soon as they are drawn\n"
+		"  --virtual-clock\tOnly advance the clock when a test steps it\n"
+		"  --shm-buffers=N\tDraw into N buffers in shared memory that other\n"
+		"\t\t\tprocesses can map, with --use-pixman\n"
+		"  --output-count=COUNT\tCreate multiple outputs\n"
 		"  --no-outputs\t\tDo not create any virtual outputs\n"
 		"\n");
 #endif
@@ -846,6 +852,15 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int repaint_margin;
+	int adaptive_repaint;
+	int occluded_frame_rate;
+	int performance_stats;
+	int pixman_threads;
+	int pixman_transform_cache;
+	int gl_upload_buffers;
+	int gl_atlas_max_size;
+	int gl_program_cache;
 	int vt_switching;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
@@ -884,6 +899,73 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	weston_log("Output repaint window is %d ms maximum.\n",
 		   ec->repaint_msec);
 
+	weston_config_section_get_bool(s, "adaptive-repaint-window",
+				       &adaptive_repaint, false);
+	ec->repaint_adaptive = adaptive_repaint;
+	weston_config_section_get_int(s, "repaint-margin", &repaint_margin,
+				      ec->repaint_margin_msec);
+	if (repaint_margin < 0 || repaint_margin > 1000) {
+		weston_log("Invalid repaint-margin value in config: %d\n",
+			   repaint_margin);
+	} else {
+		ec->repaint_margin_msec = repaint_margin;
+	}
+	if (ec->repaint_adaptive)
+		weston_log("Output repaint window adapts to repaint times, "
+			   "with a %d ms margin.\n", ec->repaint_margin_msec);
+
+	weston_config_section_get_int(s, "occluded-frame-rate",
+				      &occluded_frame_rate, 0);
+	if (occluded_frame_rate < 0 || occluded_frame_rate > 1000) {
+		weston_log("Invalid occluded-frame-rate value in config: %d\n",
+			   occluded_frame_rate);
+	} else if (occluded_frame_rate > 0) {
+		ec->occluded_frame_msec = 1000 / occluded_frame_rate;
+		weston_log("Frame callbacks of occluded surfaces are limited "
+			   "to %d Hz.\n", occluded_frame_rate);
+	}
+
+	weston_config_section_get_int(s, "pixman-threads", &pixman_threads, 1);
+	if (pixman_threads < 1 || pixman_threads > 64)
+		weston_log("Invalid pixman-threads value in config: %d\n",
+			   pixman_threads);
+	else
+		ec->pixman_threads = pixman_threads;
+
+	weston_config_section_get_int(s, "pixman-transform-cache",
+				      &pixman_transform_cache, 0);
+	if (pixman_transform_cache < 0 || pixman_transform_cache > 4096)
+		weston_log("Invalid pixman-transform-cache value in config: "
+			   "%d\n", pixman_transform_cache);
+	else
+		ec->pixman_transform_cache_size =
+			(size_t) pixman_transform_cache << 20;
+
+	weston_config_section_get_int(s, "gl-upload-buffers",
+				      &gl_upload_buffers, 0);
+	if (gl_upload_buffers < 0 || gl_upload_buffers > 16)
+		weston_log("Invalid gl-upload-buffers value in config: %d\n",
+			   gl_upload_buffers);
+	else
+		ec->gl_upload_buffers = gl_upload_buffers;
+
+	weston_config_section_get_int(s, "gl-atlas-max-size",
+				      &gl_atlas_max_size, 0);
+	if (gl_atlas_max_size < 0 || gl_atlas_max_size > 256)
+		weston_log("Invalid gl-atlas-max-size value in config: %d\n",
+			   gl_atlas_max_size);
+	else
+		ec->gl_atlas_max_size = gl_atlas_max_size;
+
+	weston_config_section_get_bool(s, "gl-program-cache",
+				       &gl_program_cache, false);
+	ec->gl_program_cache = gl_program_cache;
+
+	weston_config_section_get_bool(s, "performance-stats",
+				       &performance_stats, false);
+	if (performance_stats && stats_interface_create(ec) < 0)
+		return -1;
+
 	return 0;
 }
 
@@ -1212,12 +1294,32 @@ static void
 headless_backend_output_configure(struct wl_listener *listener, void *data)
 {
 	struct weston_output *output = data;
+	struct weston_config *wc = wet_get_config(output->compositor);
+	const struct weston_headless_output_api *api =
+		weston_headless_output_get_api(output->compositor);
+	struct weston_config_section *section;
 	struct wet_output_config defaults = {
 		.width = 1024,
 		.height = 640,
 		.scale = 1,
 		.transform = WL_OUTPUT_TRANSFORM_NORMAL
 	};
+	int32_t refresh;
+	int unthrottled;
+
+	section = weston_config_get_section(wc, "output", "name", output->name);
+	if (section && api) {
+		weston_config_section_get_int(section, "refresh", &refresh, 0);
+		weston_config_section_get_bool(section, "unthrottled",
+					       &unthrottled, 0);
+
+		if ((refresh > 0 || unthrottled) &&
+		    api->output_set_refresh(output,
+					    refresh > 0 ? refresh : 60000,
+					    unthrottled) < 0)
+			weston_log("Cannot set the refresh rate of "
+				   "output \"%s\".\n", output->name);
+	}
 
 	if (wet_configure_windowed_output_from_config(output, &defaults) < 0)
 		weston_log("Cannot configure output \"%s\".\n", output->name);
@@ -1229,9 +1331,15 @@ load_headless_backend(struct weston_compositor *c,
 {
 	const struct weston_windowed_output_api *api;
 	struct weston_headless_backend_config config = {{ 0, }};
+	struct weston_config_section *section;
 	int no_outputs = 0;
+	int option_count = 1;
+	int output_count = 0;
+	char const *section_name;
+	char *output_name;
 	int ret = 0;
 	char *transform = NULL;
+	int i;
 
 	struct wet_output_config *parsed_options = wet_init_parsed_options(c);
 	if (!parsed_options)
@@ -1242,6 +1350,11 @@ load_headless_backend(struct weston_compositor *c,
 		{ WESTON_OPTION_INTEGER, "height", 0, &parsed_options->height },
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &config.use_pixman },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
+		{ WESTON_OPTION_INTEGER, "refresh", 0, &config.refresh },
+		{ WESTON_OPTION_BOOLEAN, "unthrottled", 0, &config.unthrottled },
+		{ WESTON_OPTION_BOOLEAN, "virtual-clock", 0, &config.virtual_clock },
+		{ WESTON_OPTION_INTEGER, "shm-buffers", 0, &config.shm_buffers },
+		{ WESTON_OPTION_INTEGER, "output-count", 0, &option_count },
 		{ WESTON_OPTION_BOOLEAN, "no-outputs", 0, &no_outputs },
 	};
 
@@ -1267,16 +1380,56 @@ load_headless_backend(struct weston_compositor *c,
 
 	wet_set_pending_output_handler(c, headless_backend_output_configure);
 
-	if (!no_outputs) {
-		api = weston_windowed_output_get_api(c);
+	if (no_outputs)
+		return 0;
 
-		if (!api) {
-			weston_log("Cannot use weston_windowed_output_api.\n");
+	api = weston_windowed_output_get_api(c);
+
+	if (!api) {
+		weston_log("Cannot use weston_windowed_output_api.\n");
+		return -1;
+	}
+
+	/* Outputs configured in weston.ini come first, so that their
+	 * sizes, scales and transforms can differ. */
+	section = NULL;
+	while (weston_config_next_section(wc, &section, &section_name)) {
+		if (output_count >= option_count)
+			break;
+
+		if (strcmp(section_name, "output") != 0)
+			continue;
+
+		weston_config_section_get_string(section, "name", &output_name, NULL);
+		if (output_name == NULL ||
+		    strncmp(output_name, "headless", strlen("headless")) != 0) {
+			free(output_name);
+			continue;
+		}
+
+		if (api->output_create(c, output_name) < 0) {
+			free(output_name);
 			return -1;
 		}
+		free(output_name);
+
+		output_count++;
+	}
+
+	for (i = output_count; i < option_count; i++) {
+		if (i == 0)
+			output_name = strdup("headless");
+		else if (asprintf(&output_name, "headless%d", i) < 0)
+			output_name = NULL;
 
-		if (api->output_create(c, "headless") < 0)
+		if (!output_name)
 			return -1;
+
+		if (api->output_create(c, output_name) < 0) {
+			free(output_name);
+			return -1;
+		}
+		free(output_name);
 	}
 
 	return 0;
@@ -78,6 +78,12 @@ struct shared_output {
 	pixman_image_t *cache_image;
 	uint32_t *tmp_data;
 	size_t tmp_data_size;
+
+	/* The damage of a frame, in buffer coordinates, waiting for the
+	 * pixels of its extents to be read back. */
+	struct weston_pixels_readback readback;
+	pixman_region32_t readback_damage;
+	bool reading;
 };
 
 struct ss_seat {
@@ -787,6 +793,57 @@ struct zwp_fullscreen_shell_mode_feedback_v1_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+/* Copies the damage from the pixels read back for its extents, rows
+ * bottom to top if the capture is y-flipped, into the cache image. */
+static void
+shared_output_update_cache(struct shared_output *so, const uint32_t *pixels)
+{
+	pixman_box32_t *r, *e;
+	uint32_t *cache_data;
+	int32_t width, height, stride, src_stride;
+	int i, nrects, do_yflip;
+
+	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	e = pixman_region32_extents(&so->readback_damage);
+	src_stride = e->x2 - e->x1;
+	stride = pixman_image_get_stride(so->cache_image) / 4;
+	cache_data = pixman_image_get_data(so->cache_image);
+
+	r = pixman_region32_rectangles(&so->readback_damage, &nrects);
+	for (i = 0; i < nrects; ++i) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (do_yflip)
+			pixman_blt((uint32_t *) pixels, cache_data,
+				   -src_stride, stride, 32, 32,
+				   r[i].x1 - e->x1, r[i].y1 + 1 - e->y2,
+				   r[i].x1, r[i].y1, width, height);
+		else
+			pixman_blt((uint32_t *) pixels, cache_data,
+				   src_stride, stride, 32, 32,
+				   r[i].x1 - e->x1, r[i].y1 - e->y1,
+				   r[i].x1, r[i].y1, width, height);
+	}
+
+	so->cache_dirty = 1;
+
+	shared_output_update(so);
+}
+
+static void
+shared_output_readback_done(struct weston_pixels_readback *readback,
+			    const void *pixels)
+{
+	struct shared_output *so =
+		container_of(readback, struct shared_output, readback);
+
+	so->reading = false;
+	if (pixels)
+		shared_output_update_cache(so, pixels);
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
@@ -795,9 +852,15 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	pixman_region32_t damage;
 	struct ss_shm_buffer *sb;
 	int32_t x, y, width, height, stride;
-	int i, nrects, do_yflip;
-	pixman_box32_t *r;
-	uint32_t *cache_data;
+	int do_yflip;
+	pixman_box32_t *e;
+
+	/* The damage of this frame is lost if the last one is still
+	 * being read, so read the whole output next time. */
+	if (so->reading) {
+		weston_output_damage(so->output);
+		return;
+	}
 
 	/* Damage in output coordinates */
 	pixman_region32_init(&damage);
@@ -838,44 +901,43 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 		pixman_region32_init_rect(&damage, 0, 0, width, height);
 	}
 
-	if (shared_output_ensure_tmp_data(so, &damage) < 0) {
-		shared_output_destroy(so);
+	pixman_region32_copy(&so->readback_damage, &damage);
+	pixman_region32_fini(&damage);
+
+	if (!pixman_region32_not_empty(&so->readback_damage)) {
+		shared_output_update_cache(so, NULL);
 		return;
 	}
 
-	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	e = pixman_region32_extents(&so->readback_damage);
+	x = e->x1;
+	width = e->x2 - e->x1;
+	height = e->y2 - e->y1;
 
-	cache_data = pixman_image_get_data(so->cache_image);
-	r = pixman_region32_rectangles(&damage, &nrects);
-	for (i = 0; i < nrects; ++i) {
-		x = r[i].x1;
-		y = r[i].y1;
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
+	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	if (do_yflip)
+		y = so->output->current_mode->height - e->y2;
+	else
+		y = e->y1;
 
-		if (do_yflip) {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, so->output->current_mode->height - r[i].y2,
-				width, height);
-
-			pixman_blt(so->tmp_data, cache_data, -width, stride,
-				   32, 32, 0, 1 - height, x, y, width, height);
-		} else {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, y, width, height);
-
-			pixman_blt(so->tmp_data, cache_data, width, stride,
-				   32, 32, 0, 0, x, y, width, height);
-		}
+	if (weston_output_read_pixels_async(so->output, &so->readback,
+					    PIXMAN_a8r8g8b8,
+					    x, y, width, height,
+					    shared_output_readback_done) == 0) {
+		so->reading = true;
+		return;
 	}
 
-	pixman_region32_fini(&damage);
-
-	so->cache_dirty = 1;
+	if (shared_output_ensure_tmp_data(so, &so->readback_damage) < 0) {
+		shared_output_destroy(so);
+		return;
+	}
 
-	shared_output_update(so);
+	so->output->compositor->renderer->read_pixels(so->output,
+						      PIXMAN_a8r8g8b8,
+						      so->tmp_data,
+						      x, y, width, height);
+	shared_output_update_cache(so, so->tmp_data);
 }
 
 static struct shared_output *
@@ -891,6 +953,8 @@ shared_output_create(struct weston_output *output, int parent_fd)
 		goto err_close;
 
 	wl_list_init(&so->seat_list);
+	wl_list_init(&so->readback.link);
+	pixman_region32_init(&so->readback_damage);
 
 	so->parent.display = wl_display_connect_to_fd(parent_fd);
 	if (!so->parent.display)
@@ -999,6 +1063,9 @@ shared_output_destroy(struct shared_output *so)
 	wl_list_remove(&so->output_destroyed.link);
 	wl_list_remove(&so->frame_listener.link);
 
+	weston_pixels_readback_cancel(&so->readback);
+	pixman_region32_fini(&so->readback_damage);
+
 	pixman_image_unref(so->cache_image);
 	free(so->tmp_data);
 
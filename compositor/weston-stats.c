@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "compositor.h"
+#include "weston.h"
+#include "weston-stats-server-protocol.h"
+#include "shared/helpers.h"
+#include "shared/zalloc.h"
+
+/* Serves the performance counters of libweston over the weston_stats
+ * protocol, for weston-stats and monitoring tools. */
+
+struct stats_interface {
+	struct weston_compositor *compositor;
+	struct wl_global *global;
+	struct wl_listener destroy_listener;
+};
+
+static void
+send_output_stats(struct wl_resource *report, struct weston_output *output)
+{
+	struct weston_output_stats *stats = &output->stats;
+	struct wl_array histogram;
+	uint32_t *buckets;
+
+	wl_array_init(&histogram);
+	buckets = wl_array_add(&histogram, sizeof stats->repaint_histogram);
+	if (!buckets) {
+		wl_resource_post_no_memory(report);
+		return;
+	}
+	memcpy(buckets, stats->repaint_histogram,
+	       sizeof stats->repaint_histogram);
+
+	weston_stats_report_send_output(report, output->name,
+					output->current_mode->refresh,
+					output->repaint_timing.repaints,
+					stats->frames_presented,
+					stats->vblanks_missed,
+					stats->views,
+					stats->plane_views,
+					stats->plane_cache_hits,
+					stats->plane_cache_misses,
+					&histogram);
+
+	wl_array_release(&histogram);
+}
+
+static void
+stats_sample(struct wl_client *client, struct wl_resource *resource,
+	     uint32_t id)
+{
+	struct stats_interface *stats = wl_resource_get_user_data(resource);
+	struct weston_compositor *ec = stats->compositor;
+	struct weston_client_stats *client_stats;
+	struct weston_output *output;
+	struct wl_resource *report;
+	pid_t pid;
+
+	report = wl_resource_create(client, &weston_stats_report_interface,
+				    1, id);
+	if (!report) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	weston_stats_report_send_compositor(report, ec->upload_bytes >> 32,
+					    ec->upload_bytes & 0xffffffff,
+					    ec->commits);
+
+	wl_list_for_each(output, &ec->output_list, link)
+		send_output_stats(report, output);
+
+	wl_list_for_each(client_stats, &ec->client_stats_list, link) {
+		wl_client_get_credentials(client_stats->client,
+					  &pid, NULL, NULL);
+		weston_stats_report_send_client(report, pid,
+						client_stats->commits);
+	}
+
+	weston_stats_report_send_done(report);
+	wl_resource_destroy(report);
+}
+
+static void
+stats_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct weston_stats_interface stats_implementation = {
+	stats_destroy,
+	stats_sample
+};
+
+static void
+bind_stats(struct wl_client *client, void *data, uint32_t version,
+	   uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_stats_interface, 1, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &stats_implementation,
+				       data, NULL);
+}
+
+static void
+stats_interface_destroy(struct wl_listener *listener, void *data)
+{
+	struct stats_interface *stats =
+		container_of(listener, struct stats_interface,
+			     destroy_listener);
+
+	wl_global_destroy(stats->global);
+	free(stats);
+}
+
+WL_EXPORT int
+stats_interface_create(struct weston_compositor *ec)
+{
+	struct stats_interface *stats;
+
+	stats = zalloc(sizeof *stats);
+	if (stats == NULL)
+		return -1;
+
+	stats->compositor = ec;
+	stats->global = wl_global_create(ec->wl_display,
+					 &weston_stats_interface, 1,
+					 stats, bind_stats);
+	if (stats->global == NULL) {
+		free(stats);
+		return -1;
+	}
+
+	stats->destroy_listener.notify = stats_interface_destroy;
+	wl_signal_add(&ec->destroy_signal, &stats->destroy_listener);
+
+	return 0;
+}
@@ -850,9 +850,15 @@ commit_screen_list(struct ivi_layout *layout)
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_layer   *next     = NULL;
 	struct ivi_layout_view *ivi_view = NULL;
-
-	/* Clear view list of layout ivi_layer */
-	wl_list_init(&layout->layout_layer.view_list.link);
+	struct weston_view *view, *view_next;
+
+	/* Clear view list of layout ivi_layer. Going through
+	 * weston_layer_entry_remove() marks the compositor's view list
+	 * dirty, even when no view gets inserted again below. */
+	wl_list_for_each_safe(view, view_next,
+			      &layout->layout_layer.view_list.link,
+			      layer_link.link)
+		weston_layer_entry_remove(&view->layer_link);
 
 	wl_list_for_each(iviscrn, &layout->screen_list, link) {
 		if (iviscrn->order.dirty) {
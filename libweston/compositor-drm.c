@@ -59,6 +59,7 @@
 #include "vaapi-recorder.h"
 #include "presentation-time-server-protocol.h"
 #include "linux-dmabuf.h"
+#include "drm-plane-cache.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
 #define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
@@ -185,6 +186,8 @@ struct drm_output {
 
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+
+	struct drm_plane_cache plane_cache;
 };
 
 /*
@@ -1252,6 +1255,66 @@ drm_output_set_cursor(struct drm_output *output)
 	}
 }
 
+struct drm_plane_try_data {
+	struct drm_output *output;
+	struct weston_view *ev;
+	struct weston_plane *plane;
+};
+
+static bool
+drm_output_try_plane(void *data, enum drm_plane_kind kind)
+{
+	struct drm_plane_try_data *try = data;
+
+	switch (kind) {
+	case DRM_PLANE_KIND_CURSOR:
+		try->plane = drm_output_prepare_cursor_view(try->output,
+							    try->ev);
+		break;
+	case DRM_PLANE_KIND_SCANOUT:
+		try->plane = drm_output_prepare_scanout_view(try->output,
+							     try->ev);
+		break;
+	case DRM_PLANE_KIND_OVERLAY:
+		try->plane = drm_output_prepare_overlay_view(try->output,
+							     try->ev);
+		break;
+	default:
+		try->plane = NULL;
+		break;
+	}
+
+	return try->plane != NULL;
+}
+
+static void
+drm_view_plane_key(struct weston_view *ev, bool overlapped,
+		   struct drm_plane_cache_key *key)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+
+	memset(key, 0, sizeof *key);
+	key->view = ev;
+	key->transform_serial = ev->transform.serial;
+	key->width = ev->surface->width;
+	key->height = ev->surface->height;
+
+	if (!buffer)
+		key->buffer_type = 0;
+	else if (wl_shm_buffer_get(buffer->resource))
+		key->buffer_type = 1;
+	else if (linux_dmabuf_buffer_get(buffer->resource))
+		key->buffer_type = 2;
+	else
+		key->buffer_type = 3;
+
+	key->buffer_transform = ev->surface->buffer_viewport.buffer.transform;
+	key->buffer_scale = ev->surface->buffer_viewport.buffer.scale;
+	key->alpha = ev->alpha;
+	key->output_mask = ev->output_mask;
+	key->overlapped = overlapped;
+}
+
 static void
 drm_assign_planes(struct weston_output *output_base)
 {
@@ -1260,6 +1323,9 @@ drm_assign_planes(struct weston_output *output_base)
 	struct weston_view *ev, *next;
 	pixman_region32_t overlap, surface_overlap;
 	struct weston_plane *primary, *next_plane;
+	struct drm_plane_try_data try = { .output = output };
+	struct drm_plane_cache_key key;
+	enum drm_plane_kind kind;
 
 	/*
 	 * Find a surface for each sprite in the output using some heuristics:
@@ -1273,8 +1339,12 @@ drm_assign_planes(struct weston_output *output_base)
 	 * the main display surface may not need to update at all, and
 	 * the client buffer can be used directly for the sprite surface
 	 * as we do for flipping full screen surfaces.
+	 *
+	 * Most repaints end up with the same assignment as the previous
+	 * one, so the plane cache first tries the planes the views had then.
 	 */
 	pixman_region32_init(&overlap);
+	drm_plane_cache_begin(&output->plane_cache);
 	primary = &output_base->compositor->primary_plane;
 
 	wl_list_for_each_safe(ev, next, &output_base->compositor->view_list, link) {
@@ -1301,17 +1371,17 @@ drm_assign_planes(struct weston_output *output_base)
 		pixman_region32_intersect(&surface_overlap, &overlap,
 					  &ev->transform.boundingbox);
 
-		next_plane = NULL;
-		if (pixman_region32_not_empty(&surface_overlap))
-			next_plane = primary;
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_cursor_view(output, ev);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_scanout_view(output, ev);
-		if (next_plane == NULL)
-			next_plane = drm_output_prepare_overlay_view(output, ev);
-		if (next_plane == NULL)
+		drm_view_plane_key(ev,
+				   pixman_region32_not_empty(&surface_overlap),
+				   &key);
+		try.ev = ev;
+		try.plane = NULL;
+		kind = drm_plane_cache_assign(&output->plane_cache, &key,
+					      drm_output_try_plane, &try);
+		if (kind == DRM_PLANE_KIND_PRIMARY)
 			next_plane = primary;
+		else
+			next_plane = try.plane;
 
 		weston_view_move_to_plane(ev, next_plane);
 
@@ -1333,6 +1403,10 @@ drm_assign_planes(struct weston_output *output_base)
 		pixman_region32_fini(&surface_overlap);
 	}
 	pixman_region32_fini(&overlap);
+
+	drm_plane_cache_end(&output->plane_cache);
+	output_base->stats.plane_cache_hits += output->plane_cache.hits;
+	output_base->stats.plane_cache_misses += output->plane_cache.misses;
 }
 
 static void
@@ -1415,6 +1489,7 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 
 	/* reset rendering stuff. */
+	drm_plane_cache_invalidate(&output->plane_cache);
 	drm_output_release_fb(output, output->current);
 	drm_output_release_fb(output, output->next);
 	output->current = output->next = NULL;
@@ -2443,6 +2518,7 @@ drm_output_deinit(struct weston_output *base)
 
 	weston_plane_release(&output->fb_plane);
 	weston_plane_release(&output->cursor_plane);
+	drm_plane_cache_invalidate(&output->plane_cache);
 
 	drmModeFreeProperty(output->dpms_prop);
 
@@ -2481,6 +2557,8 @@ drm_output_destroy(struct weston_output *base)
 	if (output->backlight)
 		backlight_destroy(output->backlight);
 
+	drm_plane_cache_release(&output->plane_cache);
+
 	b->crtc_allocator &= ~(1 << output->crtc_id);
 	b->connector_allocator &= ~(1 << output->connector_id);
 
@@ -2558,6 +2636,7 @@ create_output_for_connector(struct drm_backend *b,
 	output->destroy_pending = 0;
 	output->disable_pending = 0;
 	output->original_crtc = NULL;
+	drm_plane_cache_init(&output->plane_cache);
 
 	b->crtc_allocator |= (1 << output->crtc_id);
 	b->connector_allocator |= (1 << output->connector_id);
@@ -2954,6 +3033,7 @@ planes_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	       void *data)
 {
 	struct drm_backend *b = data;
+	struct drm_output *output;
 
 	switch (key) {
 	case KEY_C:
@@ -2968,6 +3048,10 @@ planes_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	default:
 		break;
 	}
+
+	/* Views left on the primary plane would stay there otherwise. */
+	wl_list_for_each(output, &b->compositor->output_list, base.link)
+		drm_plane_cache_invalidate(&output->plane_cache);
 }
 
 #ifdef BUILD_VAAPI_RECORDER
@@ -3112,8 +3196,10 @@ switch_to_gl_renderer(struct drm_backend *b)
 		assert(0);
 	}
 
-	wl_list_for_each(output, &b->compositor->output_list, base.link)
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
 		drm_output_init_egl(output, b);
+		drm_plane_cache_invalidate(&output->plane_cache);
+	}
 
 	b->use_pixman = 0;
 
@@ -28,14 +28,20 @@
 
 #include <assert.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <stdbool.h>
 
 #include "compositor.h"
 #include "compositor-headless.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
 #include "pixman-renderer.h"
 #include "presentation-time-server-protocol.h"
 #include "windowed-output-api.h"
@@ -46,15 +52,44 @@ struct headless_backend {
 
 	struct weston_seat fake_seat;
 	bool use_pixman;
+	int refresh;
+	bool unthrottled;
+	bool virtual_clock;
+	int shm_buffers;
 };
 
 struct headless_output {
 	struct weston_output base;
 
 	struct weston_mode mode;
+	int refresh;			/* mHz */
+	bool unthrottled;
 	struct wl_event_source *finish_frame_timer;
+
+	/* Unthrottled outputs signal the end of a frame through an
+	 * eventfd, so that it is handled along with client requests. */
+	int finish_frame_fd;
+	struct wl_event_source *finish_frame_source;
+
+	/* With the virtual clock, the vblank_count'th vblank since the
+	 * output was enabled happens at vblank_base plus as many refresh
+	 * periods, and a drawn frame waits for it in frame_pending. */
+	int64_t vblank_base;		/* nsec */
+	uint64_t vblank_count;
+	bool frame_pending;
+
 	uint32_t *image_buf;
 	pixman_image_t *image;
+
+	/* Shared-memory framebuffer, see struct weston_headless_fb_header.
+	 * shm_stale holds what changed since each buffer was last drawn. */
+	int shm_buffers;
+	int shm_fd;
+	void *shm_map;
+	size_t shm_size;
+	struct weston_headless_fb_header *shm_header;
+	pixman_image_t *shm_images[WESTON_HEADLESS_FB_MAX_BUFFERS];
+	pixman_region32_t shm_stale[WESTON_HEADLESS_FB_MAX_BUFFERS];
 };
 
 static inline struct headless_output *
@@ -69,13 +104,34 @@ to_headless_backend(struct weston_compositor *base)
 	return container_of(base->backend, struct headless_backend, base);
 }
 
+/* Time of a vblank of the virtual clock, exact for any refresh rate and
+ * without accumulating rounding errors over many frames. */
 static void
-headless_output_start_repaint_loop(struct weston_output *output)
+headless_output_vblank_time(struct headless_output *output, uint64_t count,
+			    struct timespec *ts)
 {
+	int64_t nsec;
+
+	nsec = output->vblank_base +
+	       count / output->refresh * 1000000000000LL +
+	       count % output->refresh * 1000000000000LL / output->refresh;
+	timespec_from_nsec(ts, nsec);
+}
+
+static void
+headless_output_start_repaint_loop(struct weston_output *output_base)
+{
+	struct headless_output *output = to_headless_output(output_base);
+	struct headless_backend *b = to_headless_backend(output_base->compositor);
 	struct timespec ts;
 
-	weston_compositor_read_presentation_clock(output->compositor, &ts);
-	weston_output_finish_frame(output, &ts, WP_PRESENTATION_FEEDBACK_INVALID);
+	if (b->virtual_clock)
+		headless_output_vblank_time(output, output->vblank_count, &ts);
+	else
+		weston_compositor_read_presentation_clock(output_base->compositor,
+							  &ts);
+	weston_output_finish_frame(output_base, &ts,
+				   WP_PRESENTATION_FEEDBACK_INVALID);
 }
 
 static int
@@ -90,19 +146,197 @@ finish_frame_handler(void *data)
 	return 1;
 }
 
+static int
+finish_frame_fd_handler(int fd, uint32_t mask, void *data)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof count) != sizeof count)
+		return 0;
+
+	return finish_frame_handler(data);
+}
+
+static void
+headless_output_repaint_shm(struct headless_output *output,
+			    pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct weston_headless_fb_header *header = output->shm_header;
+	struct weston_headless_fb_frame *frame;
+	pixman_region32_t local, region;
+	pixman_box32_t *extents;
+	struct timespec now;
+	uint64_t seq;
+	int i, j;
+
+	seq = header->seq + 1;
+	i = seq % output->shm_buffers;
+	frame = &header->frames[i];
+
+	/* Readers of the buffer must see that it is being drawn before
+	 * any pixel changes. */
+	__atomic_store_n(&frame->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	pixman_region32_init(&local);
+	pixman_region32_copy(&local, damage);
+	pixman_region32_translate(&local, -output->base.x, -output->base.y);
+
+	/* The buffer still holds frame seq - shm_buffers, so bring
+	 * everything that changed since then up to date. */
+	pixman_region32_init(&region);
+	pixman_region32_copy(&region, &output->shm_stale[i]);
+	pixman_region32_translate(&region, output->base.x, output->base.y);
+	pixman_region32_union(&region, &region, damage);
+	pixman_renderer_output_set_buffer(&output->base,
+					  output->shm_images[i]);
+	ec->renderer->repaint_output(&output->base, &region);
+
+	for (j = 0; j < output->shm_buffers; j++) {
+		if (j == i)
+			pixman_region32_clear(&output->shm_stale[j]);
+		else
+			pixman_region32_union(&output->shm_stale[j],
+					      &output->shm_stale[j], &local);
+	}
+
+	weston_transformed_region(output->base.width, output->base.height,
+				  output->base.transform,
+				  output->base.current_scale,
+				  &local, &region);
+	pixman_region32_fini(&local);
+	extents = pixman_region32_extents(&region);
+	frame->damage_x = extents->x1;
+	frame->damage_y = extents->y1;
+	frame->damage_width = extents->x2 - extents->x1;
+	frame->damage_height = extents->y2 - extents->y1;
+	pixman_region32_fini(&region);
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	frame->time_nsec = timespec_to_nsec(&now);
+
+	__atomic_store_n(&frame->seq, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&header->seq, seq, __ATOMIC_RELEASE);
+}
+
 static int
 headless_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage)
 {
 	struct headless_output *output = to_headless_output(output_base);
 	struct weston_compositor *ec = output->base.compositor;
+	struct headless_backend *b = to_headless_backend(ec);
 
-	ec->renderer->repaint_output(&output->base, damage);
+	if (output->shm_header)
+		headless_output_repaint_shm(output, damage);
+	else
+		ec->renderer->repaint_output(&output->base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	if (b->virtual_clock) {
+		output->frame_pending = true;
+	} else if (output->unthrottled) {
+		uint64_t one = 1;
+
+		if (write(output->finish_frame_fd, &one, sizeof one) !=
+		    sizeof one)
+			weston_log("headless: failed to finish frame: %m\n");
+	} else {
+		wl_event_source_timer_update(output->finish_frame_timer,
+					     MAX((1000000 + output->refresh / 2) /
+						 output->refresh, 1));
+	}
+
+	return 0;
+}
+
+static void
+headless_output_destroy_shm(struct headless_output *output)
+{
+	int i;
+
+	for (i = 0; i < output->shm_buffers; i++) {
+		if (output->shm_images[i])
+			pixman_image_unref(output->shm_images[i]);
+		output->shm_images[i] = NULL;
+		pixman_region32_fini(&output->shm_stale[i]);
+	}
+
+	munmap(output->shm_map, output->shm_size);
+	close(output->shm_fd);
+	output->shm_header = NULL;
+}
+
+static int
+headless_output_create_shm(struct headless_output *output)
+{
+	struct weston_headless_fb_header *header;
+	int width = output->base.current_mode->width;
+	int height = output->base.current_mode->height;
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t offset, buffer_size;
+	char name[64];
+	int i;
+
+	/* Keep the buffers page aligned, so that readers can map them on
+	 * their own. */
+	offset = (sizeof *header + page_size - 1) / page_size * page_size;
+	buffer_size = (size_t)width * height * 4;
+	output->shm_size = offset + buffer_size * output->shm_buffers;
+
+	snprintf(name, sizeof name, "weston-headless-%s", output->base.name);
+	output->shm_fd = os_create_memfd(name, output->shm_size);
+	if (output->shm_fd < 0) {
+		weston_log("headless: creating framebuffer failed: %m\n");
+		return -1;
+	}
+
+	output->shm_map = mmap(NULL, output->shm_size, PROT_READ | PROT_WRITE,
+			       MAP_SHARED, output->shm_fd, 0);
+	if (output->shm_map == MAP_FAILED) {
+		weston_log("headless: mapping framebuffer failed: %m\n");
+		close(output->shm_fd);
+		return -1;
+	}
+
+	header = output->shm_map;
+	header->magic = WESTON_HEADLESS_FB_MAGIC;
+	header->version = WESTON_HEADLESS_FB_VERSION;
+	header->width = width;
+	header->height = height;
+	header->stride = width * 4;
+	header->format = WL_SHM_FORMAT_XRGB8888;
+	header->buffer_count = output->shm_buffers;
+	header->buffer_size = buffer_size;
+	header->buffer_offset = offset;
+	output->shm_header = header;
+
+	/* Each buffer gets fully drawn the first time it is used. Stale
+	 * regions are kept in output coordinates. */
+	for (i = 0; i < output->shm_buffers; i++)
+		pixman_region32_init_rect(&output->shm_stale[i], 0, 0,
+					  output->base.width,
+					  output->base.height);
+
+	for (i = 0; i < output->shm_buffers; i++) {
+		output->shm_images[i] =
+			pixman_image_create_bits(PIXMAN_x8r8g8b8,
+						 width, height,
+						 (uint32_t *)((char *)output->shm_map +
+							      offset +
+							      i * buffer_size),
+						 width * 4);
+		if (!output->shm_images[i]) {
+			headless_output_destroy_shm(output);
+			return -1;
+		}
+	}
+
+	weston_log("Output %s: framebuffer shared as /proc/%d/fd/%d\n",
+		   output->base.name, getpid(), output->shm_fd);
 
 	return 0;
 }
@@ -117,11 +351,21 @@ headless_output_disable(struct weston_output *base)
 		return 0;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->finish_frame_source) {
+		wl_event_source_remove(output->finish_frame_source);
+		close(output->finish_frame_fd);
+		output->finish_frame_source = NULL;
+	}
 
 	if (b->use_pixman) {
 		pixman_renderer_output_destroy(&output->base);
-		pixman_image_unref(output->image);
-		free(output->image_buf);
+
+		if (output->shm_header) {
+			headless_output_destroy_shm(output);
+		} else {
+			pixman_image_unref(output->image);
+			free(output->image_buf);
+		}
 	}
 
 	return 0;
@@ -145,11 +389,46 @@ headless_output_enable(struct weston_output *base)
 	struct headless_backend *b = to_headless_backend(base->compositor);
 	struct wl_event_loop *loop;
 
+	if (b->virtual_clock) {
+		struct timespec now;
+
+		weston_compositor_read_presentation_clock(b->compositor, &now);
+		output->vblank_base = timespec_to_nsec(&now);
+		output->vblank_count = 0;
+		output->frame_pending = false;
+	}
+
 	loop = wl_display_get_event_loop(b->compositor->wl_display);
 	output->finish_frame_timer =
 		wl_event_loop_add_timer(loop, finish_frame_handler, output);
 
-	if (b->use_pixman) {
+	if (output->unthrottled) {
+		output->finish_frame_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (output->finish_frame_fd < 0)
+			goto err_eventfd;
+
+		output->finish_frame_source =
+			wl_event_loop_add_fd(loop, output->finish_frame_fd,
+					     WL_EVENT_READABLE,
+					     finish_frame_fd_handler, output);
+		if (!output->finish_frame_source) {
+			close(output->finish_frame_fd);
+			goto err_eventfd;
+		}
+	}
+
+	if (b->use_pixman && output->shm_buffers > 0) {
+		if (headless_output_create_shm(output) < 0)
+			goto err_malloc;
+
+		if (pixman_renderer_output_create(&output->base) < 0) {
+			headless_output_destroy_shm(output);
+			goto err_malloc;
+		}
+
+		pixman_renderer_output_set_buffer(&output->base,
+						  output->shm_images[0]);
+	} else if (b->use_pixman) {
 		output->image_buf = malloc(output->base.current_mode->width *
 					   output->base.current_mode->height * 4);
 		if (!output->image_buf)
@@ -174,6 +453,12 @@ err_renderer:
 	pixman_image_unref(output->image);
 	free(output->image_buf);
 err_malloc:
+	if (output->finish_frame_source) {
+		wl_event_source_remove(output->finish_frame_source);
+		close(output->finish_frame_fd);
+		output->finish_frame_source = NULL;
+	}
+err_eventfd:
 	wl_event_source_remove(output->finish_frame_timer);
 
 	return -1;
@@ -199,7 +484,7 @@ headless_output_set_size(struct weston_output *base,
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = output_width;
 	output->mode.height = output_height;
-	output->mode.refresh = 60000;
+	output->mode.refresh = output->unthrottled ? 0 : output->refresh;
 	wl_list_init(&output->base.mode_list);
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
@@ -221,10 +506,78 @@ headless_output_set_size(struct weston_output *base,
 	return 0;
 }
 
+static int
+headless_output_set_refresh(struct weston_output *base,
+			    int refresh, bool unthrottled)
+{
+	struct headless_output *output = to_headless_output(base);
+	struct headless_backend *b = to_headless_backend(base->compositor);
+
+	if (output->base.enabled || refresh <= 0)
+		return -1;
+
+	/* Frames only end when the virtual clock is stepped. */
+	if (b->virtual_clock && unthrottled)
+		return -1;
+
+	output->refresh = refresh;
+	output->unthrottled = unthrottled;
+	output->mode.refresh = unthrottled ? 0 : refresh;
+
+	return 0;
+}
+
+static int
+headless_step_frame(struct weston_compositor *compositor)
+{
+	struct headless_backend *b = to_headless_backend(compositor);
+	struct headless_output *output;
+	struct timespec next, ts;
+	bool found = false;
+	int frames = 0;
+
+	if (!b->virtual_clock)
+		return -1;
+
+	wl_list_for_each(output, &compositor->output_list, base.link) {
+		headless_output_vblank_time(output, output->vblank_count + 1,
+					    &ts);
+		if (!found || timespec_to_nsec(&ts) < timespec_to_nsec(&next))
+			next = ts;
+		found = true;
+	}
+
+	if (!found)
+		return 0;
+
+	weston_compositor_set_presentation_clock_virtual(compositor, &next);
+
+	wl_list_for_each(output, &compositor->output_list, base.link) {
+		headless_output_vblank_time(output, output->vblank_count + 1,
+					    &ts);
+		if (timespec_to_nsec(&ts) != timespec_to_nsec(&next))
+			continue;
+
+		output->vblank_count++;
+		output->base.msc++;
+
+		if (!output->frame_pending)
+			continue;
+
+		output->frame_pending = false;
+		weston_output_finish_frame(&output->base, &next,
+					   WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+		frames++;
+	}
+
+	return frames;
+}
+
 static int
 headless_output_create(struct weston_compositor *compositor,
 		       const char *name)
 {
+	struct headless_backend *b = to_headless_backend(compositor);
 	struct headless_output *output;
 
 	/* name can't be NULL. */
@@ -235,6 +588,9 @@ headless_output_create(struct weston_compositor *compositor,
 		return -1;
 
 	output->base.name = strdup(name);
+	output->refresh = b->refresh;
+	output->unthrottled = b->unthrottled;
+	output->shm_buffers = b->shm_buffers;
 	output->base.destroy = headless_output_destroy;
 	output->base.disable = headless_output_disable;
 	output->base.enable = headless_output_enable;
@@ -265,6 +621,11 @@ static const struct weston_windowed_output_api api = {
 	headless_output_create,
 };
 
+static const struct weston_headless_output_api headless_api = {
+	headless_output_set_refresh,
+	headless_step_frame,
+};
+
 static struct headless_backend *
 headless_backend_create(struct weston_compositor *compositor,
 			struct weston_headless_backend_config *config)
@@ -284,6 +645,32 @@ headless_backend_create(struct weston_compositor *compositor,
 	b->base.restore = headless_restore;
 
 	b->use_pixman = config->use_pixman;
+	b->refresh = config->refresh > 0 ? config->refresh : 60000;
+	b->unthrottled = config->unthrottled;
+	b->virtual_clock = config->virtual_clock;
+	b->shm_buffers = config->shm_buffers;
+	if (b->shm_buffers > 0 && !b->use_pixman) {
+		weston_log("headless: shared-memory framebuffers need "
+			   "the pixman renderer\n");
+		b->shm_buffers = 0;
+	}
+	if (b->shm_buffers > WESTON_HEADLESS_FB_MAX_BUFFERS) {
+		weston_log("headless: using %d framebuffers instead of %d\n",
+			   WESTON_HEADLESS_FB_MAX_BUFFERS, b->shm_buffers);
+		b->shm_buffers = WESTON_HEADLESS_FB_MAX_BUFFERS;
+	}
+	if (b->virtual_clock) {
+		/* Start away from zero, which reads as an unset time. */
+		struct timespec start = { .tv_sec = 1 };
+
+		weston_compositor_set_presentation_clock_virtual(compositor,
+								 &start);
+		if (b->unthrottled) {
+			weston_log("headless: unthrottled outputs are not "
+				   "supported with the virtual clock\n");
+			b->unthrottled = false;
+		}
+	}
 	if (b->use_pixman) {
 		pixman_renderer_init(compositor);
 	}
@@ -301,6 +688,14 @@ headless_backend_create(struct weston_compositor *compositor,
 		goto err_input;
 	}
 
+	ret = weston_plugin_api_register(compositor,
+					 WESTON_HEADLESS_OUTPUT_API_NAME,
+					 &headless_api, sizeof(headless_api));
+	if (ret < 0) {
+		weston_log("Failed to register headless output API.\n");
+		goto err_input;
+	}
+
 	return b;
 
 err_input:
@@ -30,19 +30,79 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "compositor.h"
+#include "plugin-registry.h"
+#include "headless-framebuffer.h"
 
-#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 2
+#define WESTON_HEADLESS_BACKEND_CONFIG_VERSION 3
 
 struct weston_headless_backend_config {
 	struct weston_backend_config base;
 
 	/** Whether to use the pixman renderer instead of the OpenGL ES renderer. */
 	int use_pixman;
+
+	/** Refresh rate of new outputs in mHz, 0 for 60 Hz. */
+	int refresh;
+
+	/** Whether new outputs finish a frame as soon as it is drawn
+	 * instead of at the refresh rate, for measuring throughput. */
+	int unthrottled;
+
+	/** Whether to drive the presentation clock virtually: it starts
+	 * at one second and only advances through
+	 * weston_headless_output_api::step_frame, so that frame timing is
+	 * the same on every run. */
+	int virtual_clock;
+
+	/** Number of buffers in the shared-memory framebuffer of new
+	 * outputs, 0 to draw into private memory. Needs the pixman
+	 * renderer. See headless-framebuffer.h. */
+	int shm_buffers;
 };
 
+#define WESTON_HEADLESS_OUTPUT_API_NAME "weston_headless_output_api_v1"
+
+struct weston_headless_output_api {
+	/** Set the frame rate of an output that is not enabled yet.
+	 *
+	 * \param output An output of the headless backend.
+	 * \param refresh Refresh rate in mHz, must not be 0.
+	 * \param unthrottled Whether to finish frames as soon as they are
+	 * drawn; the output then has no refresh rate.
+	 *
+	 * Returns 0 on success, -1 on failure.
+	 */
+	int (*output_set_refresh)(struct weston_output *output,
+				  int refresh, bool unthrottled);
+
+	/** Advance the virtual clock to the next vblank of any output.
+	 *
+	 * \param compositor The compositor of the headless backend.
+	 *
+	 * The outputs whose vblank it is advance their msc and finish the
+	 * frame they have drawn, if any; they repaint right away if there is
+	 * more damage.
+	 *
+	 * Returns the number of frames finished, or -1 if the backend does
+	 * not use the virtual clock.
+	 */
+	int (*step_frame)(struct weston_compositor *compositor);
+};
+
+static inline const struct weston_headless_output_api *
+weston_headless_output_get_api(struct weston_compositor *compositor)
+{
+	const void *api;
+	api = weston_plugin_api_get(compositor, WESTON_HEADLESS_OUTPUT_API_NAME,
+				    sizeof(struct weston_headless_output_api));
+
+	return (const struct weston_headless_output_api *)api;
+}
+
 #ifdef  __cplusplus
 }
 #endif
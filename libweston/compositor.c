@@ -32,6 +32,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -63,8 +64,11 @@
 #include "git-version.h"
 #include "version.h"
 #include "plugin-registry.h"
+#include "slab.h"
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
+#define DEFAULT_REPAINT_MARGIN 2 /* milliseconds */
+#define REPAINT_MIN_SAMPLES 8
 
 static void
 weston_output_transform_scale_init(struct weston_output *output,
@@ -73,6 +77,24 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+weston_compositor_pick_grid_dirty(struct weston_compositor *compositor);
+
+static void
+weston_compositor_pick_grid_move_view(struct weston_compositor *compositor,
+				      struct weston_view *view,
+				      const pixman_box32_t *old_box);
+
+static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor);
+
+static void
+weston_compositor_output_views_dirty(struct weston_compositor *compositor,
+				     uint32_t output_mask);
+
+static void
+weston_compositor_reassign_view_outputs(struct weston_compositor *compositor);
+
 static void weston_mode_switch_finish(struct weston_output *output,
 				      int mode_changed,
 				      int scale_changed)
@@ -93,6 +115,7 @@ static void weston_mode_switch_finish(struct weston_output *output,
 				  output->width, output->height);
 
 	weston_output_update_matrix(output);
+	weston_compositor_reassign_view_outputs(output->compositor);
 
 	/* If a pointer falls outside the outputs new geometry, move it to its
 	 * lower-right corner */
@@ -264,7 +287,7 @@ weston_view_create(struct weston_surface *surface)
 {
 	struct weston_view *view;
 
-	view = zalloc(sizeof *view);
+	view = weston_slab_zalloc(surface->compositor->view_slab);
 	if (view == NULL)
 		return NULL;
 
@@ -451,7 +474,7 @@ weston_surface_create(struct weston_compositor *compositor)
 {
 	struct weston_surface *surface;
 
-	surface = zalloc(sizeof *surface);
+	surface = weston_slab_zalloc(compositor->surface_slab);
 	if (surface == NULL)
 		return NULL;
 
@@ -521,6 +544,36 @@ weston_view_to_global_float(struct weston_view *view,
 	}
 }
 
+/** Transform a polygon from surface to global coordinates
+ *
+ * \param view The view.
+ * \param x The x coordinates, replaced with the transformed ones.
+ * \param y The y coordinates, replaced with the transformed ones.
+ * \param n The number of points.
+ *
+ * Same as weston_view_to_global_float() on each point, but transforms
+ * all of them in one go.
+ */
+WL_EXPORT void
+weston_view_to_global_points(struct weston_view *view,
+			     float *x, float *y, int n)
+{
+	int i;
+
+	if (view->transform.enabled) {
+		if (weston_matrix_transform_xy(&view->transform.matrix,
+					       x, y, n) < 0)
+			weston_log("warning: numerical instability in "
+				   "%s()\n", __func__);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		x[i] += view->geometry.x;
+		y[i] += view->geometry.y;
+	}
+}
+
 WL_EXPORT void
 weston_transformed_coord(int width, int height,
 			 enum wl_output_transform transform,
@@ -1002,6 +1055,20 @@ weston_surface_assign_output(struct weston_surface *es)
 	weston_surface_update_output_mask(es, mask);
 }
 
+/* The outputs a view is shown on, as bits of output ids */
+static uint32_t
+view_output_bits(struct weston_view *view)
+{
+	uint32_t bits = view->output_mask;
+
+	/* A view entirely off-screen still has a primary output, which
+	 * sends the frame callbacks of its surface. */
+	if (view->output)
+		bits |= 1u << view->output->id;
+
+	return bits;
+}
+
 /** Recalculate which output(s) the view is displayed on
  *
  * \param ev  The view to remap to outputs
@@ -1019,9 +1086,10 @@ weston_view_assign_output(struct weston_view *ev)
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct weston_output *output, *new_output;
 	pixman_region32_t region;
-	uint32_t max, area, mask;
+	uint32_t max, area, mask, old_bits;
 	pixman_box32_t *e;
 
+	old_bits = view_output_bits(ev);
 	new_output = NULL;
 	max = 0;
 	mask = 0;
@@ -1046,12 +1114,32 @@ weston_view_assign_output(struct weston_view *ev)
 	}
 	pixman_region32_fini(&region);
 
-	ev->output = new_output;
-	ev->output_mask = mask;
+	if (ev->output != new_output || ev->output_mask != mask) {
+		ev->output = new_output;
+		ev->output_mask = mask;
+		weston_compositor_output_views_dirty(ec, old_bits |
+						     view_output_bits(ev));
+	}
 
 	weston_surface_assign_output(ev->surface);
 }
 
+/** Recalculate the outputs of all views after output geometry changed
+ *
+ * Views with a dirty transform are skipped, they get reassigned when the
+ * transform is next updated.
+ */
+static void
+weston_compositor_reassign_view_outputs(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!view->transform.dirty)
+			weston_view_assign_output(view);
+	}
+}
+
 static void
 weston_view_to_view_map(struct weston_view *from, struct weston_view *to,
 			int from_x, int from_y, int *to_x, int *to_y)
@@ -1086,12 +1174,8 @@ view_compute_bbox(struct weston_view *view, const pixman_box32_t *inbox,
 {
 	float min_x = HUGE_VALF,  min_y = HUGE_VALF;
 	float max_x = -HUGE_VALF, max_y = -HUGE_VALF;
-	int32_t s[4][2] = {
-		{ inbox->x1, inbox->y1 },
-		{ inbox->x1, inbox->y2 },
-		{ inbox->x2, inbox->y1 },
-		{ inbox->x2, inbox->y2 },
-	};
+	float x[4] = { inbox->x1, inbox->x1, inbox->x2, inbox->x2 };
+	float y[4] = { inbox->y1, inbox->y2, inbox->y1, inbox->y2 };
 	float int_x, int_y;
 	int i;
 
@@ -1101,17 +1185,17 @@ view_compute_bbox(struct weston_view *view, const pixman_box32_t *inbox,
 		return;
 	}
 
+	weston_view_to_global_points(view, x, y, 4);
+
 	for (i = 0; i < 4; ++i) {
-		float x, y;
-		weston_view_to_global_float(view, s[i][0], s[i][1], &x, &y);
-		if (x < min_x)
-			min_x = x;
-		if (x > max_x)
-			max_x = x;
-		if (y < min_y)
-			min_y = y;
-		if (y > max_y)
-			max_y = y;
+		if (x[i] < min_x)
+			min_x = x[i];
+		if (x[i] > max_x)
+			max_x = x[i];
+		if (y[i] < min_y)
+			min_y = y[i];
+		if (y[i] > max_y)
+			max_y = y[i];
 	}
 
 	int_x = floorf(min_x);
@@ -1219,6 +1303,7 @@ weston_view_update_transform(struct weston_view *view)
 	struct weston_view *parent = view->geometry.parent;
 	struct weston_layer *layer;
 	pixman_region32_t mask;
+	pixman_box32_t old_box;
 
 	if (!view->transform.dirty)
 		return;
@@ -1230,6 +1315,7 @@ weston_view_update_transform(struct weston_view *view)
 
 	weston_view_damage_below(view);
 
+	old_box = *pixman_region32_extents(&view->transform.boundingbox);
 	pixman_region32_fini(&view->transform.boundingbox);
 	pixman_region32_fini(&view->transform.opaque);
 	pixman_region32_init(&view->transform.opaque);
@@ -1268,6 +1354,8 @@ weston_view_update_transform(struct weston_view *view)
 	weston_view_damage_below(view);
 
 	weston_view_assign_output(view);
+	weston_compositor_pick_grid_move_view(view->surface->compositor,
+					      view, &old_box);
 
 	wl_signal_emit(&view->surface->compositor->transform_signal,
 		       view->surface);
@@ -1289,6 +1377,7 @@ weston_view_geometry_dirty(struct weston_view *view)
 		return;
 
 	view->transform.dirty = 1;
+	view->transform.serial++;
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1691,38 +1780,366 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    wl_fixed_t x, wl_fixed_t y,
-			    wl_fixed_t *vx, wl_fixed_t *vy)
+/* Upper bound on the number of cells along each axis of the pick grid. */
+#define PICK_GRID_MAX_DIM 32
+
+/* With fewer views than this, walking view_list is cheaper than the grid. */
+#define PICK_GRID_MIN_VIEWS 16
+
+/** Uniform grid over the bounding boxes of weston_compositor::view_list
+ *
+ * Each cell holds the views whose transform.boundingbox overlaps it, in
+ * view_list (stacking) order. Picking only needs to look at the views
+ * of the one cell that contains the point, and the first view accepting
+ * the point there is the same one a full walk of view_list would find.
+ *
+ * The grid is rebuilt lazily on the next pick after being marked dirty
+ * by weston_compositor_pick_grid_dirty(). A view whose transform changes
+ * is only moved between the cells of its old and new bounding boxes, by
+ * weston_compositor_pick_grid_move_view(), as long as it stays within
+ * the extents of the grid.
+ */
+struct weston_pick_grid {
+	bool dirty;
+	bool enabled;
+	/** Bumped on every rebuild, see weston_view::pick_grid */
+	uint32_t generation;
+
+	/** Union of all view bounding boxes at the time of the rebuild */
+	pixman_box32_t extents;
+	int cols, rows;
+	int64_t cell_width, cell_height;
+
+	/* struct weston_view * */
+	struct wl_array cells[PICK_GRID_MAX_DIM * PICK_GRID_MAX_DIM];
+};
+
+static struct weston_pick_grid *
+weston_pick_grid_create(void)
+{
+	struct weston_pick_grid *grid;
+	int i;
+
+	grid = zalloc(sizeof *grid);
+	if (!grid)
+		return NULL;
+
+	for (i = 0; i < PICK_GRID_MAX_DIM * PICK_GRID_MAX_DIM; i++)
+		wl_array_init(&grid->cells[i]);
+	grid->dirty = true;
+
+	return grid;
+}
+
+static void
+weston_pick_grid_destroy(struct weston_pick_grid *grid)
+{
+	int i;
+
+	for (i = 0; i < PICK_GRID_MAX_DIM * PICK_GRID_MAX_DIM; i++)
+		wl_array_release(&grid->cells[i]);
+	free(grid);
+}
+
+static void
+weston_compositor_pick_grid_dirty(struct weston_compositor *compositor)
+{
+	compositor->pick_grid->dirty = true;
+}
+
+static int
+pick_grid_column(struct weston_pick_grid *grid, int32_t x)
+{
+	int64_t c = ((int64_t)x - grid->extents.x1) / grid->cell_width;
+
+	return MIN(MAX(c, 0), grid->cols - 1);
+}
+
+static int
+pick_grid_row(struct weston_pick_grid *grid, int32_t y)
+{
+	int64_t r = ((int64_t)y - grid->extents.y1) / grid->cell_height;
+
+	return MIN(MAX(r, 0), grid->rows - 1);
+}
+
+static bool
+pick_grid_add_view(struct weston_pick_grid *grid, struct weston_view *view,
+		   const pixman_box32_t *box)
+{
+	struct weston_view **slot;
+	int c, r, c1, c2, r1, r2;
+
+	c1 = pick_grid_column(grid, box->x1);
+	c2 = pick_grid_column(grid, box->x2 - 1);
+	r1 = pick_grid_row(grid, box->y1);
+	r2 = pick_grid_row(grid, box->y2 - 1);
+
+	for (r = r1; r <= r2; r++) {
+		for (c = c1; c <= c2; c++) {
+			slot = wl_array_add(&grid->cells[r * grid->cols + c],
+					    sizeof *slot);
+			if (!slot)
+				return false;
+			*slot = view;
+		}
+	}
+
+	return true;
+}
+
+/* Cells keep their views in stacking order, find where view goes. */
+static size_t
+pick_grid_cell_position(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views = cell->data;
+	size_t lo = 0, hi = cell->size / sizeof *views, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (views[mid]->pick_grid.order < view->pick_grid.order)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+static bool
+pick_grid_cell_remove(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views = cell->data;
+	size_t count = cell->size / sizeof *views;
+	size_t i = pick_grid_cell_position(cell, view);
+
+	if (i == count || views[i] != view)
+		return false;
+
+	memmove(&views[i], &views[i + 1], (count - i - 1) * sizeof *views);
+	cell->size -= sizeof *views;
+
+	return true;
+}
+
+static bool
+pick_grid_cell_insert(struct wl_array *cell, struct weston_view *view)
+{
+	struct weston_view **views;
+	size_t count = cell->size / sizeof *views;
+	size_t i = pick_grid_cell_position(cell, view);
+
+	if (!wl_array_add(cell, sizeof *views))
+		return false;
+
+	views = cell->data;
+	memmove(&views[i + 1], &views[i], (count - i) * sizeof *views);
+	views[i] = view;
+
+	return true;
+}
+
+static bool
+pick_grid_box_empty(const pixman_box32_t *box)
+{
+	return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+/** Move a view whose bounding box changed from old_box to its new cells
+ *
+ * Views that were not in view_list at the last rebuild are not in the
+ * grid, and a view leaving the extents of the grid needs a rebuild.
+ */
+static void
+weston_compositor_pick_grid_move_view(struct weston_compositor *compositor,
+				      struct weston_view *view,
+				      const pixman_box32_t *old_box)
+{
+	struct weston_pick_grid *grid = compositor->pick_grid;
+	pixman_box32_t *box;
+	int c, r, c1, c2, r1, r2;
+
+	if (grid->dirty || view->pick_grid.generation != grid->generation)
+		return;
+
+	if (!grid->enabled) {
+		grid->dirty = true;
+		return;
+	}
+
+	box = pixman_region32_extents(&view->transform.boundingbox);
+	if (!pick_grid_box_empty(box) &&
+	    (box->x1 < grid->extents.x1 || box->y1 < grid->extents.y1 ||
+	     box->x2 > grid->extents.x2 || box->y2 > grid->extents.y2)) {
+		grid->dirty = true;
+		return;
+	}
+
+	if (!pick_grid_box_empty(old_box)) {
+		c1 = pick_grid_column(grid, old_box->x1);
+		c2 = pick_grid_column(grid, old_box->x2 - 1);
+		r1 = pick_grid_row(grid, old_box->y1);
+		r2 = pick_grid_row(grid, old_box->y2 - 1);
+
+		for (r = r1; r <= r2; r++) {
+			for (c = c1; c <= c2; c++) {
+				if (!pick_grid_cell_remove(
+					&grid->cells[r * grid->cols + c],
+					view)) {
+					grid->dirty = true;
+					return;
+				}
+			}
+		}
+	}
+
+	if (pick_grid_box_empty(box))
+		return;
+
+	c1 = pick_grid_column(grid, box->x1);
+	c2 = pick_grid_column(grid, box->x2 - 1);
+	r1 = pick_grid_row(grid, box->y1);
+	r2 = pick_grid_row(grid, box->y2 - 1);
+
+	for (r = r1; r <= r2; r++) {
+		for (c = c1; c <= c2; c++) {
+			if (!pick_grid_cell_insert(
+				&grid->cells[r * grid->cols + c], view)) {
+				grid->dirty = true;
+				return;
+			}
+		}
+	}
+}
+
+static void
+weston_pick_grid_rebuild(struct weston_pick_grid *grid,
+			 struct wl_list *view_list)
 {
 	struct weston_view *view;
+	pixman_box32_t *box;
+	int i, dim, count = 0;
+	uint32_t order = 0;
+
+	for (i = 0; i < grid->cols * grid->rows; i++)
+		grid->cells[i].size = 0;
+
+	grid->dirty = false;
+	grid->enabled = false;
+	grid->cols = 0;
+	grid->rows = 0;
+	grid->generation++;
+
+	wl_list_for_each(view, view_list, link) {
+		view->pick_grid.generation = grid->generation;
+		view->pick_grid.order = order++;
+
+		box = pixman_region32_extents(&view->transform.boundingbox);
+		if (pick_grid_box_empty(box))
+			continue;
+
+		if (count++ == 0) {
+			grid->extents = *box;
+			continue;
+		}
+
+		grid->extents.x1 = MIN(grid->extents.x1, box->x1);
+		grid->extents.y1 = MIN(grid->extents.y1, box->y1);
+		grid->extents.x2 = MAX(grid->extents.x2, box->x2);
+		grid->extents.y2 = MAX(grid->extents.y2, box->y2);
+	}
+
+	if (count < PICK_GRID_MIN_VIEWS)
+		return;
+
+	/* Aim for a handful of views per cell; a view covering the whole
+	 * extents lands in every cell, so don't overdo the resolution. */
+	dim = ceil(sqrt(count / 4.0));
+	dim = MIN(MAX(dim, 1), PICK_GRID_MAX_DIM);
+	grid->cols = dim;
+	grid->rows = dim;
+	grid->cell_width = ((int64_t)grid->extents.x2 - grid->extents.x1 +
+			    dim - 1) / dim;
+	grid->cell_height = ((int64_t)grid->extents.y2 - grid->extents.y1 +
+			     dim - 1) / dim;
+
+	wl_list_for_each(view, view_list, link) {
+		box = pixman_region32_extents(&view->transform.boundingbox);
+		if (pick_grid_box_empty(box))
+			continue;
+
+		if (!pick_grid_add_view(grid, view, box)) {
+			/* Out of memory, fall back to walking the list. */
+			for (i = 0; i < grid->cols * grid->rows; i++)
+				grid->cells[i].size = 0;
+			grid->cols = 0;
+			grid->rows = 0;
+			return;
+		}
+	}
+
+	grid->enabled = true;
+}
+
+static bool
+view_accepts_input_at(struct weston_view *view,
+		      wl_fixed_t x, wl_fixed_t y,
+		      wl_fixed_t *vx, wl_fixed_t *vy)
+{
 	wl_fixed_t view_x, view_y;
 	int view_ix, view_iy;
 	int ix = wl_fixed_to_int(x);
 	int iy = wl_fixed_to_int(y);
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, ix, iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    ix, iy, NULL))
+		return false;
 
-		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
-		view_ix = wl_fixed_to_int(view_x);
-		view_iy = wl_fixed_to_int(view_y);
+	weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+	view_ix = wl_fixed_to_int(view_x);
+	view_iy = wl_fixed_to_int(view_y);
 
-		if (!pixman_region32_contains_point(&view->surface->input,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->surface->input,
+					    view_ix, view_iy, NULL))
+		return false;
 
-		if (view->geometry.scissor_enabled &&
-		    !pixman_region32_contains_point(&view->geometry.scissor,
-						    view_ix, view_iy, NULL))
-			continue;
+	if (view->geometry.scissor_enabled &&
+	    !pixman_region32_contains_point(&view->geometry.scissor,
+					    view_ix, view_iy, NULL))
+		return false;
+
+	*vx = view_x;
+	*vy = view_y;
+	return true;
+}
+
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    wl_fixed_t x, wl_fixed_t y,
+			    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_pick_grid *grid = compositor->pick_grid;
+	struct weston_view *view, **pview;
+	struct wl_array *cell;
+	int ix = wl_fixed_to_int(x);
+	int iy = wl_fixed_to_int(y);
+
+	if (grid->dirty)
+		weston_pick_grid_rebuild(grid, &compositor->view_list);
 
-		*vx = view_x;
-		*vy = view_y;
-		return view;
+	if (!grid->enabled) {
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (view_accepts_input_at(view, x, y, vx, vy))
+				return view;
+		}
+	} else if (ix >= grid->extents.x1 && ix < grid->extents.x2 &&
+		   iy >= grid->extents.y1 && iy < grid->extents.y2) {
+		cell = &grid->cells[pick_grid_row(grid, iy) * grid->cols +
+				    pick_grid_column(grid, ix)];
+		wl_array_for_each(pview, cell) {
+			if (view_accepts_input_at(*pview, x, y, vx, vy))
+				return *pview;
+		}
 	}
 
 	*vx = wl_fixed_from_int(-1000000);
@@ -1751,12 +2168,16 @@ weston_view_unmap(struct weston_view *view)
 		return;
 
 	weston_view_damage_below(view);
+	weston_compositor_output_views_dirty(view->surface->compositor,
+					     view_output_bits(view));
 	view->output = NULL;
 	view->plane = NULL;
 	view->is_mapped = false;
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	weston_compositor_view_list_dirty(view->surface->compositor);
+	weston_compositor_pick_grid_dirty(view->surface->compositor);
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
@@ -1813,6 +2234,10 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->link);
 	weston_layer_entry_remove(&view->layer_link);
+	weston_compositor_view_list_dirty(view->surface->compositor);
+	weston_compositor_pick_grid_dirty(view->surface->compositor);
+	weston_compositor_output_views_dirty(view->surface->compositor,
+					     view_output_bits(view));
 
 	pixman_region32_fini(&view->clip);
 	pixman_region32_fini(&view->geometry.scissor);
@@ -1823,7 +2248,7 @@ weston_view_destroy(struct weston_view *view)
 
 	wl_list_remove(&view->surface_link);
 
-	free(view);
+	weston_slab_free(view);
 }
 
 WL_EXPORT void
@@ -1864,7 +2289,7 @@ weston_surface_destroy(struct weston_surface *surface)
 			      link)
 		weston_pointer_constraint_destroy(constraint);
 
-	free(surface);
+	weston_slab_free(surface);
 }
 
 static void
@@ -1994,12 +2419,21 @@ weston_output_damage(struct weston_output *output)
 	weston_output_schedule_repaint(output);
 }
 
-static void
+/* Returns false if the damage was left pending. */
+static bool
 surface_flush_damage(struct weston_surface *surface)
 {
 	if (surface->buffer_ref.buffer &&
-	    wl_shm_buffer_get(surface->buffer_ref.buffer->resource))
+	    wl_shm_buffer_get(surface->buffer_ref.buffer->resource)) {
+		/* Nobody would see the upload. Keep the damage, and the
+		 * buffer, until the surface is uncovered; the damage of
+		 * later commits is added to it. */
+		if (surface->occluded &&
+		    pixman_region32_not_empty(&surface->damage))
+			return false;
+
 		surface->compositor->renderer->flush_damage(surface);
+	}
 
 	if (weston_timeline_enabled_ &&
 	    pixman_region32_not_empty(&surface->damage))
@@ -2007,32 +2441,47 @@ surface_flush_damage(struct weston_surface *surface)
 			 TLP_OUTPUT(surface->output), TLP_END);
 
 	pixman_region32_clear(&surface->damage);
+
+	return true;
 }
 
 static void
 view_accumulate_damage(struct weston_view *view,
-		       pixman_region32_t *opaque)
+		       pixman_region32_t *opaque,
+		       pixman_region32_t *damage)
 {
-	pixman_region32_t damage;
+	pixman_region32_t bbox;
 
-	pixman_region32_init(&damage);
 	if (view->transform.enabled) {
 		pixman_box32_t *extents;
 
 		extents = pixman_region32_extents(&view->surface->damage);
-		view_compute_bbox(view, extents, &damage);
+		view_compute_bbox(view, extents, &bbox);
+		pixman_region32_copy(damage, &bbox);
+		pixman_region32_fini(&bbox);
 	} else {
-		pixman_region32_copy(&damage, &view->surface->damage);
-		pixman_region32_translate(&damage,
+		pixman_region32_copy(damage, &view->surface->damage);
+		pixman_region32_translate(damage,
 					  view->geometry.x, view->geometry.y);
 	}
 
-	pixman_region32_intersect(&damage, &damage,
+	pixman_region32_intersect(damage, damage,
 				  &view->transform.boundingbox);
-	pixman_region32_subtract(&damage, &damage, opaque);
+	pixman_region32_subtract(damage, damage, opaque);
 	pixman_region32_union(&view->plane->damage,
-			      &view->plane->damage, &damage);
-	pixman_region32_fini(&damage);
+			      &view->plane->damage, damage);
+
+	/* Visible unless covered by opaque views above it, on this plane
+	 * or on the planes above. Parts outside of all outputs count as
+	 * visible, which is merely conservative. */
+	if (view->surface->occluded && view->output_mask != 0) {
+		pixman_region32_subtract(damage, &view->transform.boundingbox,
+					 opaque);
+		pixman_region32_subtract(damage, damage, &view->plane->clip);
+		if (pixman_region32_not_empty(damage))
+			view->surface->occluded = false;
+	}
+
 	pixman_region32_copy(&view->clip, opaque);
 	pixman_region32_union(opaque, opaque, &view->transform.opaque);
 }
@@ -2040,39 +2489,75 @@ view_accumulate_damage(struct weston_view *view,
 static void
 compositor_accumulate_damage(struct weston_compositor *ec)
 {
+	pixman_region32_t *opaque = &ec->accumulate_opaque;
+	pixman_region32_t *clip = &ec->accumulate_clip;
 	struct weston_plane *plane;
-	struct weston_view *ev;
-	pixman_region32_t opaque, clip;
+	struct weston_view *ev, **pev;
+	uint32_t serial = ++ec->accumulate_serial;
+	bool walk_list = false;
+
+	/* Sort the views into per-plane buckets, keeping the stacking
+	 * order, so that each plane only looks at its own views. */
+	wl_list_for_each(ev, &ec->view_list, link) {
+		ev->surface->touched = false;
+		ev->surface->occluded = true;
+
+		if (!ev->plane || walk_list)
+			continue;
+
+		plane = ev->plane;
+		if (plane->views_serial != serial) {
+			plane->views.size = 0;
+			plane->views_serial = serial;
+		}
 
-	pixman_region32_init(&clip);
+		pev = wl_array_add(&plane->views, sizeof *pev);
+		if (!pev) {
+			/* Fall back to walking the view list per plane. */
+			weston_log("failed to allocate the views of a plane\n");
+			walk_list = true;
+			continue;
+		}
+		*pev = ev;
+	}
+
+	pixman_region32_clear(clip);
 
 	wl_list_for_each(plane, &ec->plane_list, link) {
-		pixman_region32_copy(&plane->clip, &clip);
+		pixman_region32_copy(&plane->clip, clip);
 
-		pixman_region32_init(&opaque);
+		if (walk_list) {
+			pixman_region32_clear(opaque);
 
-		wl_list_for_each(ev, &ec->view_list, link) {
-			if (ev->plane != plane)
-				continue;
+			wl_list_for_each(ev, &ec->view_list, link) {
+				if (ev->plane == plane)
+					view_accumulate_damage(ev, opaque,
+						&ec->accumulate_damage);
+			}
 
-			view_accumulate_damage(ev, &opaque);
+			pixman_region32_union(clip, clip, opaque);
+			continue;
 		}
 
-		pixman_region32_union(&clip, &clip, &opaque);
-		pixman_region32_fini(&opaque);
-	}
+		if (plane->views_serial != serial)
+			continue;
 
-	pixman_region32_fini(&clip);
+		pixman_region32_clear(opaque);
 
-	wl_list_for_each(ev, &ec->view_list, link)
-		ev->surface->touched = false;
+		wl_array_for_each(pev, &plane->views)
+			view_accumulate_damage(*pev, opaque,
+					       &ec->accumulate_damage);
+
+		pixman_region32_union(clip, clip, opaque);
+	}
 
 	wl_list_for_each(ev, &ec->view_list, link) {
 		if (ev->surface->touched)
 			continue;
 		ev->surface->touched = true;
 
-		surface_flush_damage(ev->surface);
+		if (!surface_flush_damage(ev->surface))
+			continue;
 
 		/* Both the renderer and the backend have seen the buffer
 		 * by now. If renderer needs the buffer, it has its own
@@ -2210,6 +2695,146 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	weston_compositor_pick_grid_dirty(compositor);
+	weston_compositor_output_views_dirty(compositor, ~0u);
+
+	/* Last, as freeing the unused sub-surface views marks it again. */
+	compositor->view_list_needs_rebuild = false;
+}
+
+/** Mark the view list as stale
+ *
+ * \param compositor The compositor.
+ *
+ * The flattened weston_compositor::view_list is only rebuilt from the
+ * layers before a repaint when something that affects it has changed:
+ * a layer entry was inserted or removed, a view was unmapped or
+ * destroyed, or sub-surfaces were added, removed, mapped or restacked.
+ * Changes to the layer list itself are detected by
+ * weston_compositor_layer_list_changed().
+ */
+static void
+weston_compositor_view_list_dirty(struct weston_compositor *compositor)
+{
+	compositor->view_list_needs_rebuild = true;
+}
+
+/** Check whether the layer list changed since the last call
+ *
+ * \param compositor The compositor.
+ * \return True if layers were added, removed or reordered.
+ *
+ * Shells manipulate weston_layer::link directly to show and hide whole
+ * layers, so compare against a copy of the list taken the last time
+ * instead of relying on notification.
+ */
+static bool
+weston_compositor_layer_list_changed(struct weston_compositor *compositor)
+{
+	struct wl_array *snapshot = &compositor->layer_list_snapshot;
+	struct weston_layer *layer, **slot;
+	size_t i = 0, count = snapshot->size / sizeof *slot;
+
+	slot = snapshot->data;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if (i == count || slot[i] != layer)
+			break;
+		i++;
+	}
+
+	if (i == count && &layer->link == &compositor->layer_list)
+		return false;
+
+	snapshot->size = 0;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		slot = wl_array_add(snapshot, sizeof *slot);
+		if (!slot) {
+			/* Forces a rebuild on every repaint until it fits. */
+			snapshot->size = 0;
+			break;
+		}
+		*slot = layer;
+	}
+
+	return true;
+}
+
+static void
+weston_compositor_update_view_list(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	if (weston_compositor_layer_list_changed(compositor))
+		weston_compositor_view_list_dirty(compositor);
+
+	if (compositor->view_list_needs_rebuild) {
+		weston_compositor_build_view_list(compositor);
+		return;
+	}
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
+}
+
+/** Mark the visible view lists of some outputs as stale
+ *
+ * \param compositor The compositor.
+ * \param output_mask Bit mask of output ids to mark.
+ *
+ * Called whenever the view list is rebuilt or a view enters or leaves an
+ * output, see weston_output_update_visible_views().
+ */
+static void
+weston_compositor_output_views_dirty(struct weston_compositor *compositor,
+				     uint32_t output_mask)
+{
+	struct weston_output *output;
+
+	if (output_mask == 0)
+		return;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output_mask & (1u << output->id))
+			output->visible_views_dirty = true;
+	}
+}
+
+/** Collect the views shown on an output
+ *
+ * \param output The output.
+ *
+ * Filters weston_compositor::view_list down to the views that overlap
+ * the output or have it as their primary output, so that repainting one
+ * output of many does not walk the views on all the others.
+ */
+static void
+weston_output_update_visible_views(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view *view, **slot;
+	uint32_t bit = 1u << output->id;
+
+	if (!output->visible_views_dirty)
+		return;
+
+	output->visible_views.size = 0;
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!(view_output_bits(view) & bit))
+			continue;
+
+		slot = wl_array_add(&output->visible_views, sizeof *slot);
+		if (!slot) {
+			/* Stay dirty so the next repaint tries again. */
+			weston_log("failed to allocate the view list of "
+				   "output %s\n", output->name);
+			output->visible_views.size = 0;
+			return;
+		}
+		*slot = view;
+	}
+
+	output->visible_views_dirty = false;
 }
 
 static void
@@ -2237,24 +2862,239 @@ weston_output_take_feedback_list(struct weston_output *output,
 	wl_list_init(&surface->feedback_list);
 }
 
+static void
+weston_output_record_repaint_time(struct weston_output *output,
+				  const struct timespec *start)
+{
+	struct timespec now, duration;
+	int64_t usec;
+	int bucket;
+
+	weston_compositor_read_presentation_clock(output->compositor, &now);
+	timespec_sub(&duration, &now, start);
+	usec = timespec_to_nsec(&duration) / 1000;
+	if (usec < 0)
+		usec = 0;
+	else if (usec > UINT32_MAX)
+		usec = UINT32_MAX;
+
+	output->repaint_timing.usec[output->repaint_timing.next] = usec;
+	output->repaint_timing.next =
+		(output->repaint_timing.next + 1) % WESTON_REPAINT_HISTORY;
+	if (output->repaint_timing.count < WESTON_REPAINT_HISTORY)
+		output->repaint_timing.count++;
+
+	output->repaint_timing.repaints++;
+	if (output->repaint_timing.window_usec > 0 &&
+	    usec > output->repaint_timing.window_usec)
+		output->repaint_timing.late++;
+
+	for (bucket = 0; bucket < WESTON_REPAINT_HISTOGRAM_BUCKETS - 1; bucket++)
+		if (usec < (250 << bucket))
+			break;
+	output->stats.repaint_histogram[bucket]++;
+}
+
+/** Work out which refresh a repaint starting now is meant for
+ *
+ * That is the first refresh after now, counting in whole refresh periods
+ * from the last presented frame. weston_output_finish_frame() compares
+ * it to the actual presentation time to count missed refreshes.
+ */
+static void
+weston_output_set_target_vblank(struct weston_output *output,
+				const struct timespec *now)
+{
+	int64_t last = output->repaint_timing.last_vblank_nsec;
+	int64_t refresh_nsec, elapsed;
+
+	output->repaint_timing.target_vblank_nsec = 0;
+	if (last == 0 || output->current_mode->refresh <= 0)
+		return;
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	elapsed = timespec_to_nsec(now) - last;
+	if (elapsed < 0)
+		elapsed = 0;
+
+	output->repaint_timing.target_vblank_nsec =
+		last + (elapsed / refresh_nsec + 1) * refresh_nsec;
+}
+
+static void
+weston_output_count_presented(struct weston_output *output,
+			      const struct timespec *stamp,
+			      uint32_t presented_flags)
+{
+	int64_t target = output->repaint_timing.target_vblank_nsec;
+	int64_t refresh_nsec, late;
+
+	output->repaint_timing.last_vblank_nsec = timespec_to_nsec(stamp);
+	output->repaint_timing.target_vblank_nsec = 0;
+
+	/* Restarts of the repaint loop do not present anything. */
+	if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID)
+		return;
+
+	output->stats.frames_presented++;
+
+	if (target == 0 || output->current_mode->refresh == 0)
+		return;
+
+	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+
+	late = output->repaint_timing.last_vblank_nsec - target;
+	if (late > refresh_nsec / 2)
+		output->stats.vblanks_missed +=
+			(late + refresh_nsec / 2) / refresh_nsec;
+}
+
+/** Length of the repaint window for the next repaint of an output
+ *
+ * With an adaptive window, this is the longest repaint in the history
+ * plus the configured margin, so that the repaint starts as late as it
+ * can and still make the next refresh. Until enough repaints have been
+ * measured, and without an adaptive window, repaint_msec is used.
+ */
+static int
+weston_output_repaint_window_msec(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	uint32_t max = 0;
+	unsigned i;
+
+	if (!compositor->repaint_adaptive ||
+	    output->repaint_timing.count < REPAINT_MIN_SAMPLES)
+		return compositor->repaint_msec;
+
+	for (i = 0; i < output->repaint_timing.count; i++)
+		max = MAX(max, output->repaint_timing.usec[i]);
+
+	/* The repaint timer has millisecond resolution, round up. */
+	return (max + 999) / 1000 + compositor->repaint_margin_msec;
+}
+
+/** Get the repaint timing statistics of an output
+ *
+ * \param output The output.
+ * \param stats Filled with the statistics.
+ *
+ * Repaint times cover the core repaint and the backend queueing the
+ * frame, but not rendering still in flight on the GPU; the repaint
+ * margin is there to absorb that.
+ */
+WL_EXPORT void
+weston_output_get_repaint_stats(struct weston_output *output,
+				struct weston_repaint_stats *stats)
+{
+	uint64_t sum = 0;
+	unsigned i;
+
+	memset(stats, 0, sizeof *stats);
+	stats->samples = output->repaint_timing.count;
+	stats->window_usec = output->repaint_timing.window_usec;
+	stats->repaints = output->repaint_timing.repaints;
+	stats->late = output->repaint_timing.late;
+
+	if (stats->samples == 0)
+		return;
+
+	stats->min_usec = UINT32_MAX;
+	for (i = 0; i < stats->samples; i++) {
+		stats->min_usec = MIN(stats->min_usec,
+				      output->repaint_timing.usec[i]);
+		stats->max_usec = MAX(stats->max_usec,
+				      output->repaint_timing.usec[i]);
+		sum += output->repaint_timing.usec[i];
+	}
+	stats->avg_usec = sum / stats->samples;
+}
+
+static int
+frame_throttle_timer_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	/* Repaint, so that the held frame callbacks get another chance. */
+	compositor->frame_throttle_armed = false;
+	weston_compositor_schedule_repaint(compositor);
+
+	return 0;
+}
+
+/** Decide whether to hold back the frame callbacks of a surface
+ *
+ * \param surface The surface, whose primary output is being repainted.
+ * \param output The output being repainted.
+ * \return True if the frame callbacks should stay pending.
+ *
+ * Surfaces that are not visible at all get their frame callbacks at most
+ * once per weston_compositor::occluded_frame_msec, so that hidden
+ * animations do not run at full rate. A timer makes sure the callbacks
+ * are sent eventually, even when nothing else repaints.
+ */
+static bool
+weston_surface_throttle_frame(struct weston_surface *surface,
+			      struct weston_output *output)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	uint32_t period = compositor->occluded_frame_msec;
+	uint32_t elapsed;
+
+	if (period == 0)
+		return false;
+
+	/* The state follows visibility, not the periods; a throttled
+	 * surface still gets its callbacks once per period. */
+	if (surface->occluded != surface->frame_throttled) {
+		surface->frame_throttled = surface->occluded;
+		TL_POINT(surface->occluded ? "core_frame_throttle_begin" :
+					     "core_frame_throttle_end",
+			 TLP_SURFACE(surface), TLP_OUTPUT(output), TLP_END);
+	}
+
+	if (wl_list_empty(&surface->frame_callback_list))
+		return false;
+
+	elapsed = output->frame_time - surface->frame_done_time;
+	if (!surface->frame_throttled || elapsed >= period) {
+		surface->frame_done_time = output->frame_time;
+		return false;
+	}
+
+	if (!compositor->frame_throttle_armed) {
+		wl_event_source_timer_update(compositor->frame_throttle_timer,
+					     period - elapsed);
+		compositor->frame_throttle_armed = true;
+	}
+
+	return true;
+}
+
 static int
 weston_output_repaint(struct weston_output *output)
 {
 	struct weston_compositor *ec = output->compositor;
-	struct weston_view *ev;
+	struct weston_view *ev, **evp;
 	struct weston_animation *animation, *next;
 	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	struct timespec start;
 	int r;
 
 	if (output->destroying)
 		return 0;
 
+	weston_compositor_read_presentation_clock(ec, &start);
+	weston_output_set_target_vblank(output, &start);
+
 	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	/* Rebuild the surface list if needed and update surface transforms
+	 * up front. */
+	weston_compositor_update_view_list(ec);
+	weston_output_update_visible_views(output);
 
 	if (output->assign_planes && !output->disable_planes) {
 		output->assign_planes(output);
@@ -2265,22 +3105,33 @@ weston_output_repaint(struct weston_output *output)
 		}
 	}
 
+	/* Before collecting the frame callbacks, which depend on whether
+	 * the surfaces are occluded. */
+	compositor_accumulate_damage(ec);
+
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(ev, &ec->view_list, link) {
+	wl_array_for_each(evp, &output->visible_views) {
+		ev = *evp;
+
+		output->stats.views++;
+		if (ev->plane != &ec->primary_plane)
+			output->stats.plane_views++;
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
 		if (ev->surface->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &ev->surface->frame_callback_list);
-			wl_list_init(&ev->surface->frame_callback_list);
+			if (!weston_surface_throttle_frame(ev->surface,
+							   output)) {
+				wl_list_insert_list(&frame_callback_list,
+					&ev->surface->frame_callback_list);
+				wl_list_init(&ev->surface->frame_callback_list);
+			}
 
 			weston_output_take_feedback_list(output, ev->surface);
 		}
 	}
 
-	compositor_accumulate_damage(ec);
-
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
 				  &ec->primary_plane.damage, &output->region);
@@ -2292,6 +3143,8 @@ weston_output_repaint(struct weston_output *output)
 
 	r = output->repaint(output, &output_damage);
 
+	weston_output_record_repaint_time(output, &start);
+
 	pixman_region32_fini(&output_damage);
 
 	output->repaint_needed = 0;
@@ -2346,23 +3199,39 @@ weston_output_finish_frame(struct weston_output *output,
 	int32_t refresh_nsec;
 	struct timespec now;
 	struct timespec gone;
-	int msec;
+	int msec, window_msec;
 
 	TL_POINT("core_repaint_finished", TLP_OUTPUT(output),
 		 TLP_VBLANK(stamp), TLP_END);
 
-	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	/* A mode without a refresh rate is not throttled at all. */
+	if (output->current_mode->refresh > 0)
+		refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+	else
+		refresh_nsec = 0;
+
 	weston_presentation_feedback_present_list(&output->feedback_list,
 						  output, refresh_nsec, stamp,
 						  output->msc,
 						  presented_flags);
+	weston_output_count_presented(output, stamp, presented_flags);
 
 	output->frame_time = stamp->tv_sec * 1000 + stamp->tv_nsec / 1000000;
 
+	/* Nothing to wait for: either the output is not throttled, or
+	 * time only passes when the backend steps the virtual clock. */
+	if (refresh_nsec == 0 || compositor->presentation_clock_virtual) {
+		output->repaint_timing.window_usec = 0;
+		output_repaint_timer_handler(output);
+		return;
+	}
+
 	weston_compositor_read_presentation_clock(compositor, &now);
 	timespec_sub(&gone, &now, stamp);
 	msec = (refresh_nsec - timespec_to_nsec(&gone)) / 1000000; /* floor */
-	msec -= compositor->repaint_msec;
+	window_msec = weston_output_repaint_window_msec(output);
+	msec -= window_msec;
+	output->repaint_timing.window_usec = window_msec * 1000;
 
 	if (msec < -1000 || msec > 1000) {
 		static bool warned;
@@ -2376,7 +3245,7 @@ weston_output_finish_frame(struct weston_output *output,
 	}
 
 	/* Called from restart_repaint_loop and restart happens already after
-	 * the deadline given by repaint_msec? In that case we delay until
+	 * the deadline given by the repaint window? In that case we delay until
 	 * the deadline of the next frame, to give clients a more predictable
 	 * timing of the repaint cycle to lock on. */
 	if (presented_flags == WP_PRESENTATION_FEEDBACK_INVALID && msec < 0)
@@ -2400,13 +3269,23 @@ WL_EXPORT void
 weston_layer_entry_insert(struct weston_layer_entry *list,
 			  struct weston_layer_entry *entry)
 {
+	struct weston_view *view =
+		container_of(entry, struct weston_view, layer_link);
+
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	weston_compositor_view_list_dirty(view->surface->compositor);
 }
 
 WL_EXPORT void
 weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
+	struct weston_view *view =
+		container_of(entry, struct weston_view, layer_link);
+
+	if (entry->layer)
+		weston_compositor_view_list_dirty(view->surface->compositor);
+
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
 	entry->layer = NULL;
@@ -2544,7 +3423,7 @@ destroy_frame_callback(struct wl_resource *resource)
 	struct weston_frame_callback *cb = wl_resource_get_user_data(resource);
 
 	wl_list_remove(&cb->link);
-	free(cb);
+	weston_slab_free(cb);
 }
 
 static void
@@ -2554,7 +3433,7 @@ surface_frame(struct wl_client *client,
 	struct weston_frame_callback *cb;
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 
-	cb = malloc(sizeof *cb);
+	cb = weston_slab_zalloc(surface->compositor->frame_callback_slab);
 	if (cb == NULL) {
 		wl_resource_post_no_memory(resource);
 		return;
@@ -2563,7 +3442,7 @@ surface_frame(struct wl_client *client,
 	cb->resource = wl_resource_create(client, &wl_callback_interface, 1,
 					  callback);
 	if (cb->resource == NULL) {
-		free(cb);
+		weston_slab_free(cb);
 		wl_resource_post_no_memory(resource);
 		return;
 	}
@@ -2613,12 +3492,26 @@ static void
 weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
+	struct wl_list *link = surface->subsurface_list.next;
+
+	/* Most commits do not restack, keep the view list then. */
+	wl_list_for_each(sub, &surface->subsurface_list_pending,
+			 parent_link_pending) {
+		if (link != &sub->parent_link)
+			break;
+		link = link->next;
+	}
+
+	if (&sub->parent_link_pending == &surface->subsurface_list_pending)
+		return;
 
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 	}
+
+	weston_compositor_view_list_dirty(surface->compositor);
 }
 
 static void
@@ -2919,6 +3812,61 @@ static void
 weston_subsurface_parent_commit(struct weston_subsurface *sub,
 				int parent_is_synchronized);
 
+static void
+client_stats_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_stats *stats =
+		container_of(listener, struct weston_client_stats,
+			     destroy_listener);
+
+	wl_list_remove(&stats->link);
+	free(stats);
+}
+
+static void
+weston_client_stats_commit(struct weston_compositor *compositor,
+			   struct wl_client *client)
+{
+	struct weston_client_stats *stats;
+	struct wl_listener *listener;
+
+	compositor->commits++;
+
+	listener = wl_client_get_destroy_listener(client,
+						  client_stats_destroy);
+	if (listener) {
+		stats = container_of(listener, struct weston_client_stats,
+				     destroy_listener);
+	} else {
+		stats = zalloc(sizeof *stats);
+		if (!stats)
+			return;
+
+		stats->client = client;
+		stats->destroy_listener.notify = client_stats_destroy;
+		wl_client_add_destroy_listener(client,
+					       &stats->destroy_listener);
+		wl_list_insert(compositor->client_stats_list.prev,
+			       &stats->link);
+	}
+
+	stats->commits++;
+}
+
+static void
+weston_compositor_destroy_client_stats(struct weston_compositor *compositor)
+{
+	struct weston_client_stats *stats, *next;
+
+	/* Clients outlive the compositor. */
+	wl_list_for_each_safe(stats, next, &compositor->client_stats_list,
+			      link) {
+		wl_list_remove(&stats->destroy_listener.link);
+		wl_list_remove(&stats->link);
+		free(stats);
+	}
+}
+
 static void
 surface_commit(struct wl_client *client, struct wl_resource *resource)
 {
@@ -2945,6 +3893,8 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 		return;
 	}
 
+	weston_client_stats_commit(surface->compositor, client);
+
 	if (sub) {
 		weston_subsurface_commit(sub);
 		return;
@@ -3284,6 +4234,7 @@ subsurface_committed(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 	if (!weston_surface_is_mapped(surface)) {
 		surface->is_mapped = true;
+		weston_compositor_view_list_dirty(surface->compositor);
 
 		/* Cannot call weston_view_update_transform(),
 		 * because that would call it also for the parent surface,
@@ -3497,6 +4448,70 @@ weston_surface_copy_content(struct weston_surface *surface,
 					 src_x, src_y, width, height);
 }
 
+/** Read back output pixels without waiting for the GPU
+ *
+ * \param output The output to read from.
+ * \param readback The request, owned by the caller.
+ * \param format The pixel format, compositor->read_format.
+ * \param x X of the rectangle to read, in framebuffer pixels.
+ * \param y Y of the rectangle to read, in framebuffer pixels.
+ * \param width Width in pixels of the rectangle to read.
+ * \param height Height in pixels of the rectangle to read.
+ * \param done Called with the pixels once they are available.
+ * \return 0 for success, -1 if the renderer cannot read asynchronously.
+ *
+ * This is the asynchronous form of weston_renderer::read_pixels(), meant
+ * to be called from the output frame signal. The rectangle and the
+ * layout of the pixels are the same as there, and the stride is exactly
+ * width times the pixel size.
+ *
+ * The renderer starts the read and calls done later, at the latest when
+ * the output repaints next and before its next frame signal, so that a
+ * readback per frame never overlaps with the next one. The pixels are
+ * only valid during the call, and NULL if the read failed. Pending
+ * readbacks are finished before their output goes away.
+ *
+ * On failure, callers fall back to weston_renderer::read_pixels().
+ */
+WL_EXPORT int
+weston_output_read_pixels_async(struct weston_output *output,
+				struct weston_pixels_readback *readback,
+				pixman_format_code_t format,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_pixels_readback_done_func_t done)
+{
+	struct weston_renderer *rer = output->compositor->renderer;
+
+	wl_list_init(&readback->link);
+
+	if (!rer->read_pixels_async)
+		return -1;
+
+	readback->format = format;
+	readback->x = x;
+	readback->y = y;
+	readback->width = width;
+	readback->height = height;
+	readback->done = done;
+	readback->renderer_data = NULL;
+
+	return rer->read_pixels_async(output, readback);
+}
+
+/** Drop a readback before its done callback
+ *
+ * \param readback The request, which may also have completed already.
+ *
+ * Must be called before the memory of a readback in flight is freed.
+ */
+WL_EXPORT void
+weston_pixels_readback_cancel(struct weston_pixels_readback *readback)
+{
+	wl_list_remove(&readback->link);
+	wl_list_init(&readback->link);
+}
+
 static void
 subsurface_set_position(struct wl_client *client,
 			struct wl_resource *resource, int32_t x, int32_t y)
@@ -3625,6 +4640,7 @@ subsurface_set_desync(struct wl_client *client, struct wl_resource *resource)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	weston_compositor_view_list_dirty(sub->surface->compositor);
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -3691,6 +4707,8 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+
+	weston_compositor_view_list_dirty(parent->compositor);
 }
 
 static void
@@ -3738,7 +4756,7 @@ weston_subsurface_destroy(struct weston_subsurface *sub)
 	}
 
 	wl_list_remove(&sub->surface_destroy_listener.link);
-	free(sub);
+	weston_slab_free(sub);
 }
 
 static const struct wl_subsurface_interface subsurface_implementation = {
@@ -3757,7 +4775,7 @@ weston_subsurface_create(uint32_t id, struct weston_surface *surface,
 	struct weston_subsurface *sub;
 	struct wl_client *client = wl_resource_get_client(surface->resource);
 
-	sub = zalloc(sizeof *sub);
+	sub = weston_slab_zalloc(surface->compositor->subsurface_slab);
 	if (sub == NULL)
 		return NULL;
 
@@ -3766,7 +4784,7 @@ weston_subsurface_create(uint32_t id, struct weston_surface *surface,
 	sub->resource =
 		wl_resource_create(client, &wl_subsurface_interface, 1, id);
 	if (!sub->resource) {
-		free(sub);
+		weston_slab_free(sub);
 		return NULL;
 	}
 
@@ -3790,7 +4808,7 @@ weston_subsurface_create_for_parent(struct weston_surface *parent)
 {
 	struct weston_subsurface *sub;
 
-	sub = zalloc(sizeof *sub);
+	sub = weston_slab_zalloc(parent->compositor->subsurface_slab);
 	if (sub == NULL)
 		return NULL;
 
@@ -4025,6 +5043,7 @@ weston_plane_init(struct weston_plane *plane,
 {
 	pixman_region32_init(&plane->damage);
 	pixman_region32_init(&plane->clip);
+	wl_array_init(&plane->views);
 	plane->x = x;
 	plane->y = y;
 	plane->compositor = ec;
@@ -4041,6 +5060,7 @@ weston_plane_release(struct weston_plane *plane)
 
 	pixman_region32_fini(&plane->damage);
 	pixman_region32_fini(&plane->clip);
+	wl_array_release(&plane->views);
 
 	wl_list_for_each(view, &plane->compositor->view_list, link) {
 		if (view->plane == plane)
@@ -4242,6 +5262,7 @@ weston_output_move(struct weston_output *output, int x, int y)
 	weston_output_init_geometry(output, x, y);
 
 	output->dirty = 1;
+	weston_compositor_reassign_view_outputs(output->compositor);
 
 	/* Move views on this output. */
 	wl_signal_emit(&output->compositor->output_moved_signal, output);
@@ -4345,7 +5366,7 @@ weston_compositor_remove_output(struct weston_output *output)
 	assert(output->destroying);
 
 	wl_list_for_each(view, &output->compositor->view_list, link) {
-		if (view->output_mask & (1u << output->id))
+		if (view_output_bits(view) & (1u << output->id))
 			weston_view_assign_output(view);
 	}
 
@@ -4428,6 +5449,7 @@ weston_output_init(struct weston_output *output,
 	assert(output->name);
 
 	wl_list_init(&output->link);
+	wl_array_init(&output->visible_views);
 
 	output->enabled = false;
 
@@ -4520,6 +5542,9 @@ weston_output_enable(struct weston_output *output)
 	output->x = x;
 	output->y = y;
 	output->dirty = 1;
+	output->visible_views_dirty = true;
+	memset(&output->repaint_timing, 0, sizeof output->repaint_timing);
+	memset(&output->stats, 0, sizeof output->stats);
 	output->original_scale = output->scale;
 
 	weston_output_transform_scale_init(output, output->transform, output->scale);
@@ -4644,6 +5669,7 @@ weston_output_destroy(struct weston_output *output)
 		weston_output_enable_undo(output);
 	}
 
+	wl_array_release(&output->visible_views);
 	free(output->name);
 }
 
@@ -4834,7 +5860,7 @@ destroy_presentation_feedback(struct wl_resource *feedback_resource)
 	feedback = wl_resource_get_user_data(feedback_resource);
 
 	wl_list_remove(&feedback->link);
-	free(feedback);
+	weston_slab_free(feedback);
 }
 
 static void
@@ -4854,7 +5880,7 @@ presentation_feedback(struct wl_client *client,
 
 	surface = wl_resource_get_user_data(surface_resource);
 
-	feedback = zalloc(sizeof *feedback);
+	feedback = weston_slab_zalloc(surface->compositor->feedback_slab);
 	if (feedback == NULL)
 		goto err_calloc;
 
@@ -4872,7 +5898,7 @@ presentation_feedback(struct wl_client *client,
 	return;
 
 err_create:
-	free(feedback);
+	weston_slab_free(feedback);
 
 err_calloc:
 	wl_client_post_no_memory(client);
@@ -4952,6 +5978,57 @@ timeline_key_binding_handler(struct weston_keyboard *keyboard, uint32_t time,
 		weston_timeline_open(compositor);
 }
 
+static int
+weston_compositor_create_slabs(struct weston_compositor *ec)
+{
+	ec->surface_slab = weston_slab_create("surface",
+					      sizeof(struct weston_surface));
+	ec->view_slab = weston_slab_create("view",
+					   sizeof(struct weston_view));
+	ec->subsurface_slab = weston_slab_create("subsurface",
+					sizeof(struct weston_subsurface));
+	ec->frame_callback_slab = weston_slab_create("frame callback",
+					sizeof(struct weston_frame_callback));
+	ec->feedback_slab = weston_slab_create("presentation feedback",
+				sizeof(struct weston_presentation_feedback));
+
+	if (!ec->surface_slab || !ec->view_slab || !ec->subsurface_slab ||
+	    !ec->frame_callback_slab || !ec->feedback_slab)
+		return -1;
+
+	return 0;
+}
+
+/* Objects still alive are typically client resources, which outlive the
+ * compositor; their slabs go away once the last of them is freed. */
+static void
+weston_compositor_destroy_slabs(struct weston_compositor *ec)
+{
+	struct weston_slab **slabs[] = {
+		&ec->surface_slab,
+		&ec->view_slab,
+		&ec->subsurface_slab,
+		&ec->frame_callback_slab,
+		&ec->feedback_slab,
+	};
+	struct weston_slab_stats stats;
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(slabs); i++) {
+		if (!*slabs[i])
+			continue;
+
+		weston_slab_get_stats(*slabs[i], &stats);
+		weston_log("%s objects: %u live, %u peak, "
+			   "%" PRIu64 " allocated\n",
+			   weston_slab_get_name(*slabs[i]), stats.live,
+			   stats.peak, stats.allocations);
+
+		weston_slab_destroy(*slabs[i]);
+		*slabs[i] = NULL;
+	}
+}
+
 /** Create the compositor.
  *
  * This functions creates and initializes a compositor instance.
@@ -4994,9 +6071,17 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	ec->output_id_pool = 0;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
+	ec->repaint_margin_msec = DEFAULT_REPAINT_MARGIN;
 
 	ec->activate_serial = 1;
 
+	ec->pick_grid = weston_pick_grid_create();
+	if (!ec->pick_grid)
+		goto fail;
+
+	if (weston_compositor_create_slabs(ec) < 0)
+		goto fail;
+
 	if (!wl_global_create(ec->wl_display, &wl_compositor_interface, 4,
 			      ec, compositor_bind))
 		goto fail;
@@ -5016,7 +6101,13 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	if (weston_input_init(ec) != 0)
 		goto fail;
 
+	wl_list_init(&ec->client_stats_list);
 	wl_list_init(&ec->view_list);
+	wl_array_init(&ec->layer_list_snapshot);
+	ec->view_list_needs_rebuild = true;
+	pixman_region32_init(&ec->accumulate_clip);
+	pixman_region32_init(&ec->accumulate_opaque);
+	pixman_region32_init(&ec->accumulate_damage);
 	wl_list_init(&ec->plane_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
@@ -5040,6 +6131,8 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
+	ec->frame_throttle_timer =
+		wl_event_loop_add_timer(loop, frame_throttle_timer_handler, ec);
 
 	weston_layer_init(&ec->fade_layer, &ec->layer_list);
 	weston_layer_init(&ec->cursor_layer, &ec->fade_layer.link);
@@ -5050,6 +6143,9 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	return ec;
 
 fail:
+	if (ec->pick_grid)
+		weston_pick_grid_destroy(ec->pick_grid);
+	weston_compositor_destroy_slabs(ec);
 	free(ec);
 	return NULL;
 }
@@ -5060,6 +6156,7 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	struct weston_output *output, *next;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->frame_throttle_timer);
 
 	/* Destroy all outputs associated with this compositor */
 	wl_list_for_each_safe(output, next, &ec->output_list, link)
@@ -5149,6 +6246,27 @@ weston_compositor_set_presentation_clock_software(
 	return -1;
 }
 
+/** Drive the Presentation clock from the backend
+ *
+ * \param compositor
+ * \param now The new current time.
+ *
+ * From the first call on, weston_compositor_read_presentation_clock()
+ * returns \c now instead of reading the system clock, until the backend
+ * sets the clock again. Outputs are then repainted as soon as a frame
+ * has been finished, without waiting for a repaint window in wall clock
+ * time, so that frame timing only depends on how the backend steps the
+ * clock. The clock must never go backwards.
+ */
+WL_EXPORT void
+weston_compositor_set_presentation_clock_virtual(
+					struct weston_compositor *compositor,
+					const struct timespec *now)
+{
+	compositor->presentation_clock_virtual = true;
+	compositor->presentation_clock_now = *now;
+}
+
 /** Read the current time from the Presentation clock
  *
  * \param compositor
@@ -5169,6 +6287,11 @@ weston_compositor_read_presentation_clock(
 	static bool warned;
 	int ret;
 
+	if (compositor->presentation_clock_virtual) {
+		*ts = compositor->presentation_clock_now;
+		return;
+	}
+
 	ret = clock_gettime(compositor->presentation_clock, ts);
 	if (ret < 0) {
 		ts->tv_sec = 0;
@@ -5283,6 +6406,14 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 
 	weston_plugin_api_destroy_list(compositor);
 
+	weston_pick_grid_destroy(compositor->pick_grid);
+	wl_array_release(&compositor->layer_list_snapshot);
+	pixman_region32_fini(&compositor->accumulate_clip);
+	pixman_region32_fini(&compositor->accumulate_opaque);
+	pixman_region32_fini(&compositor->accumulate_damage);
+	weston_compositor_destroy_client_stats(compositor);
+	weston_compositor_destroy_slabs(compositor);
+
 	free(compositor);
 }
 
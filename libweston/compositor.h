@@ -145,6 +145,44 @@ struct weston_output_zoom {
 	struct wl_listener motion_listener;
 };
 
+#define WESTON_REPAINT_HISTORY 32
+
+/** Repaint timing of an output, see weston_output_get_repaint_stats() */
+struct weston_repaint_stats {
+	uint32_t samples;	/**< repaints in the history */
+	uint32_t min_usec;	/**< shortest repaint in the history */
+	uint32_t avg_usec;	/**< mean repaint time in the history */
+	uint32_t max_usec;	/**< longest repaint in the history */
+	int32_t window_usec;	/**< window given to the next repaint */
+	uint64_t repaints;	/**< repaints since the output was enabled */
+	uint64_t late;		/**< repaints that overran their window */
+};
+
+#define WESTON_REPAINT_HISTOGRAM_BUCKETS 10
+
+/** Counters of an output since it was enabled
+ *
+ * Bucket i of repaint_histogram counts the repaints that took less than
+ * 250 << i microseconds, the last bucket all longer ones.
+ */
+struct weston_output_stats {
+	uint64_t frames_presented;	/**< frames that reached the screen */
+	uint64_t vblanks_missed;	/**< refreshes missed by late frames */
+	uint64_t views;		/**< views shown, summed over repaints */
+	uint64_t plane_views;	/**< of those, views not on the primary plane */
+	uint64_t plane_cache_hits;	/**< views that kept their plane */
+	uint64_t plane_cache_misses;	/**< views that searched for a plane */
+	uint32_t repaint_histogram[WESTON_REPAINT_HISTOGRAM_BUCKETS];
+};
+
+/** Counters of a client, in weston_compositor::client_stats_list */
+struct weston_client_stats {
+	struct wl_client *client;
+	struct wl_list link;
+	struct wl_listener destroy_listener;
+	uint64_t commits;	/**< wl_surface.commit requests */
+};
+
 /* bit compatible with drm definitions. */
 enum dpms_enum {
 	WESTON_DPMS_ON,
@@ -191,6 +229,29 @@ struct weston_output {
 	int destroying;
 	struct wl_list feedback_list;
 
+	/** Views shown on this output, in stacking order, top first.
+	 * Rebuilt from weston_compositor::view_list before a repaint when
+	 * visible_views_dirty is set. */
+	struct wl_array visible_views; /* struct weston_view * */
+	bool visible_views_dirty;
+
+	/* Time from the start of a repaint until the backend has queued
+	 * it, for the last WESTON_REPAINT_HISTORY repaints. */
+	struct {
+		uint32_t usec[WESTON_REPAINT_HISTORY];
+		unsigned count;
+		unsigned next;
+		int32_t window_usec;
+		uint64_t repaints;
+		uint64_t late;
+		/* Presentation time of the last frame, and the refresh the
+		 * repaint in flight is meant for, 0 if unknown. */
+		int64_t last_vblank_nsec;
+		int64_t target_vblank_nsec;
+	} repaint_timing;
+
+	struct weston_output_stats stats;
+
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
 	uint32_t transform;
@@ -651,6 +712,29 @@ struct weston_plane {
 	pixman_region32_t clip;
 	int32_t x, y;
 	struct wl_list link;
+
+	/* Views on this plane in stacking order, only valid during
+	 * damage accumulation. struct weston_view * */
+	struct wl_array views;
+	uint32_t views_serial;
+};
+
+struct weston_pixels_readback;
+
+typedef void (*weston_pixels_readback_done_func_t)(
+				struct weston_pixels_readback *readback,
+				const void *pixels);
+
+/** A read of output pixels in flight, see
+ * weston_output_read_pixels_async(). Embedded into the structure of its
+ * user, which must keep it alive until done is called or it is
+ * cancelled. */
+struct weston_pixels_readback {
+	struct wl_list link;	/* renderer's list while in flight */
+	pixman_format_code_t format;
+	uint32_t x, y, width, height;
+	weston_pixels_readback_done_func_t done;
+	void *renderer_data;
 };
 
 struct weston_renderer {
@@ -658,6 +742,9 @@ struct weston_renderer {
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+	/** See weston_output_read_pixels_async() */
+	int (*read_pixels_async)(struct weston_output *output,
+				 struct weston_pixels_readback *readback);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -743,6 +830,8 @@ struct weston_backend {
 
 struct weston_desktop_xwayland;
 struct weston_desktop_xwayland_interface;
+struct weston_pick_grid;
+struct weston_slab;
 
 struct weston_compositor {
 	struct wl_signal destroy_signal;
@@ -783,6 +872,9 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;
 	struct wl_list view_list;	/* struct weston_view::link */
+	bool view_list_needs_rebuild;
+	struct wl_array layer_list_snapshot; /* struct weston_layer * */
+	struct weston_pick_grid *pick_grid; /* spatial index of view_list */
 	struct wl_list plane_list;
 	struct wl_list key_binding_list;
 	struct wl_list modifier_binding_list;
@@ -800,6 +892,21 @@ struct weston_compositor {
 
 	/* Repaint state. */
 	struct weston_plane primary_plane;
+
+	/* Scratch state of the damage accumulation, kept across repaints
+	 * so that region data is not reallocated every frame. */
+	uint32_t accumulate_serial;
+	pixman_region32_t accumulate_clip;
+	pixman_region32_t accumulate_opaque;
+	pixman_region32_t accumulate_damage;
+
+	/* Pools for the objects clients create and destroy the most. */
+	struct weston_slab *surface_slab;
+	struct weston_slab *view_slab;
+	struct weston_slab *subsurface_slab;
+	struct weston_slab *frame_callback_slab;
+	struct weston_slab *feedback_slab;
+
 	uint32_t capabilities; /* combination of enum weston_capability */
 
 	struct weston_renderer *renderer;
@@ -827,7 +934,40 @@ struct weston_compositor {
 	bool vt_switching;
 
 	clockid_t presentation_clock;
+	/* A virtual presentation clock only moves when the backend sets
+	 * it, see weston_compositor_set_presentation_clock_virtual(). */
+	bool presentation_clock_virtual;
+	struct timespec presentation_clock_now;
 	int32_t repaint_msec;
+	/* Size the repaint window from measured repaint times, plus this
+	 * margin, instead of using repaint_msec. */
+	bool repaint_adaptive;
+	int32_t repaint_margin_msec;
+	/* Minimum time between frame callbacks of occluded surfaces, 0 to
+	 * not throttle them. */
+	uint32_t occluded_frame_msec;
+	struct wl_event_source *frame_throttle_timer;
+	bool frame_throttle_armed;
+	/* Threads the pixman renderer draws with, set before it is
+	 * initialized; 0 or 1 for only the compositor thread. */
+	int32_t pixman_threads;
+	/* Bytes the pixman renderer may spend on keeping transformed
+	 * views, 0 to resample them on every repaint. */
+	size_t pixman_transform_cache_size;
+	/* Buffers the GL renderer stages shm uploads in, 0 to upload
+	 * straight from client memory. */
+	int32_t gl_upload_buffers;
+	/* Largest width and height of shm surfaces the GL renderer
+	 * packs into shared atlas textures, 0 for none. */
+	int32_t gl_atlas_max_size;
+	/* Whether the GL renderer keeps linked shader programs in the
+	 * user's cache directory. */
+	bool gl_program_cache;
+
+	/* Performance counters. */
+	uint64_t upload_bytes;	/* shm data uploaded by the renderer */
+	uint64_t commits;
+	struct wl_list client_stats_list; /* weston_client_stats::link */
 
 	unsigned int activate_serial;
 
@@ -964,6 +1104,9 @@ struct weston_view {
 	 */
 	struct {
 		int dirty;
+		/* Bumped by weston_view_geometry_dirty(), for renderers
+		 * that keep what they derive from the transform. */
+		uint32_t serial;
 
 		/* Approximations in global coordinates:
 		 * - boundingbox is guaranteed to include the whole view in
@@ -1001,6 +1144,12 @@ struct weston_view {
 	uint32_t psf_flags;
 
 	bool is_mapped;
+
+	/* Managed by the pick grid, see weston_compositor_pick_view() */
+	struct {
+		uint32_t generation;	/* grid rebuild that saw the view */
+		uint32_t order;		/* position in view_list then */
+	} pick_grid;
 };
 
 struct weston_surface_state {
@@ -1085,6 +1234,16 @@ struct weston_surface {
 	 */
 	bool touched;
 
+	/* Set by the damage accumulation of a repaint when no view of the
+	 * surface shows any part of it on an output. */
+	bool occluded;
+
+	/* Frame callback throttling, see
+	 * weston_compositor::occluded_frame_msec. frame_throttled is the
+	 * occlusion at the last frame, and only changes with it. */
+	uint32_t frame_done_time;
+	bool frame_throttled;
+
 	void *renderer_state;
 
 	struct wl_list views;
@@ -1214,6 +1373,9 @@ weston_view_to_global_fixed(struct weston_view *view,
 void
 weston_view_to_global_float(struct weston_view *view,
 			    float sx, float sy, float *x, float *y);
+void
+weston_view_to_global_points(struct weston_view *view,
+			     float *x, float *y, int n);
 
 void
 weston_view_from_global_float(struct weston_view *view,
@@ -1331,6 +1493,9 @@ weston_output_finish_frame(struct weston_output *output,
 void
 weston_output_schedule_repaint(struct weston_output *output);
 void
+weston_output_get_repaint_stats(struct weston_output *output,
+				struct weston_repaint_stats *stats);
+void
 weston_output_damage(struct weston_output *output);
 void
 weston_compositor_schedule_repaint(struct weston_compositor *compositor);
@@ -1541,6 +1706,17 @@ weston_surface_copy_content(struct weston_surface *surface,
 			    int src_x, int src_y,
 			    int width, int height);
 
+int
+weston_output_read_pixels_async(struct weston_output *output,
+				struct weston_pixels_readback *readback,
+				pixman_format_code_t format,
+				uint32_t x, uint32_t y,
+				uint32_t width, uint32_t height,
+				weston_pixels_readback_done_func_t done);
+
+void
+weston_pixels_readback_cancel(struct weston_pixels_readback *readback);
+
 struct weston_buffer *
 weston_buffer_from_resource(struct wl_resource *resource);
 
@@ -1580,6 +1756,10 @@ int
 weston_compositor_set_presentation_clock_software(
 					struct weston_compositor *compositor);
 void
+weston_compositor_set_presentation_clock_virtual(
+					struct weston_compositor *compositor,
+					const struct timespec *now);
+void
 weston_compositor_read_presentation_clock(
 			const struct weston_compositor *compositor,
 			struct timespec *ts);
@@ -0,0 +1,167 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <wayland-util.h>
+
+#include "drm-plane-cache.h"
+#include "shared/helpers.h"
+
+struct drm_plane_cache_entry {
+	struct drm_plane_cache_key key;
+	enum drm_plane_kind kind;
+};
+
+void
+drm_plane_cache_init(struct drm_plane_cache *cache)
+{
+	memset(cache, 0, sizeof *cache);
+	wl_array_init(&cache->entries);
+	wl_array_init(&cache->next);
+}
+
+void
+drm_plane_cache_release(struct drm_plane_cache *cache)
+{
+	wl_array_release(&cache->entries);
+	wl_array_release(&cache->next);
+}
+
+/** Forget the previous assignment, the next repaint searches all planes */
+void
+drm_plane_cache_invalidate(struct drm_plane_cache *cache)
+{
+	cache->entries.size = 0;
+}
+
+/** Start assigning the views of a repaint */
+void
+drm_plane_cache_begin(struct drm_plane_cache *cache)
+{
+	cache->index = 0;
+	cache->valid = cache->age < DRM_PLANE_CACHE_MAX_AGE;
+	if (cache->valid)
+		cache->age++;
+	else
+		cache->age = 0;
+
+	cache->next.size = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+}
+
+static bool
+search_planes(drm_plane_try_func_t try_plane, void *data,
+	      enum drm_plane_kind *kind)
+{
+	static const enum drm_plane_kind order[] = {
+		DRM_PLANE_KIND_CURSOR,
+		DRM_PLANE_KIND_SCANOUT,
+		DRM_PLANE_KIND_OVERLAY,
+	};
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(order); i++) {
+		if (try_plane(data, order[i])) {
+			*kind = order[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Assign the next view, in the order of the view list
+ *
+ * \param cache The cache of the output.
+ * \param key The key of the view.
+ * \param try_plane Called for the planes to try, see drm_plane_try_func_t.
+ * \param data Passed to try_plane.
+ * \return The kind of plane the view got. For DRM_PLANE_KIND_PRIMARY,
+ * try_plane did not succeed and the view belongs on the primary plane.
+ */
+enum drm_plane_kind
+drm_plane_cache_assign(struct drm_plane_cache *cache,
+		       const struct drm_plane_cache_key *key,
+		       drm_plane_try_func_t try_plane, void *data)
+{
+	struct drm_plane_cache_entry *prev = NULL, *entry;
+	enum drm_plane_kind kind = DRM_PLANE_KIND_PRIMARY;
+	bool hit = false;
+
+	if (cache->valid &&
+	    (cache->index + 1) * sizeof *prev <= cache->entries.size) {
+		prev = (struct drm_plane_cache_entry *) cache->entries.data +
+		       cache->index;
+		if (memcmp(&prev->key, key, sizeof *key) != 0)
+			prev = NULL;
+	}
+
+	if (key->overlapped) {
+		/* Only the primary plane keeps the stacking order. */
+		hit = prev != NULL;
+	} else if (prev && prev->kind == DRM_PLANE_KIND_PRIMARY) {
+		hit = true;
+	} else if (prev && try_plane(data, prev->kind)) {
+		kind = prev->kind;
+		hit = true;
+	} else if (!search_planes(try_plane, data, &kind)) {
+		kind = DRM_PLANE_KIND_PRIMARY;
+	}
+
+	/* The planes left for the views below depend on this one. */
+	if (hit)
+		cache->hits++;
+	else
+		cache->misses++;
+	cache->valid = cache->valid && hit;
+	cache->index++;
+
+	/* Without an entry, the views below miss in the next repaint, as
+	 * their keys name the view. */
+	entry = wl_array_add(&cache->next, sizeof *entry);
+	if (entry) {
+		entry->key = *key;
+		entry->kind = kind;
+	}
+
+	return kind;
+}
+
+/** Finish the repaint, its assignment becomes the one to reuse */
+void
+drm_plane_cache_end(struct drm_plane_cache *cache)
+{
+	struct wl_array tmp;
+
+	tmp = cache->entries;
+	cache->entries = cache->next;
+	cache->next = tmp;
+}
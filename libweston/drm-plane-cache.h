@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_DRM_PLANE_CACHE_H
+#define WESTON_DRM_PLANE_CACHE_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <wayland-util.h>
+
+/** Kinds of planes the DRM backend can put a view on. */
+enum drm_plane_kind {
+	DRM_PLANE_KIND_PRIMARY = 0,
+	DRM_PLANE_KIND_CURSOR,
+	DRM_PLANE_KIND_SCANOUT,
+	DRM_PLANE_KIND_OVERLAY,
+};
+
+/** What the plane checks of a view depend on
+ *
+ * Apart from these, whether a view fits a plane only depends on the
+ * planes taken by the views above it. Keys must be zero initialized,
+ * they are compared as a whole.
+ */
+struct drm_plane_cache_key {
+	const void *view;
+	uint32_t transform_serial;	/**< weston_view::transform.serial */
+	int32_t width;
+	int32_t height;
+	uint32_t buffer_type;		/**< none, shm, dmabuf, ... */
+	uint32_t buffer_transform;
+	int32_t buffer_scale;
+	float alpha;
+	uint32_t output_mask;
+	bool overlapped;		/**< below a view on the primary plane */
+};
+
+/** The plane assignment of an output in its previous repaint
+ *
+ * Views are assigned in order, top first. As long as the views and
+ * their keys match the previous repaint, each view is first given the
+ * plane it had then. A view that was left on the primary plane stays
+ * there without any checks. From the first view that does not match,
+ * or whose plane no longer fits, the remaining views search all planes.
+ *
+ * A stale entry can only leave a view on the primary plane, which is
+ * always correct, since a cached plane is checked again by trying it.
+ * Things the key does not capture, like the format of a new buffer, are
+ * picked up by a full search every DRM_PLANE_CACHE_MAX_AGE repaints.
+ */
+struct drm_plane_cache {
+	struct wl_array entries;	/**< previous repaint */
+	struct wl_array next;		/**< current repaint */
+	size_t index;
+	bool valid;
+	unsigned int age;
+
+	uint32_t hits;		/**< views of this repaint that reused a plane */
+	uint32_t misses;	/**< views of this repaint that searched */
+};
+
+#define DRM_PLANE_CACHE_MAX_AGE 30
+
+/** Tries to put the view on a plane of the given kind
+ *
+ * \param data The data given to drm_plane_cache_assign().
+ * \param kind Never DRM_PLANE_KIND_PRIMARY.
+ * \return Whether the view was put on such a plane.
+ */
+typedef bool (*drm_plane_try_func_t)(void *data, enum drm_plane_kind kind);
+
+void
+drm_plane_cache_init(struct drm_plane_cache *cache);
+
+void
+drm_plane_cache_release(struct drm_plane_cache *cache);
+
+void
+drm_plane_cache_invalidate(struct drm_plane_cache *cache);
+
+void
+drm_plane_cache_begin(struct drm_plane_cache *cache);
+
+enum drm_plane_kind
+drm_plane_cache_assign(struct drm_plane_cache *cache,
+		       const struct drm_plane_cache_key *key,
+		       drm_plane_try_func_t try_plane, void *data);
+
+void
+drm_plane_cache_end(struct drm_plane_cache *cache);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -31,11 +31,17 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <float.h>
+#include <limits.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <linux/input.h>
 #include <drm_fourcc.h>
 
@@ -86,6 +92,22 @@ struct gl_output_state {
 	enum gl_border_status border_status;
 
 	struct weston_matrix output_matrix;
+
+	/* Asynchronous readbacks of the last frame, finished at the next
+	 * repaint or by the timer a refresh later, whichever is first. */
+	struct wl_list readback_list; /* weston_pixels_readback::link */
+	struct wl_list readback_buffers; /* gl_readback_buffer::link */
+	struct wl_event_source *readback_timer;
+};
+
+/* Readbacks land in pixel pack buffers, or in plain memory if the GL has
+ * none. Buffers are reused once the readbacks of a frame are done. */
+struct gl_readback_buffer {
+	struct wl_list link;
+	GLuint name;
+	size_t size;
+	void *data;
+	bool busy;
 };
 
 enum buffer_type {
@@ -97,6 +119,72 @@ enum buffer_type {
 
 struct gl_renderer;
 
+/* Small shm surfaces share atlas textures of ATLAS_SIZE squared texels.
+ * An atlas is split into shelves, horizontal bands of a height that is a
+ * multiple of ATLAS_UNIT, and a shelf into columns of ATLAS_UNIT texels,
+ * so that the 64 columns of a shelf fit into one bitmask. Empty shelves
+ * give their band back to the atlas. */
+#define ATLAS_SIZE 1024
+#define ATLAS_UNIT 16
+#define ATLAS_MAX_COUNT 4
+
+struct gl_atlas_shelf {
+	struct wl_list link;	/* gl_atlas::shelf_list, sorted by y */
+	int32_t y, height;
+	uint64_t columns;	/* bit i: texels i * ATLAS_UNIT on are in use */
+};
+
+struct gl_atlas {
+	GLuint tex;
+	struct wl_list shelf_list;
+};
+
+/* The GL state a view is drawn with. Consecutive draws with equal state
+ * go into one batch of indexed triangles, see repaint_region(). */
+struct gl_draw_state {
+	struct gl_shader *shader;
+	GLenum target;
+	GLuint textures[3];
+	int num_textures;
+	GLint filter;
+	bool blend;
+	GLfloat alpha;
+	GLfloat color[4];
+};
+
+/* The triangle fans of a view for one pair of repaint and surface
+ * regions. They are kept while the transform of the view and the layout
+ * of its texture stay the same, so that views that do not move are not
+ * clipped again on every repaint. */
+#define VIEW_GEOMETRY_COUNT 4
+
+struct gl_view_geometry {
+	bool valid;
+	uint32_t transform_serial;
+	struct weston_matrix surface_to_buffer;
+	struct gl_atlas *atlas;
+	int32_t atlas_x, atlas_y;
+	int pitch, height, y_inverted;
+	pixman_region32_t region;
+	pixman_region32_t surf_region;
+
+	struct wl_array vertices;	/* GLfloat */
+	struct wl_array vtxcnt;		/* unsigned int */
+};
+
+struct gl_view_state {
+	struct wl_list link;		/* gl_renderer::view_state_list */
+	struct wl_listener destroy_listener;
+	struct gl_view_geometry geometry[VIEW_GEOMETRY_COUNT];
+	int next;			/* entry replaced on a miss */
+};
+
+/* A pixel unpack buffer that shm damage is staged in. */
+struct gl_upload_buffer {
+	GLuint name;
+	GLsizeiptr size;
+};
+
 struct egl_image {
 	struct gl_renderer *renderer;
 	EGLImageKHR image;
@@ -154,6 +242,13 @@ struct gl_surface_state {
 	GLenum target;
 	int num_images;
 
+	/* Where the surface is drawn from when it lives in an atlas, in
+	 * place of textures[0]. */
+	struct gl_atlas *atlas;
+	struct gl_atlas_shelf *atlas_shelf;
+	uint64_t atlas_columns;
+	int32_t atlas_x, atlas_y;
+
 	struct weston_buffer_reference buffer_ref;
 	enum buffer_type buffer_type;
 	int pitch; /* in pixels */
@@ -182,6 +277,24 @@ struct gl_renderer {
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
 
+	/* The batch being collected: triangles indexing vertices from
+	 * batch_first on, all drawn with draw_state. */
+	struct wl_array indices;
+	uint32_t batch_first;
+	struct gl_draw_state draw_state;
+	bool draw_state_valid;
+
+	/* The cached geometry of every view drawn so far, freed with the
+	 * view or, for views that outlive us, when the renderer is
+	 * destroyed. */
+	struct wl_list view_state_list;	/* gl_view_state::link */
+
+	/* Per repaint counts, logged when draw_count_debug is set. */
+	struct weston_binding *draw_count_binding;
+	int draw_count_debug;
+	uint32_t draw_calls;
+	uint32_t state_changes;
+
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
 	PFNEGLDESTROYIMAGEKHRPROC destroy_image;
@@ -190,6 +303,37 @@ struct gl_renderer {
 
 	int has_unpack_subimage;
 
+	/* Pixel buffer objects, for shm uploads and output readbacks. */
+	bool has_pixel_buffers;
+	GLenum pack_buffer_usage;
+
+	/* Ring of buffers for shm uploads, empty if not supported or
+	 * not enabled. */
+	void *(GL_APIENTRY *map_buffer_range)(GLenum target, GLintptr offset,
+					      GLsizeiptr length,
+					      GLbitfield access);
+	GLboolean (GL_APIENTRY *unmap_buffer)(GLenum target);
+	struct gl_upload_buffer *upload_buffers;
+	int upload_buffer_count;
+	int upload_buffer_next;
+
+	/* Largest width and height of surfaces put into an atlas, 0 to
+	 * give every surface a texture of its own. */
+	int32_t atlas_max_size;
+	struct gl_atlas atlases[ATLAS_MAX_COUNT];
+	struct wl_array atlas_staging;
+
+	/* Directory linked shader programs are cached in, NULL when
+	 * the cache is disabled or not supported. The seed is a hash of
+	 * the GL driver identification. */
+	char *program_cache_dir;
+	uint64_t program_cache_seed;
+	void (GL_APIENTRY *get_program_binary)(GLuint program, GLsizei size,
+					       GLsizei *length,
+					       GLenum *format, void *binary);
+	void (GL_APIENTRY *program_binary)(GLuint program, GLenum format,
+					   const void *binary, GLint length);
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -395,9 +539,7 @@ calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
 	ctx.clip.y2 = rect->y2;
 
 	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
+	weston_view_to_global_points(ev, surf.x, surf.y, surf.n);
 
 	/* find bounding box: */
 	min_x = max_x = surf.x[0];
@@ -494,7 +636,7 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
+	GLfloat *v, inv_width, inv_height, offset_x, offset_y;
 	unsigned int *vtxcnt, nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
 	pixman_box32_t *raw_rects;
@@ -517,8 +659,17 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
 	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
+	if (gs->atlas) {
+		inv_width = 1.0 / ATLAS_SIZE;
+		inv_height = 1.0 / ATLAS_SIZE;
+		offset_x = gs->atlas_x;
+		offset_y = gs->atlas_y;
+	} else {
+		inv_width = 1.0 / gs->pitch;
+		inv_height = 1.0 / gs->height;
+		offset_x = 0.0;
+		offset_y = 0.0;
+	}
 
 	for (i = 0; i < nrects; i++) {
 		pixman_box32_t *rect = &rects[i];
@@ -557,11 +708,12 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 				weston_surface_to_buffer_float(ev->surface,
 							       sx, sy,
 							       &bx, &by);
-				*(v++) = bx * inv_width;
+				*(v++) = (offset_x + bx) * inv_width;
 				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
+					*(v++) = (offset_y + by) * inv_height;
 				} else {
-					*(v++) = (gs->height - by) * inv_height;
+					*(v++) = (offset_y + gs->height - by) *
+						 inv_height;
 				}
 			}
 
@@ -574,6 +726,163 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	return nvtx;
 }
 
+static void
+view_state_destroy(struct gl_view_state *vs)
+{
+	int i;
+
+	for (i = 0; i < VIEW_GEOMETRY_COUNT; i++) {
+		pixman_region32_fini(&vs->geometry[i].region);
+		pixman_region32_fini(&vs->geometry[i].surf_region);
+		wl_array_release(&vs->geometry[i].vertices);
+		wl_array_release(&vs->geometry[i].vtxcnt);
+	}
+
+	wl_list_remove(&vs->destroy_listener.link);
+	wl_list_remove(&vs->link);
+	free(vs);
+}
+
+static void
+view_state_handle_view_destroy(struct wl_listener *listener, void *data)
+{
+	struct gl_view_state *vs =
+		container_of(listener, struct gl_view_state,
+			     destroy_listener);
+
+	view_state_destroy(vs);
+}
+
+static struct gl_view_state *
+get_view_state(struct weston_view *view)
+{
+	struct gl_renderer *gr = get_renderer(view->surface->compositor);
+	struct gl_view_state *vs;
+	struct wl_listener *listener;
+	int i;
+
+	listener = wl_signal_get(&view->destroy_signal,
+				 view_state_handle_view_destroy);
+	if (listener)
+		return container_of(listener, struct gl_view_state,
+				    destroy_listener);
+
+	vs = zalloc(sizeof *vs);
+	if (!vs)
+		return NULL;
+
+	for (i = 0; i < VIEW_GEOMETRY_COUNT; i++) {
+		pixman_region32_init(&vs->geometry[i].region);
+		pixman_region32_init(&vs->geometry[i].surf_region);
+	}
+
+	wl_list_insert(&gr->view_state_list, &vs->link);
+	vs->destroy_listener.notify = view_state_handle_view_destroy;
+	wl_signal_add(&view->destroy_signal, &vs->destroy_listener);
+
+	return vs;
+}
+
+static bool
+view_geometry_matches(struct gl_view_geometry *geometry,
+		      struct weston_view *ev, pixman_region32_t *region,
+		      pixman_region32_t *surf_region)
+{
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+
+	return geometry->valid &&
+	       geometry->transform_serial == ev->transform.serial &&
+	       geometry->atlas == gs->atlas &&
+	       geometry->atlas_x == gs->atlas_x &&
+	       geometry->atlas_y == gs->atlas_y &&
+	       geometry->pitch == gs->pitch &&
+	       geometry->height == gs->height &&
+	       geometry->y_inverted == gs->y_inverted &&
+	       memcmp(&geometry->surface_to_buffer,
+		      &ev->surface->surface_to_buffer_matrix,
+		      sizeof geometry->surface_to_buffer) == 0 &&
+	       pixman_region32_equal(&geometry->region, region) &&
+	       pixman_region32_equal(&geometry->surf_region, surf_region);
+}
+
+static bool
+copy_array(struct wl_array *dst, const void *data, size_t size)
+{
+	void *p;
+
+	p = wl_array_add(dst, size);
+	if (!p)
+		return false;
+
+	memcpy(p, data, size);
+	return true;
+}
+
+/* Same as texture_region(), but from the geometry kept for the view
+ * when nothing it depends on has changed. */
+static int
+view_geometry(struct weston_view *ev, pixman_region32_t *region,
+	      pixman_region32_t *surf_region)
+{
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_view_geometry *geometry;
+	struct gl_view_state *vs;
+	size_t first_vertex, first_fan;
+	unsigned int *vtxcnt;
+	int i, nfans, nvtx;
+
+	vs = get_view_state(ev);
+	if (!vs)
+		return texture_region(ev, region, surf_region);
+
+	for (i = 0; i < VIEW_GEOMETRY_COUNT; i++) {
+		geometry = &vs->geometry[i];
+		if (!view_geometry_matches(geometry, ev, region, surf_region))
+			continue;
+
+		if (!copy_array(&gr->vertices, geometry->vertices.data,
+				geometry->vertices.size) ||
+		    !copy_array(&gr->vtxcnt, geometry->vtxcnt.data,
+				geometry->vtxcnt.size))
+			return 0;
+
+		return geometry->vtxcnt.size / sizeof(unsigned int);
+	}
+
+	first_vertex = gr->vertices.size;
+	first_fan = gr->vtxcnt.size;
+	nfans = texture_region(ev, region, surf_region);
+
+	vtxcnt = (unsigned int *) ((char *) gr->vtxcnt.data + first_fan);
+	for (i = 0, nvtx = 0; i < nfans; i++)
+		nvtx += vtxcnt[i];
+
+	geometry = &vs->geometry[vs->next];
+	vs->next = (vs->next + 1) % VIEW_GEOMETRY_COUNT;
+
+	geometry->vertices.size = 0;
+	geometry->vtxcnt.size = 0;
+	geometry->valid =
+		copy_array(&geometry->vertices,
+			   (char *) gr->vertices.data + first_vertex,
+			   nvtx * 4 * sizeof(GLfloat)) &&
+		copy_array(&geometry->vtxcnt, vtxcnt,
+			   nfans * sizeof *vtxcnt);
+	geometry->transform_serial = ev->transform.serial;
+	geometry->surface_to_buffer = ev->surface->surface_to_buffer_matrix;
+	geometry->atlas = gs->atlas;
+	geometry->atlas_x = gs->atlas_x;
+	geometry->atlas_y = gs->atlas_y;
+	geometry->pitch = gs->pitch;
+	geometry->height = gs->height;
+	geometry->y_inverted = gs->y_inverted;
+	pixman_region32_copy(&geometry->region, region);
+	pixman_region32_copy(&geometry->surf_region, surf_region);
+
+	return nfans;
+}
+
 static void
 triangle_fan_debug(struct weston_view *view, int first, int count)
 {
@@ -614,15 +923,90 @@ triangle_fan_debug(struct weston_view *view, int first, int count)
 	free(buffer);
 }
 
+/* Draw the triangles collected so far, keeping the vertices. */
+static void
+draw_batch(struct gl_renderer *gr)
+{
+	GLfloat *v = (GLfloat *) gr->vertices.data + gr->batch_first * 4;
+
+	if (gr->indices.size == 0)
+		return;
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(1);
+
+	glDrawElements(GL_TRIANGLES, gr->indices.size / sizeof(GLushort),
+		       GL_UNSIGNED_SHORT, gr->indices.data);
+	gr->draw_calls++;
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	gr->indices.size = 0;
+}
+
+/* Draw the batch before the GL state changes. */
+static void
+flush_batch(struct gl_renderer *gr)
+{
+	draw_batch(gr);
+	gr->vertices.size = 0;
+	gr->batch_first = 0;
+}
+
+static void
+repaint_region_debug(struct weston_view *ev, int nfans)
+{
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	GLfloat *v = gr->vertices.data;
+	unsigned int *vtxcnt = gr->vtxcnt.data;
+	int i, first;
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
+	glEnableVertexAttribArray(1);
+
+	for (i = 0, first = 0; i < nfans; i++) {
+		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
+		gr->draw_calls++;
+		triangle_fan_debug(ev, first, vtxcnt[i]);
+		first += vtxcnt[i];
+	}
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	gr->vertices.size = 0;
+
+	/* The outlines changed the color of the solid shader. */
+	gr->draw_state_valid = false;
+}
+
 static void
 repaint_region(struct weston_view *ev, pixman_region32_t *region,
 		pixman_region32_t *surf_region)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
 	unsigned int *vtxcnt;
-	int i, first, nfans;
+	GLushort *index;
+	uint32_t first, j;
+	int i, nfans;
+
+	/* The fans of the debug mode are outlined one by one. */
+	if (gr->fan_debug)
+		flush_batch(gr);
+
+	first = gr->vertices.size / (4 * sizeof(GLfloat));
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -632,30 +1016,39 @@ repaint_region(struct weston_view *ev, pixman_region32_t *region,
 	 * polygon for each pair, and store it as a triangle fan if
 	 * it has a non-zero area (at least 3 vertices, actually).
 	 */
-	nfans = texture_region(ev, region, surf_region);
-
-	v = gr->vertices.data;
+	nfans = view_geometry(ev, region, surf_region);
 	vtxcnt = gr->vtxcnt.data;
 
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
+	if (gr->fan_debug) {
+		repaint_region_debug(ev, nfans);
+		gr->vtxcnt.size = 0;
+		return;
+	}
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	/* Turn the fans into triangles added to the batch. */
+	for (i = 0; i < nfans; i++) {
+		/* Indices are 16 bits, so the batch may need to be drawn
+		 * and restarted on the way. */
+		if (first + vtxcnt[i] - gr->batch_first > 65536) {
+			draw_batch(gr);
+			gr->batch_first = first;
+		}
 
-	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
-		if (gr->fan_debug)
-			triangle_fan_debug(ev, first, vtxcnt[i]);
+		index = wl_array_add(&gr->indices,
+				     (vtxcnt[i] - 2) * 3 * sizeof *index);
+		if (!index)
+			break;
+
+		for (j = 1; j + 1 < vtxcnt[i]; j++) {
+			*index++ = first - gr->batch_first;
+			*index++ = first - gr->batch_first + j;
+			*index++ = first - gr->batch_first + j + 1;
+		}
 		first += vtxcnt[i];
 	}
 
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(0);
-
-	gr->vertices.size = 0;
+	/* texture_region() made room for the worst case. */
+	gr->vertices.size = first * 4 * sizeof(GLfloat);
 	gr->vtxcnt.size = 0;
 }
 
@@ -724,6 +1117,100 @@ shader_uniforms(struct gl_shader *shader,
 		glUniform1i(shader->tex_uniforms[i], i);
 }
 
+static bool
+draw_state_equal(const struct gl_draw_state *a, const struct gl_draw_state *b)
+{
+	int i;
+
+	if (a->shader != b->shader ||
+	    a->target != b->target ||
+	    a->num_textures != b->num_textures ||
+	    a->filter != b->filter ||
+	    a->blend != b->blend ||
+	    a->alpha != b->alpha ||
+	    memcmp(a->color, b->color, sizeof a->color) != 0)
+		return false;
+
+	for (i = 0; i < a->num_textures; i++)
+		if (a->textures[i] != b->textures[i])
+			return false;
+
+	return true;
+}
+
+/** Switch to the GL state of the next draw
+ *
+ * Nothing happens if the state is the same as that of the batch being
+ * collected, which then grows by the next draw. Otherwise the batch is
+ * drawn, and only the parts of the state that differ are changed.
+ */
+static void
+set_draw_state(struct gl_renderer *gr, struct weston_output *output,
+	       const struct gl_draw_state *state)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_draw_state *cur = &gr->draw_state;
+	bool all = !gr->draw_state_valid;
+	bool new_shader;
+	int i;
+
+	if (!all && draw_state_equal(cur, state))
+		return;
+
+	flush_batch(gr);
+
+	/* Uniforms belong to the program, set them all on a switch. */
+	new_shader = all || cur->shader != state->shader;
+	if (new_shader) {
+		use_shader(gr, state->shader);
+		glUniformMatrix4fv(state->shader->proj_uniform,
+				   1, GL_FALSE, go->output_matrix.d);
+		for (i = 0; i < state->num_textures; i++)
+			glUniform1i(state->shader->tex_uniforms[i], i);
+		gr->state_changes += 2 + state->num_textures;
+	}
+
+	if (new_shader || cur->alpha != state->alpha) {
+		glUniform1f(state->shader->alpha_uniform, state->alpha);
+		gr->state_changes++;
+	}
+
+	if (new_shader ||
+	    memcmp(cur->color, state->color, sizeof cur->color) != 0) {
+		glUniform4fv(state->shader->color_uniform, 1, state->color);
+		gr->state_changes++;
+	}
+
+	/* The filter is texture state, so it is set again on every
+	 * bind. */
+	for (i = 0; i < state->num_textures; i++) {
+		if (!all && i < cur->num_textures &&
+		    cur->textures[i] == state->textures[i] &&
+		    cur->target == state->target &&
+		    cur->filter == state->filter)
+			continue;
+
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(state->target, state->textures[i]);
+		glTexParameteri(state->target,
+				GL_TEXTURE_MIN_FILTER, state->filter);
+		glTexParameteri(state->target,
+				GL_TEXTURE_MAG_FILTER, state->filter);
+		gr->state_changes += 3;
+	}
+
+	if (all || cur->blend != state->blend) {
+		if (state->blend)
+			glEnable(GL_BLEND);
+		else
+			glDisable(GL_BLEND);
+		gr->state_changes++;
+	}
+
+	*cur = *state;
+	gr->draw_state_valid = true;
+}
+
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
 	  pixman_region32_t *damage) /* in global coordinates */
@@ -737,7 +1224,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	pixman_region32_t surface_opaque;
 	/* non-opaque region in surface coordinates: */
 	pixman_region32_t surface_blend;
-	GLint filter;
+	struct gl_draw_state state;
 	int i;
 
 	/* In case of a runtime switch of renderers, we may not have received
@@ -754,28 +1241,35 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-
 	if (gr->fan_debug) {
+		flush_batch(gr);
 		use_shader(gr, &gr->solid_shader);
 		shader_uniforms(&gr->solid_shader, ev, output);
+		gr->draw_state_valid = false;
 	}
 
-	use_shader(gr, gs->shader);
-	shader_uniforms(gs->shader, ev, output);
+	memset(&state, 0, sizeof state);
+	state.shader = gs->shader;
+	state.alpha = ev->alpha;
+	memcpy(state.color, gs->color, sizeof state.color);
+
+	if (gs->shader != &gr->solid_shader) {
+		state.target = gs->target;
+		if (gs->atlas) {
+			state.num_textures = 1;
+			state.textures[0] = gs->atlas->tex;
+		} else {
+			state.num_textures = gs->num_textures;
+			for (i = 0; i < gs->num_textures; i++)
+				state.textures[i] = gs->textures[i];
+		}
+	}
 
 	if (ev->transform.enabled || output->zoom.active ||
 	    output->current_scale != ev->surface->buffer_viewport.buffer.scale)
-		filter = GL_LINEAR;
+		state.filter = GL_LINEAR;
 	else
-		filter = GL_NEAREST;
-
-	for (i = 0; i < gs->num_textures; i++) {
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
-	}
+		state.filter = GL_NEAREST;
 
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
@@ -802,21 +1296,18 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 			 * that forces texture alpha = 1.0.
 			 * Xwayland surfaces need this.
 			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
+			state.shader = &gr->texture_shader_rgbx;
 		}
 
-		if (ev->alpha < 1.0)
-			glEnable(GL_BLEND);
-		else
-			glDisable(GL_BLEND);
-
+		state.blend = ev->alpha < 1.0;
+		set_draw_state(gr, output, &state);
 		repaint_region(ev, &repaint, &surface_opaque);
 	}
 
 	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
-		glEnable(GL_BLEND);
+		state.shader = gs->shader;
+		state.blend = true;
+		set_draw_state(gr, output, &state);
 		repaint_region(ev, &repaint, &surface_blend);
 	}
 
@@ -831,11 +1322,20 @@ static void
 repaint_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **views = output->visible_views.data;
+	size_t i = output->visible_views.size / sizeof *views;
+
+	struct gl_renderer *gr = get_renderer(compositor);
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	gr->draw_state_valid = false;
+
+	/* Bottom to top, only the views on this output. */
+	while (i-- > 0)
+		if (views[i]->plane == &compositor->primary_plane)
+			draw_view(views[i], output, damage);
+
+	flush_batch(gr);
 }
 
 static void
@@ -1074,6 +1574,9 @@ output_rotate_damage(struct weston_output *output,
  * Depending on the underlying hardware, violating that assumption could
  * result in seeing through to another display plane.
  */
+static void
+finish_readbacks(struct weston_output *output);
+
 static void
 gl_renderer_repaint_output(struct weston_output *output,
 			      pixman_region32_t *output_damage)
@@ -1092,6 +1595,8 @@ gl_renderer_repaint_output(struct weston_output *output,
 	if (use_output(output) < 0)
 		return;
 
+	finish_readbacks(output);
+
 	/* Calculate the viewport */
 	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
 		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
@@ -1107,6 +1612,9 @@ gl_renderer_repaint_output(struct weston_output *output,
 			    2.0 / output->current_mode->width,
 			    -2.0 / output->current_mode->height, 1);
 
+	gr->draw_calls = 0;
+	gr->state_changes = 0;
+
 	/* if debugging, redraw everything outside the damage to clean up
 	 * debug lines from the previous draw on this buffer:
 	 */
@@ -1121,103 +1629,615 @@ gl_renderer_repaint_output(struct weston_output *output,
 		pixman_region32_fini(&undamaged);
 	}
 
-	pixman_region32_init(&total_damage);
-	pixman_region32_init(&buffer_damage);
+	pixman_region32_init(&total_damage);
+	pixman_region32_init(&buffer_damage);
+
+	output_get_damage(output, &buffer_damage, &border_damage);
+	output_rotate_damage(output, output_damage, go->border_status);
+
+	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+	border_damage |= go->border_status;
+
+	repaint_views(output, &total_damage);
+
+	if (gr->draw_count_debug)
+		weston_log("%s: %u draw calls, %u state changes\n",
+			   output->name, gr->draw_calls, gr->state_changes);
+
+	pixman_region32_fini(&total_damage);
+	pixman_region32_fini(&buffer_damage);
+
+	draw_output_borders(output, border_damage);
+
+	pixman_region32_copy(&output->previous_damage, output_damage);
+	wl_signal_emit(&output->frame_signal, output);
+
+	if (gr->swap_buffers_with_damage) {
+		pixman_region32_init(&buffer_damage);
+		weston_transformed_region(output->width, output->height,
+					  output->transform,
+					  output->current_scale,
+					  output_damage, &buffer_damage);
+
+		if (output_has_borders(output)) {
+			pixman_region32_translate(&buffer_damage,
+						  go->borders[GL_RENDERER_BORDER_LEFT].width,
+						  go->borders[GL_RENDERER_BORDER_TOP].height);
+			output_get_border_damage(output, go->border_status,
+						 &buffer_damage);
+		}
+
+		rects = pixman_region32_rectangles(&buffer_damage, &nrects);
+		egl_damage = malloc(nrects * 4 * sizeof(EGLint));
+
+		buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
+				output->current_mode->height +
+				go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+		d = egl_damage;
+		for (i = 0; i < nrects; ++i) {
+			*d++ = rects[i].x1;
+			*d++ = buffer_height - rects[i].y2;
+			*d++ = rects[i].x2 - rects[i].x1;
+			*d++ = rects[i].y2 - rects[i].y1;
+		}
+		ret = gr->swap_buffers_with_damage(gr->egl_display,
+						   go->egl_surface,
+						   egl_damage, nrects);
+		free(egl_damage);
+		pixman_region32_fini(&buffer_damage);
+	} else {
+		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
+	}
+
+	if (ret == EGL_FALSE && !errored) {
+		errored = 1;
+		weston_log("Failed in eglSwapBuffers.\n");
+		gl_renderer_print_egl_error_state();
+	}
+
+	go->border_status = BORDER_STATUS_CLEAN;
+}
+
+static int
+gl_renderer_read_pixels(struct weston_output *output,
+			       pixman_format_code_t format, void *pixels,
+			       uint32_t x, uint32_t y,
+			       uint32_t width, uint32_t height)
+{
+	GLenum gl_format;
+	struct gl_output_state *go = get_output_state(output);
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format,
+		     GL_UNSIGNED_BYTE, pixels);
+
+	return 0;
+}
+
+static void
+finish_readbacks(struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_pixels_readback *readback;
+	struct gl_readback_buffer *buffer;
+	size_t size;
+	void *map;
+
+	if (wl_list_empty(&go->readback_list))
+		goto out;
+
+	if (use_output(output) < 0)
+		goto out;
+
+	while (!wl_list_empty(&go->readback_list)) {
+		readback = container_of(go->readback_list.next,
+					struct weston_pixels_readback, link);
+		wl_list_remove(&readback->link);
+		wl_list_init(&readback->link);
+		buffer = readback->renderer_data;
+
+		if (!buffer->name) {
+			readback->done(readback, buffer->data);
+			continue;
+		}
+
+		size = (size_t) readback->width * readback->height * 4;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, buffer->name);
+		map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER_NV, 0, size,
+					   GL_MAP_READ_BIT_EXT);
+		readback->done(readback, map);
+		if (map)
+			gr->unmap_buffer(GL_PIXEL_PACK_BUFFER_NV);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+	}
+
+out:
+	/* Cancelled readbacks free their buffers here as well, but the
+	 * buffers of readbacks still queued must stay theirs. */
+	wl_list_for_each(buffer, &go->readback_buffers, link)
+		buffer->busy = false;
+	wl_list_for_each(readback, &go->readback_list, link) {
+		buffer = readback->renderer_data;
+		buffer->busy = true;
+	}
+
+	/* If the context could not be made current, the next repaint or
+	 * the destruction of the output finishes them. */
+	wl_event_source_timer_update(go->readback_timer, 0);
+}
+
+static int
+readback_timer_handler(void *data)
+{
+	finish_readbacks(data);
+
+	return 0;
+}
+
+static struct gl_readback_buffer *
+get_readback_buffer(struct gl_renderer *gr, struct gl_output_state *go,
+		    size_t size)
+{
+	struct gl_readback_buffer *buffer, *found = NULL;
+	void *data;
+
+	wl_list_for_each(buffer, &go->readback_buffers, link) {
+		if (buffer->busy)
+			continue;
+		found = buffer;
+		if (buffer->size >= size)
+			break;
+	}
+
+	if (!found) {
+		found = zalloc(sizeof *found);
+		if (!found)
+			return NULL;
+		if (gr->has_pixel_buffers)
+			glGenBuffers(1, &found->name);
+		wl_list_insert(go->readback_buffers.prev, &found->link);
+	}
+
+	if (found->size < size) {
+		if (found->name) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, found->name);
+			glBufferData(GL_PIXEL_PACK_BUFFER_NV, size, NULL,
+				     gr->pack_buffer_usage);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+		} else {
+			data = realloc(found->data, size);
+			if (!data)
+				return NULL;
+			found->data = data;
+		}
+		found->size = size;
+	}
+
+	return found;
+}
+
+/* With pack buffers, glReadPixels() only queues the copy and the GPU
+ * does it while the compositor goes on. Without them the copy is
+ * synchronous, but the callback still comes later, like with them. */
+static int
+gl_renderer_read_pixels_async(struct weston_output *output,
+			      struct weston_pixels_readback *readback)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback_buffer *buffer;
+	uint32_t refresh;
+	GLenum gl_format;
+
+	switch (readback->format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	buffer = get_readback_buffer(gr, go, (size_t) readback->width *
+					     readback->height * 4);
+	if (!buffer)
+		return -1;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	if (buffer->name) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, buffer->name);
+		glReadPixels(readback->x +
+			     go->borders[GL_RENDERER_BORDER_LEFT].width,
+			     readback->y +
+			     go->borders[GL_RENDERER_BORDER_BOTTOM].height,
+			     readback->width, readback->height, gl_format,
+			     GL_UNSIGNED_BYTE, NULL);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER_NV, 0);
+	} else {
+		glReadPixels(readback->x +
+			     go->borders[GL_RENDERER_BORDER_LEFT].width,
+			     readback->y +
+			     go->borders[GL_RENDERER_BORDER_BOTTOM].height,
+			     readback->width, readback->height, gl_format,
+			     GL_UNSIGNED_BYTE, buffer->data);
+	}
+
+	buffer->busy = true;
+	readback->renderer_data = buffer;
+	wl_list_insert(go->readback_list.prev, &readback->link);
+
+	/* An idle output does not repaint again, so do not wait for
+	 * longer than a refresh. */
+	refresh = output->current_mode->refresh;
+	if (refresh == 0)
+		refresh = 60000;
+	wl_event_source_timer_update(go->readback_timer,
+				     MAX(1000000 / refresh, 1));
+
+	return 0;
+}
+
+static bool
+atlas_init(struct gl_atlas *atlas)
+{
+	glGenTextures(1, &atlas->tex);
+	if (!atlas->tex)
+		return false;
+
+	glBindTexture(GL_TEXTURE_2D, atlas->tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT, ATLAS_SIZE, ATLAS_SIZE, 0,
+		     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+
+	return true;
+}
+
+/* Returns the first column of a free run of n columns, or -1. */
+static int
+shelf_find_columns(struct gl_atlas_shelf *shelf, uint64_t mask, int n)
+{
+	int col;
+
+	for (col = 0; col + n <= ATLAS_SIZE / ATLAS_UNIT; col++)
+		if (!(shelf->columns & (mask << col)))
+			return col;
+
+	return -1;
+}
+
+static void
+atlas_place(struct gl_surface_state *gs, struct gl_atlas *atlas,
+	    struct gl_atlas_shelf *shelf, uint64_t mask, int col)
+{
+	shelf->columns |= mask << col;
+
+	gs->atlas = atlas;
+	gs->atlas_shelf = shelf;
+	gs->atlas_columns = mask << col;
+	/* Inside the one texel wide gutter. */
+	gs->atlas_x = col * ATLAS_UNIT + 1;
+	gs->atlas_y = shelf->y + 1;
+}
+
+static bool
+atlas_alloc_in(struct gl_atlas *atlas, struct gl_surface_state *gs,
+	       int32_t height, uint64_t mask, int n)
+{
+	struct gl_atlas_shelf *shelf, *next = NULL;
+	int32_t y = 0;
+	int col;
+
+	wl_list_for_each(shelf, &atlas->shelf_list, link) {
+		if (shelf->height != height)
+			continue;
+
+		col = shelf_find_columns(shelf, mask, n);
+		if (col >= 0) {
+			atlas_place(gs, atlas, shelf, mask, col);
+			return true;
+		}
+	}
+
+	/* Open a new shelf in the first gap that is high enough. */
+	wl_list_for_each(shelf, &atlas->shelf_list, link) {
+		if (shelf->y - y >= height) {
+			next = shelf;
+			break;
+		}
+		y = shelf->y + shelf->height;
+	}
+	if (!next && ATLAS_SIZE - y < height)
+		return false;
+
+	shelf = zalloc(sizeof *shelf);
+	if (!shelf)
+		return false;
+
+	shelf->y = y;
+	shelf->height = height;
+	if (next)
+		wl_list_insert(next->link.prev, &shelf->link);
+	else
+		wl_list_insert(atlas->shelf_list.prev, &shelf->link);
+
+	atlas_place(gs, atlas, shelf, mask, 0);
+	return true;
+}
+
+/** Find room for a surface in one of the atlases
+ *
+ * The surface gets a gutter of one texel around it, a copy of its edges,
+ * so that linear filtering never samples its neighbours. Atlases are
+ * created as needed. Returns false if none has room left.
+ */
+static bool
+atlas_alloc(struct gl_renderer *gr, struct gl_surface_state *gs,
+	    int32_t width, int32_t height)
+{
+	int n = (width + 2 + ATLAS_UNIT - 1) / ATLAS_UNIT;
+	int32_t shelf_height = (height + 2 + ATLAS_UNIT - 1) & ~(ATLAS_UNIT - 1);
+	uint64_t mask = n == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << n) - 1;
+	int i;
+
+	for (i = 0; i < ATLAS_MAX_COUNT; i++) {
+		if (!gr->atlases[i].tex && !atlas_init(&gr->atlases[i]))
+			return false;
+
+		if (atlas_alloc_in(&gr->atlases[i], gs, shelf_height, mask, n))
+			return true;
+	}
+
+	return false;
+}
+
+static void
+atlas_release(struct gl_surface_state *gs)
+{
+	struct gl_atlas_shelf *shelf = gs->atlas_shelf;
+
+	if (!gs->atlas)
+		return;
+
+	shelf->columns &= ~gs->atlas_columns;
+	if (!shelf->columns) {
+		wl_list_remove(&shelf->link);
+		free(shelf);
+	}
+
+	gs->atlas = NULL;
+	gs->atlas_shelf = NULL;
+	gs->atlas_columns = 0;
+	gs->needs_full_upload = true;
+}
+
+/** Upload an shm buffer into its place in an atlas
+ *
+ * The surfaces are small, so the whole buffer is uploaded with its
+ * gutter in a single call, after copying it into a staging area.
+ */
+static void
+atlas_upload(struct gl_renderer *gr, struct gl_surface_state *gs,
+	     struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	int32_t width = gs->pitch + 2;
+	int32_t height = gs->height + 2;
+	const uint32_t *src;
+	uint32_t *staging, *row;
+	int32_t y;
+
+	gr->atlas_staging.size = 0;
+	staging = wl_array_add(&gr->atlas_staging,
+			       width * height * sizeof *staging);
+	if (!staging)
+		return;
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (y = 0; y < height; y++) {
+		src = (const uint32_t *)
+			((const uint8_t *) wl_shm_buffer_get_data(shm_buffer) +
+			 MIN(MAX(y - 1, 0), gs->height - 1) * stride);
+		row = staging + y * width;
+		memcpy(row + 1, src, gs->pitch * sizeof *row);
+		row[0] = src[0];
+		row[width - 1] = src[gs->pitch - 1];
+	}
+	wl_shm_buffer_end_access(shm_buffer);
+
+	glBindTexture(GL_TEXTURE_2D, gs->atlas->tex);
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+	glTexSubImage2D(GL_TEXTURE_2D, 0, gs->atlas_x - 1, gs->atlas_y - 1,
+			width, height, GL_BGRA_EXT, GL_UNSIGNED_BYTE, staging);
 
-	output_get_damage(output, &buffer_damage, &border_damage);
-	output_rotate_damage(output, output_damage, go->border_status);
+	gs->surface->compositor->upload_bytes +=
+		(uint64_t) width * height * sizeof *staging;
+}
 
-	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
-	border_damage |= go->border_status;
+/* Clip a damage box in buffer coordinates to what can be read from the
+ * shm buffer, and return the size it takes in an upload buffer. */
+static GLsizeiptr
+upload_box_clip(pixman_box32_t *box, int32_t width, int32_t height,
+		int bpp)
+{
+	box->x1 = MAX(box->x1, 0);
+	box->y1 = MAX(box->y1, 0);
+	box->x2 = MIN(box->x2, width);
+	box->y2 = MIN(box->y2, height);
 
-	repaint_views(output, &total_damage);
+	if (box->x1 >= box->x2 || box->y1 >= box->y2)
+		return 0;
 
-	pixman_region32_fini(&total_damage);
-	pixman_region32_fini(&buffer_damage);
+	/* Rows are padded to the default GL_UNPACK_ALIGNMENT of 4. */
+	return (GLsizeiptr) (((box->x2 - box->x1) * bpp + 3) & ~3) *
+	       (box->y2 - box->y1);
+}
 
-	draw_output_borders(output, border_damage);
+/** Upload shm damage through the next buffer of the upload ring
+ *
+ * The damaged rectangles are copied into the mapped buffer and GL is
+ * told to source the texture from there. Mapping with
+ * GL_MAP_INVALIDATE_BUFFER_BIT orphans the previous contents, so the copy
+ * never waits for the GPU to be done with an earlier upload, and the
+ * texture update is only queued instead of being done from client memory
+ * while the compositor waits. Once this returns, the client buffer is not
+ * needed any more.
+ *
+ * Returns false if nothing was uploaded, for the caller to fall back to
+ * a direct upload.
+ */
+static bool
+upload_shm_through_buffer(struct gl_renderer *gr,
+			  struct weston_surface *surface,
+			  struct gl_surface_state *gs,
+			  struct weston_buffer *buffer)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	struct gl_upload_buffer *ub;
+	pixman_box32_t *rectangles, r;
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	int bpp = stride / gs->pitch;
+	const uint8_t *data;
+	uint8_t *map, *dst;
+	GLsizeiptr total = 0, size, row_size;
+	GLintptr offset;
+	int i, n, y;
 
-	pixman_region32_copy(&output->previous_damage, output_damage);
-	wl_signal_emit(&output->frame_signal, output);
+	if (gs->needs_full_upload) {
+		n = 1;
+		rectangles = NULL;
+	} else {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+	}
 
-	if (gr->swap_buffers_with_damage) {
-		pixman_region32_init(&buffer_damage);
-		weston_transformed_region(output->width, output->height,
-					  output->transform,
-					  output->current_scale,
-					  output_damage, &buffer_damage);
+	for (i = 0; i < n; i++) {
+		if (rectangles)
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+		else
+			r = (pixman_box32_t) { 0, 0, gs->pitch, gs->height };
+		total += upload_box_clip(&r, gs->pitch, buffer->height, bpp);
+	}
 
-		if (output_has_borders(output)) {
-			pixman_region32_translate(&buffer_damage,
-						  go->borders[GL_RENDERER_BORDER_LEFT].width,
-						  go->borders[GL_RENDERER_BORDER_TOP].height);
-			output_get_border_damage(output, go->border_status,
-						 &buffer_damage);
-		}
+	if (total == 0)
+		return !gs->needs_full_upload;
 
-		rects = pixman_region32_rectangles(&buffer_damage, &nrects);
-		egl_damage = malloc(nrects * 4 * sizeof(EGLint));
+	ub = &gr->upload_buffers[gr->upload_buffer_next];
+	gr->upload_buffer_next =
+		(gr->upload_buffer_next + 1) % gr->upload_buffer_count;
 
-		buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
-				output->current_mode->height +
-				go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, ub->name);
 
-		d = egl_damage;
-		for (i = 0; i < nrects; ++i) {
-			*d++ = rects[i].x1;
-			*d++ = buffer_height - rects[i].y2;
-			*d++ = rects[i].x2 - rects[i].x1;
-			*d++ = rects[i].y2 - rects[i].y1;
-		}
-		ret = gr->swap_buffers_with_damage(gr->egl_display,
-						   go->egl_surface,
-						   egl_damage, nrects);
-		free(egl_damage);
-		pixman_region32_fini(&buffer_damage);
-	} else {
-		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
+	/* Also give back the storage of a rare big upload. */
+	if (ub->size < total || ub->size / 4 > total) {
+		glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, total, NULL,
+			     GL_STREAM_DRAW);
+		ub->size = total;
 	}
 
-	if (ret == EGL_FALSE && !errored) {
-		errored = 1;
-		weston_log("Failed in eglSwapBuffers.\n");
-		gl_renderer_print_egl_error_state();
+	map = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV, 0, total,
+				   GL_MAP_WRITE_BIT_EXT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT_EXT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return false;
 	}
 
-	go->border_status = BORDER_STATUS_CLEAN;
-}
+	data = wl_shm_buffer_get_data(shm_buffer);
+	dst = map;
 
-static int
-gl_renderer_read_pixels(struct weston_output *output,
-			       pixman_format_code_t format, void *pixels,
-			       uint32_t x, uint32_t y,
-			       uint32_t width, uint32_t height)
-{
-	GLenum gl_format;
-	struct gl_output_state *go = get_output_state(output);
+	wl_shm_buffer_begin_access(shm_buffer);
+	for (i = 0; i < n; i++) {
+		if (rectangles)
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+		else
+			r = (pixman_box32_t) { 0, 0, gs->pitch, gs->height };
+		if (!upload_box_clip(&r, gs->pitch, buffer->height, bpp))
+			continue;
 
-	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
-	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+		row_size = ((r.x2 - r.x1) * bpp + 3) & ~3;
+		for (y = r.y1; y < r.y2; y++) {
+			memcpy(dst, data + y * stride + r.x1 * bpp,
+			       (r.x2 - r.x1) * bpp);
+			dst += row_size;
+		}
+	}
+	wl_shm_buffer_end_access(shm_buffer);
 
-	switch (format) {
-	case PIXMAN_a8r8g8b8:
-		gl_format = GL_BGRA_EXT;
-		break;
-	case PIXMAN_a8b8g8r8:
-		gl_format = GL_RGBA;
-		break;
-	default:
-		return -1;
+	/* The contents can get lost while mapped, e.g. on a mode switch. */
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV)) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+		return false;
 	}
 
-	if (use_output(output) < 0)
-		return -1;
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
 
-	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glReadPixels(x, y, width, height, gl_format,
-		     GL_UNSIGNED_BYTE, pixels);
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		if (rectangles)
+			r = weston_surface_to_buffer_rect(surface,
+							  rectangles[i]);
+		else
+			r = (pixman_box32_t) { 0, 0, gs->pitch, gs->height };
+		size = upload_box_clip(&r, gs->pitch, buffer->height, bpp);
+		if (!size)
+			continue;
 
-	return 0;
+		if (rectangles)
+			glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
+					r.x2 - r.x1, r.y2 - r.y1,
+					gs->gl_format, gs->gl_pixel_type,
+					(void *) offset);
+		else
+			glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
+				     gs->pitch, gs->height, 0,
+				     gs->gl_format, gs->gl_pixel_type,
+				     (void *) offset);
+		offset += size;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+
+	surface->compositor->upload_bytes += total;
+
+	return true;
 }
 
 static void
@@ -1230,6 +2250,7 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	bool texture_used;
 	pixman_box32_t *rectangles;
 	void *data;
+	int32_t stride;
 	int i, n;
 
 	pixman_region32_union(&gs->texture_damage,
@@ -1257,9 +2278,22 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	    !gs->needs_full_upload)
 		goto done;
 
+	if (gs->atlas) {
+		atlas_upload(gr, gs, buffer);
+		goto done;
+	}
+
 	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
 
+	if (gr->upload_buffer_count > 0 &&
+	    upload_shm_through_buffer(gr, surface, gs, buffer))
+		goto done;
+
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+
 	if (!gr->has_unpack_subimage) {
+		surface->compositor->upload_bytes +=
+			(uint64_t) stride * buffer->height;
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
 		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
 			     gs->pitch, buffer->height, 0,
@@ -1274,6 +2308,8 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
 	if (gs->needs_full_upload) {
+		surface->compositor->upload_bytes +=
+			(uint64_t) stride * buffer->height;
 		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
 		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
 		wl_shm_buffer_begin_access(buffer->shm_buffer);
@@ -1296,6 +2332,8 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
 				r.x2 - r.x1, r.y2 - r.y1,
 				gs->gl_format, gs->gl_pixel_type, data);
+		surface->compositor->upload_bytes += (uint64_t)
+			(r.x2 - r.x1) * (r.y2 - r.y1) * (stride / gs->pitch);
 	}
 	wl_shm_buffer_end_access(buffer->shm_buffer);
 
@@ -1366,6 +2404,21 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		return;
 	}
 
+	/* Small BGRA surfaces go into an atlas if there is room. A new
+	 * size needs a new place. */
+	if (gl_format == GL_BGRA_EXT &&
+	    pitch <= gr->atlas_max_size &&
+	    buffer->height <= gr->atlas_max_size) {
+		if (!gs->atlas || pitch != gs->pitch ||
+		    buffer->height != gs->height) {
+			atlas_release(gs);
+			atlas_alloc(gr, gs, pitch, buffer->height);
+			gs->needs_full_upload = true;
+		}
+	} else {
+		atlas_release(gs);
+	}
+
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
 	 * happening, we need to allocate a new texture buffer. */
@@ -1893,6 +2946,7 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	weston_buffer_reference(&gs->buffer_ref, buffer);
 
 	if (!buffer) {
+		atlas_release(gs);
 		for (i = 0; i < gs->num_images; i++) {
 			egl_image_unref(gs->images[i]);
 			gs->images[i] = NULL;
@@ -1906,6 +2960,8 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	}
 
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (!shm_buffer)
+		atlas_release(gs);
 
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
@@ -1933,6 +2989,7 @@ gl_renderer_surface_set_color(struct weston_surface *surface,
 	gs->color[1] = green;
 	gs->color[2] = blue;
 	gs->color[3] = alpha;
+	atlas_release(gs);
 	gs->buffer_type = BUFFER_TYPE_SOLID;
 	gs->pitch = 1;
 	gs->height = 1;
@@ -2001,6 +3058,8 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
 	struct gl_renderer *gr = get_renderer(surface->compositor);
 	struct gl_surface_state *gs = get_surface_state(surface);
+	const GLfloat *texcoords = verts;
+	GLfloat atlas_texcoords[4 * 2];
 	int cw, ch;
 	GLuint fbo;
 	GLuint tex;
@@ -2053,13 +3112,33 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glUniformMatrix4fv(gs->shader->proj_uniform, 1, GL_FALSE, proj);
 	glUniform1f(gs->shader->alpha_uniform, 1.0f);
 
-	for (i = 0; i < gs->num_textures; i++) {
-		glUniform1i(gs->shader->tex_uniforms[i], i);
-
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if (gs->atlas) {
+		glUniform1i(gs->shader->tex_uniforms[0], 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, gs->atlas->tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+				GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+				GL_NEAREST);
+
+		for (i = 0; i < 4; i++) {
+			atlas_texcoords[i * 2] = (gs->atlas_x +
+				verts[i * 2] * cw) / ATLAS_SIZE;
+			atlas_texcoords[i * 2 + 1] = (gs->atlas_y +
+				verts[i * 2 + 1] * ch) / ATLAS_SIZE;
+		}
+		texcoords = atlas_texcoords;
+	} else {
+		for (i = 0; i < gs->num_textures; i++) {
+			glUniform1i(gs->shader->tex_uniforms[i], i);
+
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(gs->target, gs->textures[i]);
+			glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER,
+					GL_NEAREST);
+			glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER,
+					GL_NEAREST);
+		}
 	}
 
 	/* position: */
@@ -2067,7 +3146,7 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glEnableVertexAttribArray(0);
 
 	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoords);
 	glEnableVertexAttribArray(1);
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -2095,6 +3174,7 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
+	atlas_release(gs);
 	glDeleteTextures(gs->num_textures, gs->textures);
 
 	for (i = 0; i < gs->num_images; i++)
@@ -2301,18 +3381,140 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
+/* Cached programs start with this header, the program binary follows. */
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t length;
+};
+
+#define PROGRAM_CACHE_MAGIC 0x57505247	/* "WPRG" */
+#define PROGRAM_CACHE_MAX_LENGTH (4 << 20)
+
+/* FNV-1a, including the terminating zero so that the same text split
+ * differently over the strings hashes differently. */
+static uint64_t
+hash_string(uint64_t hash, const char *s)
+{
+	do {
+		hash ^= (uint8_t) *s;
+		hash *= 0x100000001b3ull;
+	} while (*s++);
+
+	return hash;
+}
+
+/* The name of a cached program covers the driver and all shader
+ * sources, so that a changed driver or shader just misses the cache
+ * instead of loading a stale program. */
+static void
+program_cache_path(struct gl_renderer *gr, const char *vertex_source,
+		   const char **fragment_sources, int count,
+		   char *path, size_t size)
+{
+	uint64_t hash = gr->program_cache_seed;
+	int i;
+
+	hash = hash_string(hash, vertex_source);
+	for (i = 0; i < count; i++)
+		hash = hash_string(hash, fragment_sources[i]);
+
+	snprintf(path, size, "%s/program-%016" PRIx64 ".bin",
+		 gr->program_cache_dir, hash);
+}
+
+/* Returns a linked program, or 0 if the cache has none for this path
+ * or the driver rejects the one it has. */
+static GLuint
+program_cache_load(struct gl_renderer *gr, const char *path)
+{
+	struct program_cache_header header;
+	GLuint program = 0;
+	GLint status;
+	void *binary = NULL;
+	FILE *fp;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return 0;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != PROGRAM_CACHE_MAGIC ||
+	    header.length == 0 ||
+	    header.length > PROGRAM_CACHE_MAX_LENGTH)
+		goto out;
+
+	binary = malloc(header.length);
+	if (!binary || fread(binary, header.length, 1, fp) != 1)
+		goto out;
+
+	program = glCreateProgram();
+	gr->program_binary(program, header.format, binary, header.length);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		program = 0;
+	}
+
+out:
+	free(binary);
+	fclose(fp);
+	return program;
+}
+
+/* Written to a temporary file first, so that a concurrent or
+ * interrupted writer never leaves a partial program behind. */
+static void
+program_cache_store(struct gl_renderer *gr, GLuint program, const char *path)
+{
+	struct program_cache_header header;
+	GLint length = 0;
+	GLenum format;
+	void *binary;
+	char tmp[PATH_MAX];
+	int fd, ok;
+
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0 || length > PROGRAM_CACHE_MAX_LENGTH)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	gr->get_program_binary(program, length, &length, &format, binary);
+
+	header.magic = PROGRAM_CACHE_MAGIC;
+	header.format = format;
+	header.length = length;
+
+	snprintf(tmp, sizeof tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		free(binary);
+		return;
+	}
+
+	ok = length > 0 &&
+	     write(fd, &header, sizeof header) == sizeof header &&
+	     write(fd, binary, length) == length;
+	close(fd);
+	free(binary);
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
 static int
 shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		   const char *vertex_source, const char *fragment_source)
 {
 	char msg[512];
+	char path[PATH_MAX];
 	GLint status;
 	int count;
 	const char *sources[3];
 
-	shader->vertex_shader =
-		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
-
 	if (renderer->fragment_shader_debug) {
 		sources[0] = fragment_source;
 		sources[1] = fragment_debug;
@@ -2324,21 +3526,35 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		count = 2;
 	}
 
-	shader->fragment_shader =
-		compile_shader(GL_FRAGMENT_SHADER, count, sources);
+	if (renderer->program_cache_dir) {
+		program_cache_path(renderer, vertex_source, sources, count,
+				   path, sizeof path);
+		shader->program = program_cache_load(renderer, path);
+	}
 
-	shader->program = glCreateProgram();
-	glAttachShader(shader->program, shader->vertex_shader);
-	glAttachShader(shader->program, shader->fragment_shader);
-	glBindAttribLocation(shader->program, 0, "position");
-	glBindAttribLocation(shader->program, 1, "texcoord");
+	if (!shader->program) {
+		shader->vertex_shader =
+			compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+		shader->fragment_shader =
+			compile_shader(GL_FRAGMENT_SHADER, count, sources);
+
+		shader->program = glCreateProgram();
+		glAttachShader(shader->program, shader->vertex_shader);
+		glAttachShader(shader->program, shader->fragment_shader);
+		glBindAttribLocation(shader->program, 0, "position");
+		glBindAttribLocation(shader->program, 1, "texcoord");
+
+		glLinkProgram(shader->program);
+		glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
+		if (!status) {
+			glGetProgramInfoLog(shader->program, sizeof msg,
+					    NULL, msg);
+			weston_log("link info: %s\n", msg);
+			return -1;
+		}
 
-	glLinkProgram(shader->program);
-	glGetProgramiv(shader->program, GL_LINK_STATUS, &status);
-	if (!status) {
-		glGetProgramInfoLog(shader->program, sizeof msg, NULL, msg);
-		weston_log("link info: %s\n", msg);
-		return -1;
+		if (renderer->program_cache_dir)
+			program_cache_store(renderer, shader->program, path);
 	}
 
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
@@ -2594,6 +3810,17 @@ gl_renderer_output_create(struct weston_output *output,
 		return -1;
 	}
 
+	go->readback_timer =
+		wl_event_loop_add_timer(wl_display_get_event_loop(ec->wl_display),
+					readback_timer_handler, output);
+	if (!go->readback_timer) {
+		eglDestroySurface(gr->egl_display, go->egl_surface);
+		free(go);
+		return -1;
+	}
+	wl_list_init(&go->readback_list);
+	wl_list_init(&go->readback_buffers);
+
 	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
 		pixman_region32_init(&go->buffer_damage[i]);
 
@@ -2609,8 +3836,29 @@ gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback_buffer *buffer, *next;
+	struct weston_pixels_readback *readback;
 	int i;
 
+	finish_readbacks(output);
+	wl_event_source_remove(go->readback_timer);
+
+	/* Without a context to map the buffers in, fail what is left. */
+	while (!wl_list_empty(&go->readback_list)) {
+		readback = container_of(go->readback_list.next,
+					struct weston_pixels_readback, link);
+		wl_list_remove(&readback->link);
+		wl_list_init(&readback->link);
+		readback->done(readback, NULL);
+	}
+
+	wl_list_for_each_safe(buffer, next, &go->readback_buffers, link) {
+		if (buffer->name)
+			glDeleteBuffers(1, &buffer->name);
+		free(buffer->data);
+		free(buffer);
+	}
+
 	for (i = 0; i < 2; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
@@ -2630,6 +3878,7 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	struct dmabuf_image *image, *next;
+	struct gl_view_state *vs, *vs_next;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
@@ -2645,6 +3894,9 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	wl_list_for_each_safe(image, next, &gr->dmabuf_images, link)
 		dmabuf_image_destroy(image);
 
+	wl_list_for_each_safe(vs, vs_next, &gr->view_state_list, link)
+		view_state_destroy(vs);
+
 	if (gr->dummy_surface != EGL_NO_SURFACE)
 		eglDestroySurface(gr->egl_display, gr->dummy_surface);
 
@@ -2655,11 +3907,18 @@ gl_renderer_destroy(struct weston_compositor *ec)
 
 	wl_array_release(&gr->vertices);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
+
+	free(gr->upload_buffers);
+	wl_array_release(&gr->atlas_staging);
+	free(gr->program_cache_dir);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->draw_count_binding)
+		weston_binding_destroy(gr->draw_count_binding);
 
 	free(gr);
 }
@@ -2910,6 +4169,7 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 		return -1;
 
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.read_pixels_async = gl_renderer_read_pixels_async;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
@@ -2970,6 +4230,7 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 		goto fail_with_error;
 
 	wl_list_init(&gr->dmabuf_images);
+	wl_list_init(&gr->view_state_list);
 	if (gr->has_dmabuf_import)
 		gr->base.import_dmabuf = gl_renderer_import_dmabuf;
 
@@ -3080,6 +4341,142 @@ fan_debug_repaint_binding(struct weston_keyboard *keyboard, uint32_t time,
 	weston_compositor_damage_all(compositor);
 }
 
+static void
+draw_count_debug_binding(struct weston_keyboard *keyboard, uint32_t time,
+			 uint32_t key, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct gl_renderer *gr = get_renderer(compositor);
+
+	gr->draw_count_debug = !gr->draw_count_debug;
+	weston_compositor_damage_all(compositor);
+}
+
+static int
+make_cache_dir(const char *path)
+{
+	if (mkdir(path, 0700) < 0 && errno != EEXIST) {
+		weston_log("failed to create %s: %m\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The cache lives in $XDG_CACHE_HOME/weston, ~/.cache/weston if that is
+ * not set. */
+static void
+setup_program_cache(struct gl_renderer *gr, const char *extensions)
+{
+	static const GLenum driver_strings[] = {
+		GL_VENDOR, GL_RENDERER, GL_VERSION
+	};
+	const char *base, *home, *str;
+	char *parent = NULL;
+	GLint formats = 0;
+	unsigned i;
+
+	if (weston_check_egl_extension(extensions,
+				       "GL_OES_get_program_binary"))
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+
+	if (formats > 0) {
+		gr->get_program_binary =
+			(void *) eglGetProcAddress("glGetProgramBinaryOES");
+		gr->program_binary =
+			(void *) eglGetProcAddress("glProgramBinaryOES");
+	}
+
+	if (!gr->get_program_binary || !gr->program_binary) {
+		weston_log("shader program cache is not supported by "
+			   "this GL implementation.\n");
+		return;
+	}
+
+	base = getenv("XDG_CACHE_HOME");
+	if (!base || base[0] != '/') {
+		home = getenv("HOME");
+		if (!home || asprintf(&parent, "%s/.cache", home) < 0) {
+			weston_log("no directory for the shader program "
+				   "cache.\n");
+			return;
+		}
+		base = parent;
+	}
+
+	if (make_cache_dir(base) < 0 ||
+	    asprintf(&gr->program_cache_dir, "%s/weston", base) < 0) {
+		gr->program_cache_dir = NULL;
+		free(parent);
+		return;
+	}
+	free(parent);
+
+	if (make_cache_dir(gr->program_cache_dir) < 0) {
+		free(gr->program_cache_dir);
+		gr->program_cache_dir = NULL;
+		return;
+	}
+
+	gr->program_cache_seed = 0xcbf29ce484222325ull;
+	for (i = 0; i < ARRAY_LENGTH(driver_strings); i++) {
+		str = (const char *) glGetString(driver_strings[i]);
+		gr->program_cache_seed =
+			hash_string(gr->program_cache_seed, str ? str : "");
+	}
+
+	weston_log("Caching shader programs in %s\n", gr->program_cache_dir);
+}
+
+/* Pixel buffers need GLES 3, or GL_NV_pixel_buffer_object and
+ * GL_EXT_map_buffer_range on GLES 2. */
+static void
+setup_pixel_buffers(struct gl_renderer *gr, const char *extensions)
+{
+	const char *version = (const char *) glGetString(GL_VERSION);
+	int major = 0;
+
+	if (version && sscanf(version, "OpenGL ES %d.", &major) == 1 &&
+	    major >= 3) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRange");
+		gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBuffer");
+		gr->pack_buffer_usage = GL_STREAM_READ;
+	} else if (weston_check_egl_extension(extensions,
+					      "GL_NV_pixel_buffer_object") &&
+		   weston_check_egl_extension(extensions,
+					      "GL_EXT_map_buffer_range")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+		/* GLES 2 knows no read usage. */
+		gr->pack_buffer_usage = GL_STREAM_DRAW;
+	}
+
+	gr->has_pixel_buffers = gr->map_buffer_range && gr->unmap_buffer;
+}
+
+static void
+setup_upload_buffers(struct gl_renderer *gr, int count)
+{
+	int i;
+
+	if (!gr->has_pixel_buffers) {
+		weston_log("wl_shm upload buffers are not supported by "
+			   "this GL implementation.\n");
+		return;
+	}
+
+	gr->upload_buffers = zalloc(count * sizeof gr->upload_buffers[0]);
+	if (!gr->upload_buffers)
+		return;
+
+	for (i = 0; i < count; i++)
+		glGenBuffers(1, &gr->upload_buffers[i].name);
+	gr->upload_buffer_count = count;
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
@@ -3087,6 +4484,7 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	const char *extensions;
 	EGLConfig context_config;
 	EGLBoolean ret;
+	int i;
 
 	static const EGLint context_attribs[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
@@ -3147,6 +4545,19 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (weston_check_egl_extension(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	setup_pixel_buffers(gr, extensions);
+
+	if (ec->gl_upload_buffers > 0)
+		setup_upload_buffers(gr, ec->gl_upload_buffers);
+
+	if (ec->gl_program_cache)
+		setup_program_cache(gr, extensions);
+
+	for (i = 0; i < ATLAS_MAX_COUNT; i++)
+		wl_list_init(&gr->atlases[i].shelf_list);
+	wl_array_init(&gr->atlas_staging);
+	gr->atlas_max_size = ec->gl_atlas_max_size;
+
 	glActiveTexture(GL_TEXTURE0);
 
 	if (compile_shaders(ec))
@@ -3160,6 +4571,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->draw_count_binding =
+		weston_compositor_add_debug_binding(ec, KEY_D,
+						    draw_count_debug_binding,
+						    ec);
 
 	gr->output_destroy_listener.notify = output_handle_destroy;
 	wl_signal_add(&ec->output_destroyed_signal,
@@ -3170,6 +4585,10 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm upload buffers: %d\n",
+			    gr->upload_buffer_count);
+	weston_log_continue(STAMP_SPACE "atlas for surfaces up to: %d px\n",
+			    gr->atlas_max_size);
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
 
@@ -0,0 +1,96 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_HEADLESS_FRAMEBUFFER_H
+#define WESTON_HEADLESS_FRAMEBUFFER_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+/* Layout of the shared-memory framebuffers of the headless backend.
+ * This header is meant for the processes reading them as well, so it
+ * does not depend on anything else of libweston. */
+
+#include <stdint.h>
+
+#define WESTON_HEADLESS_FB_MAGIC 0x42464857	/* "WHFB" */
+#define WESTON_HEADLESS_FB_VERSION 1
+#define WESTON_HEADLESS_FB_MAX_BUFFERS 8
+
+/** A buffer of the shared-memory framebuffer of a headless output. */
+struct weston_headless_fb_frame {
+	/** Number of the frame in the buffer, 0 while it is being drawn. */
+	uint64_t seq;
+	/** Presentation clock time at which the frame was drawn. */
+	uint64_t time_nsec;
+	/** Extents of what changed since frame seq - 1, in pixels of
+	 * the buffer. */
+	int32_t damage_x;
+	int32_t damage_y;
+	int32_t damage_width;
+	int32_t damage_height;
+};
+
+/** Header of the shared-memory framebuffer of a headless output.
+ *
+ * With weston_headless_backend_config::shm_buffers set, a headless output
+ * draws into a file in memory that other processes can map, named
+ * "weston-headless-<output name>" under /proc/<pid>/fd. The file starts
+ * with this header, followed by buffer_count buffers at buffer_offset,
+ * buffer_size bytes apart. Frame n is drawn into buffer n % buffer_count,
+ * so the others keep the previous frames while it is being drawn.
+ *
+ * To read the latest frame, read seq, then frames[seq % buffer_count].seq;
+ * they must match. After copying the pixels, read frames[i].seq again: if
+ * it changed, the buffer was reused while copying and the copy must be
+ * thrown away. Readers that saw frame seq - 1 only need to copy the
+ * damage of frame seq.
+ *
+ * The compositor clears frames[i].seq before drawing into buffer i and
+ * sets it, then seq, once the frame is complete. Read seq fields with
+ * acquire semantics, and put an acquire fence between copying the pixels
+ * and reading frames[i].seq again.
+ */
+struct weston_headless_fb_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t format;		/* enum wl_shm_format */
+	uint32_t buffer_count;
+	uint32_t buffer_size;
+	uint64_t buffer_offset;
+	/** The latest complete frame, 0 before the first one. */
+	uint64_t seq;
+	struct weston_headless_fb_frame frames[WESTON_HEADLESS_FB_MAX_BUFFERS];
+};
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif /* WESTON_HEADLESS_FRAMEBUFFER_H */
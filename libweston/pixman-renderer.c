@@ -30,9 +30,13 @@
 #include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "pixman-renderer.h"
+#include "yuv-convert.h"
 #include "shared/helpers.h"
 
 #include <linux/input.h>
@@ -41,19 +45,77 @@ struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* Asynchronous readbacks are copied out of hw_buffer once the
+	 * frame signal handlers have returned, before anything else
+	 * may draw into it. */
+	struct wl_list readback_list; /* weston_pixels_readback::link */
+	struct wl_event_source *readback_idle;
+	void *readback_data;
+	size_t readback_size;
+};
+
+/* The image of a wl_shm_buffer, kept for as long as the buffer lives, so
+ * that clients cycling through a few buffers do not cost a new image on
+ * every attach. */
+struct pixman_buffer_state {
+	pixman_image_t *image;
+	pixman_format_code_t format;
+	int32_t width, height, stride;
+	void *data;
+
+	struct wl_listener destroy_listener;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color;	/* of a solid color image */
+	uint32_t content_serial;	/* bumped when the image changes */
 	struct weston_buffer_reference buffer_ref;
 
+	/* Pixman has no YUV formats that it can composite quickly, YUV
+	 * buffers are converted into this image in flush_damage. */
+	pixman_image_t *yuv_image;
+	enum yuv_convert_format yuv_format;
+	bool yuv_full_convert;
+
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* Rows per tile of a threaded repaint. Tiles span the whole width of
+ * the output, so that pixman walks the same scanlines as it does in a
+ * single-threaded repaint. */
+#define TILE_HEIGHT 64
+
+struct pixman_repaint_job {
+	struct weston_output *output;
+	pixman_region32_t *damage;	/* in global coordinates */
+	void *shadow_buffer;
+	int32_t width, height, stride;
+	int32_t y1, y2;			/* damaged rows of the output */
+	int n_tiles;
+	int next_tile;			/* protected by job_mutex */
+};
+
+/** Where a view gets drawn
+ *
+ * A single-threaded repaint draws straight into the shadow image of the
+ * output. Each thread of a threaded repaint draws one tile at a time
+ * through images of its own: pixman images are validated lazily and
+ * carry the transform, filter and clip of the last composite, so they
+ * cannot be shared between threads.
+ */
+struct pixman_tile {
+	pixman_image_t *dest;
+	pixman_image_t *debug_color;
+	const pixman_box32_t *box;	/* in output coordinates, or NULL */
+	bool private_sources;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
@@ -62,6 +124,62 @@ struct pixman_renderer {
 	struct weston_binding *debug_binding;
 
 	struct wl_signal destroy_signal;
+
+	/* Threads that draw tiles together with the compositor thread. */
+	int n_workers;
+	pthread_t *workers;
+	pthread_mutex_t job_mutex;
+	pthread_cond_t job_cond;
+	pthread_cond_t done_cond;
+	struct pixman_repaint_job *job;
+	uint32_t job_serial;
+	int workers_busy;
+	bool quit;
+
+	/* Transformed view images, most recently used first. */
+	struct wl_list view_state_list;	/* pixman_view_state::link */
+	struct wl_list cache_lru;	/* pixman_view_cache::lru_link */
+	size_t cache_size;
+	size_t cache_budget;
+	uint32_t repaint_serial;
+};
+
+/** A view resampled into output coordinates
+ *
+ * Views drawn with other transforms than an integer translation are
+ * resampled on every repaint that touches them. With a cache budget,
+ * their transformed image is kept and drawn with a plain translation
+ * while neither the content nor the transform change. An image is only
+ * made once the same key was seen in two repaints, so that animated
+ * views do not pay for it.
+ */
+struct pixman_view_cache {
+	struct weston_output *output;
+	struct wl_list view_link;	/* pixman_view_state::cache_list */
+	struct wl_list lru_link;	/* pixman_renderer::cache_lru */
+
+	/* What the image is made from. */
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+	bool source_clipped;
+	pixman_region32_t source_clip;
+	uint32_t content_serial;
+	pixman_box32_t box;		/* in output coordinates */
+
+	pixman_image_t *image;
+	size_t size;
+	uint32_t repaint_serial;	/* last repaint it is valid for */
+};
+
+struct pixman_view_state {
+	struct pixman_renderer *renderer;
+	struct wl_list link;		/* pixman_renderer::view_state_list */
+	struct wl_list cache_list;
+	struct wl_listener destroy_listener;
+};
+
+static const pixman_color_t debug_red = {
+	0x3fff, 0x0000, 0x0000, 0x3fff
 };
 
 static inline struct pixman_output_state *
@@ -134,6 +252,82 @@ pixman_renderer_read_pixels(struct weston_output *output,
 	return 0;
 }
 
+static void
+finish_readbacks(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_pixels_readback *readback;
+	size_t size;
+	void *data;
+
+	if (po->readback_idle) {
+		wl_event_source_remove(po->readback_idle);
+		po->readback_idle = NULL;
+	}
+
+	while (!wl_list_empty(&po->readback_list)) {
+		readback = container_of(po->readback_list.next,
+					struct weston_pixels_readback, link);
+		wl_list_remove(&readback->link);
+		wl_list_init(&readback->link);
+
+		size = (size_t) readback->width * readback->height *
+		       (PIXMAN_FORMAT_BPP(readback->format) / 8);
+		if (size > po->readback_size) {
+			data = realloc(po->readback_data, size);
+			if (!data) {
+				readback->done(readback, NULL);
+				continue;
+			}
+			po->readback_data = data;
+			po->readback_size = size;
+		}
+
+		if (pixman_renderer_read_pixels(output, readback->format,
+						po->readback_data,
+						readback->x, readback->y,
+						readback->width,
+						readback->height) < 0)
+			readback->done(readback, NULL);
+		else
+			readback->done(readback, po->readback_data);
+	}
+}
+
+static void
+readback_idle_handler(void *data)
+{
+	struct weston_output *output = data;
+	struct pixman_output_state *po = get_output_state(output);
+
+	po->readback_idle = NULL;
+	finish_readbacks(output);
+}
+
+static int
+pixman_renderer_read_pixels_async(struct weston_output *output,
+				  struct weston_pixels_readback *readback)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct wl_event_loop *loop;
+
+	if (!po->hw_buffer)
+		return -1;
+
+	if (!po->readback_idle) {
+		loop = wl_display_get_event_loop(output->compositor->wl_display);
+		po->readback_idle =
+			wl_event_loop_add_idle(loop, readback_idle_handler,
+					       output);
+		if (!po->readback_idle)
+			return -1;
+	}
+
+	wl_list_insert(po->readback_list.prev, &readback->link);
+
+	return 0;
+}
+
 static void
 region_global_to_output(struct weston_output *output, pixman_region32_t *region)
 {
@@ -316,42 +510,419 @@ composite_clipped(pixman_image_t *src,
 	}
 }
 
+/* The region of the buffer a view with a non-translation transform may
+ * sample from, in buffer coordinates. */
+static void
+view_source_clip(struct weston_view *view, pixman_region32_t *buffer_region)
+{
+	struct weston_surface *surface = view->surface;
+	pixman_region32_t surf_region;
+
+	pixman_region32_init_rect(&surf_region, 0, 0,
+				  surface->width, surface->height);
+	if (view->geometry.scissor_enabled)
+		pixman_region32_intersect(&surf_region, &surf_region,
+					  &view->geometry.scissor);
+
+	weston_surface_to_buffer_region(surface, &surf_region, buffer_region);
+	pixman_region32_fini(&surf_region);
+}
+
+static pixman_filter_t
+view_filter(struct weston_view *view, struct weston_output *output)
+{
+	struct weston_buffer_viewport *vp = &view->surface->buffer_viewport;
+
+	if (view->transform.enabled || output->current_scale != vp->buffer.scale)
+		return PIXMAN_FILTER_BILINEAR;
+	else
+		return PIXMAN_FILTER_NEAREST;
+}
+
+static bool
+transform_is_integer_translation(const pixman_transform_t *t)
+{
+	return t->matrix[0][0] == pixman_fixed_1 && t->matrix[0][1] == 0 &&
+	       t->matrix[1][0] == 0 && t->matrix[1][1] == pixman_fixed_1 &&
+	       t->matrix[2][0] == 0 && t->matrix[2][1] == 0 &&
+	       t->matrix[2][2] == pixman_fixed_1 &&
+	       pixman_fixed_frac(t->matrix[0][2]) == 0 &&
+	       pixman_fixed_frac(t->matrix[1][2]) == 0;
+}
+
+static void
+view_cache_drop_image(struct pixman_renderer *pr,
+		      struct pixman_view_cache *cache)
+{
+	if (!cache->image)
+		return;
+
+	pixman_image_unref(cache->image);
+	cache->image = NULL;
+	pr->cache_size -= cache->size;
+	cache->size = 0;
+}
+
+static void
+view_cache_destroy(struct pixman_renderer *pr, struct pixman_view_cache *cache)
+{
+	view_cache_drop_image(pr, cache);
+	pixman_region32_fini(&cache->source_clip);
+	wl_list_remove(&cache->view_link);
+	wl_list_remove(&cache->lru_link);
+	free(cache);
+}
+
+static void
+view_state_destroy(struct pixman_view_state *vs)
+{
+	struct pixman_view_cache *cache, *next;
+
+	wl_list_for_each_safe(cache, next, &vs->cache_list, view_link)
+		view_cache_destroy(vs->renderer, cache);
+
+	wl_list_remove(&vs->destroy_listener.link);
+	wl_list_remove(&vs->link);
+	free(vs);
+}
+
+static void
+view_state_handle_view_destroy(struct wl_listener *listener, void *data)
+{
+	struct pixman_view_state *vs =
+		container_of(listener, struct pixman_view_state,
+			     destroy_listener);
+
+	view_state_destroy(vs);
+}
+
+static struct pixman_view_state *
+get_view_state(struct weston_view *view, bool create)
+{
+	struct pixman_view_state *vs;
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&view->destroy_signal,
+				 view_state_handle_view_destroy);
+	if (listener)
+		return container_of(listener, struct pixman_view_state,
+				    destroy_listener);
+
+	if (!create)
+		return NULL;
+
+	vs = zalloc(sizeof *vs);
+	if (!vs)
+		return NULL;
+
+	vs->renderer = get_renderer(view->surface->compositor);
+	wl_list_insert(&vs->renderer->view_state_list, &vs->link);
+	wl_list_init(&vs->cache_list);
+	vs->destroy_listener.notify = view_state_handle_view_destroy;
+	wl_signal_add(&view->destroy_signal, &vs->destroy_listener);
+
+	return vs;
+}
+
+static struct pixman_view_cache *
+find_view_cache(struct pixman_view_state *vs, struct weston_output *output)
+{
+	struct pixman_view_cache *cache;
+
+	wl_list_for_each(cache, &vs->cache_list, view_link)
+		if (cache->output == output)
+			return cache;
+
+	return NULL;
+}
+
+/* The cached image of a view for this repaint, if there is one. */
+static struct pixman_view_cache *
+lookup_view_cache(struct weston_view *view, struct weston_output *output)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_view_state *vs;
+	struct pixman_view_cache *cache;
+
+	if (pr->cache_budget == 0)
+		return NULL;
+
+	vs = get_view_state(view, false);
+	if (!vs)
+		return NULL;
+
+	cache = find_view_cache(vs, output);
+	if (!cache || !cache->image ||
+	    cache->repaint_serial != pr->repaint_serial)
+		return NULL;
+
+	return cache;
+}
+
+static bool
+view_cache_make_room(struct pixman_renderer *pr, size_t size)
+{
+	struct pixman_view_cache *cache, *prev;
+
+	wl_list_for_each_reverse_safe(cache, prev, &pr->cache_lru, lru_link) {
+		if (pr->cache_size + size <= pr->cache_budget)
+			break;
+
+		/* Still needed by this repaint. */
+		if (cache->repaint_serial == pr->repaint_serial)
+			break;
+
+		view_cache_drop_image(pr, cache);
+	}
+
+	return pr->cache_size + size <= pr->cache_budget;
+}
+
+static void
+view_cache_render(struct weston_view *view, struct pixman_view_cache *cache)
+{
+	struct pixman_surface_state *ps = get_surface_state(view->surface);
+	pixman_transform_t transform = cache->transform;
+	int32_t width = cache->box.x2 - cache->box.x1;
+	int32_t height = cache->box.y2 - cache->box.y1;
+	int64_t offset;
+	int i;
+
+	/* Sample at the same points as when drawing to the output: move
+	 * the origin to the corner of the box, which is exact for integer
+	 * offsets in fixed point. */
+	for (i = 0; i < 3; i++) {
+		offset = transform.matrix[i][2] +
+			 (int64_t) transform.matrix[i][0] * cache->box.x1 +
+			 (int64_t) transform.matrix[i][1] * cache->box.y1;
+		if (offset < INT32_MIN || offset > INT32_MAX)
+			return;
+		transform.matrix[i][2] = offset;
+	}
+
+	/* Cleared to transparent by pixman. */
+	cache->image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						width, height, NULL, 0);
+	if (!cache->image)
+		return;
+
+	if (ps->buffer_ref.buffer)
+		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+
+	if (cache->source_clipped)
+		composite_clipped(ps->image, NULL, cache->image, &transform,
+				  cache->filter, &cache->source_clip);
+	else
+		composite_whole(PIXMAN_OP_SRC, ps->image, NULL, cache->image,
+				&transform, cache->filter);
+
+	if (ps->buffer_ref.buffer)
+		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+
+	cache->size = (size_t) width * height * 4;
+}
+
+/** Validate or make the cached image of a view before a repaint
+ *
+ * Runs on the compositor thread before any tile is drawn, so that the
+ * workers of a threaded repaint only ever look the cache up.
+ */
+static void
+update_view_cache(struct pixman_renderer *pr, struct weston_view *view,
+		  struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_surface_state *ps = get_surface_state(view->surface);
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_view_state *vs;
+	struct pixman_view_cache *cache;
+	pixman_transform_t transform;
+	pixman_region32_t region;
+	pixman_box32_t box;
+	bool source_clipped;
+	size_t size;
+
+	if (!ps->image)
+		return;
+
+	pixman_region32_init(&region);
+	pixman_region32_intersect(&region, &view->transform.boundingbox,
+				  damage);
+	if (!pixman_region32_not_empty(&region)) {
+		pixman_region32_fini(&region);
+		return;
+	}
+
+	pixman_renderer_compute_transform(&transform, view, output);
+	if (transform_is_integer_translation(&transform)) {
+		pixman_region32_fini(&region);
+		return;
+	}
+
+	pixman_region32_copy(&region, &view->transform.boundingbox);
+	region_global_to_output(output, &region);
+	pixman_region32_intersect_rect(&region, &region, 0, 0,
+				       pixman_image_get_width(po->shadow_image),
+				       pixman_image_get_height(po->shadow_image));
+	box = *pixman_region32_extents(&region);
+	pixman_region32_fini(&region);
+
+	size = (size_t) (box.x2 - box.x1) * (box.y2 - box.y1) * 4;
+	if (size == 0 || size > pr->cache_budget)
+		return;
+
+	vs = get_view_state(view, true);
+	if (!vs)
+		return;
+
+	cache = find_view_cache(vs, output);
+	if (!cache) {
+		cache = zalloc(sizeof *cache);
+		if (!cache)
+			return;
+
+		cache->output = output;
+		pixman_region32_init(&cache->source_clip);
+		wl_list_insert(&vs->cache_list, &cache->view_link);
+		wl_list_insert(&pr->cache_lru, &cache->lru_link);
+	}
+
+	source_clipped = !view_transformation_is_translation(view);
+	pixman_region32_init(&region);
+	if (source_clipped)
+		view_source_clip(view, &region);
+
+	if (memcmp(&cache->transform, &transform, sizeof transform) != 0 ||
+	    cache->filter != view_filter(view, output) ||
+	    cache->source_clipped != source_clipped ||
+	    !pixman_region32_equal(&cache->source_clip, &region) ||
+	    cache->content_serial != ps->content_serial ||
+	    memcmp(&cache->box, &box, sizeof box) != 0) {
+		/* Changed since the last repaint, wait for it to settle. */
+		view_cache_drop_image(pr, cache);
+		cache->transform = transform;
+		cache->filter = view_filter(view, output);
+		cache->source_clipped = source_clipped;
+		pixman_region32_copy(&cache->source_clip, &region);
+		cache->content_serial = ps->content_serial;
+		cache->box = box;
+		pixman_region32_fini(&region);
+		return;
+	}
+	pixman_region32_fini(&region);
+
+	wl_list_remove(&cache->lru_link);
+	wl_list_insert(&pr->cache_lru, &cache->lru_link);
+
+	if (!cache->image) {
+		if (!view_cache_make_room(pr, size))
+			return;
+
+		view_cache_render(view, cache);
+		if (!cache->image)
+			return;
+		pr->cache_size += cache->size;
+	}
+
+	cache->repaint_serial = pr->repaint_serial;
+}
+
+static void
+update_view_caches(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view **views = output->visible_views.data;
+	size_t i, n_views = output->visible_views.size / sizeof *views;
+
+	pr->repaint_serial++;
+	if (pr->cache_budget == 0)
+		return;
+
+	for (i = 0; i < n_views; i++)
+		if (views[i]->plane == &compositor->primary_plane)
+			update_view_cache(pr, views[i], output, damage);
+}
+
+static void
+drop_output_view_caches(struct pixman_renderer *pr,
+			struct weston_output *output)
+{
+	struct pixman_view_cache *cache, *next;
+
+	wl_list_for_each_safe(cache, next, &pr->cache_lru, lru_link)
+		if (cache->output == output)
+			view_cache_destroy(pr, cache);
+}
+
+static pixman_image_t *
+create_private_source(pixman_image_t *image, const pixman_color_t *color)
+{
+	if (!pixman_image_get_data(image))
+		return pixman_image_create_solid_fill(color);
+
+	return pixman_image_create_bits_no_clear(
+				pixman_image_get_format(image),
+				pixman_image_get_width(image),
+				pixman_image_get_height(image),
+				pixman_image_get_data(image),
+				pixman_image_get_stride(image));
+}
+
 /** Paint an intersected region
  *
  * \param ev The view to be painted.
  * \param output The output being painted.
- * \param repaint_output The region to be painted in output coordinates.
+ * \param tile Where to paint.
+ * \param repaint_output The region to be painted in output coordinates,
+ *                       clipped to the tile on return.
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
  * \param pixman_op Compositing operator, either SRC or OVER.
  */
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
+	       struct pixman_tile *tile,
 	       pixman_region32_t *repaint_output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
-	struct weston_buffer_viewport *vp = &ev->surface->buffer_viewport;
+	struct pixman_view_cache *cache;
 	pixman_transform_t transform;
 	pixman_filter_t filter;
+	pixman_image_t *image;
+	pixman_image_t *src_image;
 	pixman_image_t *mask_image;
 	pixman_color_t mask = { 0, };
 
-	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(po->shadow_image, repaint_output);
-
-	pixman_renderer_compute_transform(&transform, ev, output);
+	if (tile->box) {
+		pixman_region32_intersect_rect(repaint_output, repaint_output,
+					       tile->box->x1, tile->box->y1,
+					       tile->box->x2 - tile->box->x1,
+					       tile->box->y2 - tile->box->y1);
+		if (!pixman_region32_not_empty(repaint_output))
+			return;
+	}
 
-	if (ev->transform.enabled || output->current_scale != vp->buffer.scale)
-		filter = PIXMAN_FILTER_BILINEAR;
-	else
+	/* Clip rendering to the damaged output region */
+	pixman_image_set_clip_region32(tile->dest, repaint_output);
+
+	cache = lookup_view_cache(ev, output);
+	if (cache) {
+		/* Already resampled and source clipped. */
+		image = cache->image;
+		pixman_transform_init_translate(&transform,
+				pixman_int_to_fixed(-cache->box.x1),
+				pixman_int_to_fixed(-cache->box.y1));
 		filter = PIXMAN_FILTER_NEAREST;
+		source_clip = NULL;
+	} else {
+		image = ps->image;
+		pixman_renderer_compute_transform(&transform, ev, output);
+		filter = view_filter(ev, output);
+	}
 
-	if (ps->buffer_ref.buffer)
+	if (!cache && ps->buffer_ref.buffer)
 		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
 
 	if (ev->alpha < 1.0) {
@@ -361,35 +932,44 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 		mask_image = NULL;
 	}
 
+	if (tile->private_sources)
+		src_image = create_private_source(image, &ps->color);
+	else
+		src_image = image;
+
 	if (source_clip)
-		composite_clipped(ps->image, mask_image, po->shadow_image,
+		composite_clipped(src_image, mask_image, tile->dest,
 				  &transform, filter, source_clip);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
-				po->shadow_image, &transform, filter);
+		composite_whole(pixman_op, src_image, mask_image,
+				tile->dest, &transform, filter);
+
+	if (tile->private_sources)
+		pixman_image_unref(src_image);
 
 	if (mask_image)
 		pixman_image_unref(mask_image);
 
-	if (ps->buffer_ref.buffer)
+	if (!cache && ps->buffer_ref.buffer)
 		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
 
-	if (pr->repaint_debug)
+	if (tile->debug_color)
 		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+					 tile->debug_color, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 tile->dest, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (tile->dest), /* width */
+					 pixman_image_get_height (tile->dest) /* height */);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_image_set_clip_region32 (tile->dest, NULL);
 }
 
 static void
 draw_view_translated(struct weston_view *view, struct weston_output *output,
+		     struct pixman_tile *tile,
 		     pixman_region32_t *repaint_global)
 {
 	struct weston_surface *surface = view->surface;
@@ -417,8 +997,8 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 							  view);
 			region_global_to_output(output, &repaint_output);
 
-			repaint_region(view, output, &repaint_output, NULL,
-				       PIXMAN_OP_SRC);
+			repaint_region(view, output, tile, &repaint_output,
+				       NULL, PIXMAN_OP_SRC);
 		}
 	}
 
@@ -428,7 +1008,7 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 						  &surface_blend, view);
 		region_global_to_output(output, &repaint_output);
 
-		repaint_region(view, output, &repaint_output, NULL,
+		repaint_region(view, output, tile, &repaint_output, NULL,
 			       PIXMAN_OP_OVER);
 	}
 
@@ -439,10 +1019,9 @@ draw_view_translated(struct weston_view *view, struct weston_output *output,
 static void
 draw_view_source_clipped(struct weston_view *view,
 			 struct weston_output *output,
+			 struct pixman_tile *tile,
 			 pixman_region32_t *repaint_global)
 {
-	struct weston_surface *surface = view->surface;
-	pixman_region32_t surf_region;
 	pixman_region32_t buffer_region;
 	pixman_region32_t repaint_output;
 
@@ -451,29 +1030,23 @@ draw_view_source_clipped(struct weston_view *view,
 	 * opaque separately has no benefit.
 	 */
 
-	pixman_region32_init_rect(&surf_region, 0, 0,
-				  surface->width, surface->height);
-	if (view->geometry.scissor_enabled)
-		pixman_region32_intersect(&surf_region, &surf_region,
-					  &view->geometry.scissor);
-
 	pixman_region32_init(&buffer_region);
-	weston_surface_to_buffer_region(surface, &surf_region, &buffer_region);
+	view_source_clip(view, &buffer_region);
 
 	pixman_region32_init(&repaint_output);
 	pixman_region32_copy(&repaint_output, repaint_global);
 	region_global_to_output(output, &repaint_output);
 
-	repaint_region(view, output, &repaint_output, &buffer_region,
+	repaint_region(view, output, tile, &repaint_output, &buffer_region,
 		       PIXMAN_OP_OVER);
 
 	pixman_region32_fini(&repaint_output);
 	pixman_region32_fini(&buffer_region);
-	pixman_region32_fini(&surf_region);
 }
 
 static void
 draw_view(struct weston_view *ev, struct weston_output *output,
+	  struct pixman_tile *tile,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
@@ -500,7 +1073,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * Also the boundingbox is accurate rather than an
 		 * approximation.
 		 */
-		draw_view_translated(ev, output, &repaint);
+		draw_view_translated(ev, output, tile, &repaint);
 	} else {
 		/* The complex case: the view transformation does not allow
 		 * converting opaque etc. regions into global coordinate space.
@@ -509,21 +1082,157 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		 * to be used whole. Source clipping does not work with
 		 * PIXMAN_OP_SRC.
 		 */
-		draw_view_source_clipped(ev, output, &repaint);
+		draw_view_source_clipped(ev, output, tile, &repaint);
 	}
 
 out:
 	pixman_region32_fini(&repaint);
 }
 static void
-repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
+repaint_surfaces(struct weston_output *output, struct pixman_tile *tile,
+		 pixman_region32_t *damage)
 {
 	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_view **views = output->visible_views.data;
+	size_t i = output->visible_views.size / sizeof *views;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	/* Bottom to top, only the views on this output. */
+	while (i-- > 0)
+		if (views[i]->plane == &compositor->primary_plane)
+			draw_view(views[i], output, tile, damage);
+}
+
+/* Draws tiles of the job until there are none left, on any thread. */
+static void
+repaint_tiles(struct pixman_renderer *pr, struct pixman_repaint_job *job)
+{
+	struct pixman_tile tile;
+	pixman_box32_t box;
+	int i;
+
+	tile.dest = pixman_image_create_bits_no_clear(PIXMAN_x8r8g8b8,
+						      job->width, job->height,
+						      job->shadow_buffer,
+						      job->stride);
+	tile.debug_color = pr->repaint_debug ?
+		pixman_image_create_solid_fill(&debug_red) : NULL;
+	tile.box = &box;
+	tile.private_sources = true;
+
+	for (;;) {
+		pthread_mutex_lock(&pr->job_mutex);
+		i = job->next_tile++;
+		pthread_mutex_unlock(&pr->job_mutex);
+
+		if (i >= job->n_tiles)
+			break;
+
+		box.x1 = 0;
+		box.x2 = job->width;
+		box.y1 = job->y1 + i * TILE_HEIGHT;
+		box.y2 = MIN(box.y1 + TILE_HEIGHT, job->y2);
+		repaint_surfaces(job->output, &tile, job->damage);
+	}
+
+	if (tile.debug_color)
+		pixman_image_unref(tile.debug_color);
+	pixman_image_unref(tile.dest);
+}
+
+static void *
+worker_thread(void *data)
+{
+	struct pixman_renderer *pr = data;
+	struct pixman_repaint_job *job;
+	uint32_t serial = 0;
+
+	pthread_mutex_lock(&pr->job_mutex);
+	for (;;) {
+		while (!pr->quit && pr->job_serial == serial)
+			pthread_cond_wait(&pr->job_cond, &pr->job_mutex);
+		if (pr->quit)
+			break;
+
+		serial = pr->job_serial;
+		job = pr->job;
+		pthread_mutex_unlock(&pr->job_mutex);
+
+		repaint_tiles(pr, job);
+
+		pthread_mutex_lock(&pr->job_mutex);
+		if (--pr->workers_busy == 0)
+			pthread_cond_signal(&pr->done_cond);
+	}
+	pthread_mutex_unlock(&pr->job_mutex);
+
+	return NULL;
+}
+
+/** Repaint the damage in tiles, on the worker threads and this one
+ *
+ * \return False if the damage is too small to be worth splitting, in
+ * which case nothing was drawn.
+ *
+ * Every pixel is drawn by the same sequence of composites as in a
+ * single-threaded repaint, so the result is identical. All tiles are
+ * done when this returns.
+ */
+static bool
+repaint_surfaces_threaded(struct weston_output *output,
+			  pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct pixman_output_state *po = get_output_state(output);
+	struct weston_view **views = output->visible_views.data;
+	size_t i, n_views = output->visible_views.size / sizeof *views;
+	struct pixman_repaint_job job;
+	pixman_region32_t damage_output;
+	pixman_box32_t *extents;
+
+	if (pr->n_workers == 0)
+		return false;
+
+	pixman_region32_init(&damage_output);
+	pixman_region32_copy(&damage_output, damage);
+	region_global_to_output(output, &damage_output);
+	extents = pixman_region32_extents(&damage_output);
+
+	memset(&job, 0, sizeof job);
+	job.output = output;
+	job.damage = damage;
+	job.shadow_buffer = po->shadow_buffer;
+	job.width = pixman_image_get_width(po->shadow_image);
+	job.height = pixman_image_get_height(po->shadow_image);
+	job.stride = pixman_image_get_stride(po->shadow_image);
+	job.y1 = MAX(extents->y1, 0);
+	job.y2 = MIN(extents->y2, job.height);
+	pixman_region32_fini(&damage_output);
+
+	if (job.y2 - job.y1 <= TILE_HEIGHT)
+		return false;
+	job.n_tiles = (job.y2 - job.y1 + TILE_HEIGHT - 1) / TILE_HEIGHT;
+
+	/* Surface states are created on first use, which the workers must
+	 * not do. */
+	for (i = 0; i < n_views; i++)
+		get_surface_state(views[i]->surface);
+
+	pthread_mutex_lock(&pr->job_mutex);
+	pr->job = &job;
+	pr->job_serial++;
+	pr->workers_busy = pr->n_workers;
+	pthread_cond_broadcast(&pr->job_cond);
+	pthread_mutex_unlock(&pr->job_mutex);
+
+	repaint_tiles(pr, &job);
+
+	pthread_mutex_lock(&pr->job_mutex);
+	while (pr->workers_busy > 0)
+		pthread_cond_wait(&pr->done_cond, &pr->job_mutex);
+	pr->job = NULL;
+	pthread_mutex_unlock(&pr->job_mutex);
+
+	return true;
 }
 
 static void
@@ -557,12 +1266,24 @@ static void
 pixman_renderer_repaint_output(struct weston_output *output,
 			     pixman_region32_t *output_damage)
 {
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_tile tile;
 
 	if (!po->hw_buffer)
 		return;
 
-	repaint_surfaces(output, output_damage);
+	finish_readbacks(output);
+	update_view_caches(output, output_damage);
+
+	if (!repaint_surfaces_threaded(output, output_damage)) {
+		tile.dest = po->shadow_image;
+		tile.debug_color = pr->repaint_debug ? pr->debug_color : NULL;
+		tile.box = NULL;
+		tile.private_sources = false;
+		repaint_surfaces(output, &tile, output_damage);
+	}
+
 	copy_to_hw_buffer(output, output_damage);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
@@ -571,10 +1292,56 @@ pixman_renderer_repaint_output(struct weston_output *output,
 	/* Actual flip should be done by caller */
 }
 
+static void
+convert_yuv_damage(struct pixman_surface_state *ps,
+		   struct weston_buffer *buffer)
+{
+	struct weston_surface *surface = ps->surface;
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	struct yuv_convert_source src;
+	pixman_box32_t *rects, r;
+	uint32_t *dst = pixman_image_get_data(ps->yuv_image);
+	int dst_stride = pixman_image_get_stride(ps->yuv_image);
+	int i, n;
+
+	wl_shm_buffer_begin_access(shm_buffer);
+
+	yuv_convert_source_init(&src, ps->yuv_format,
+				wl_shm_buffer_get_data(shm_buffer),
+				buffer->width, buffer->height,
+				wl_shm_buffer_get_stride(shm_buffer));
+
+	if (ps->yuv_full_convert) {
+		yuv_convert_rect(&src, dst, dst_stride,
+				 0, 0, buffer->width, buffer->height);
+		ps->yuv_full_convert = false;
+	} else {
+		rects = pixman_region32_rectangles(&surface->damage, &n);
+		for (i = 0; i < n; i++) {
+			r = weston_surface_to_buffer_rect(surface, rects[i]);
+			yuv_convert_rect(&src, dst, dst_stride, r.x1, r.y1,
+					 r.x2 - r.x1, r.y2 - r.y1);
+		}
+	}
+
+	wl_shm_buffer_end_access(shm_buffer);
+}
+
 static void
 pixman_renderer_flush_damage(struct weston_surface *surface)
 {
-	/* No-op for pixman renderer */
+	struct pixman_surface_state *ps = get_surface_state(surface);
+
+	/* A YUV buffer is not needed any more once converted, so the
+	 * client gets it back before the repaint. Other shm buffers are
+	 * read in place, and only the transformed view images go stale. */
+	if (ps->yuv_image && ps->buffer_ref.buffer) {
+		convert_yuv_damage(ps, ps->buffer_ref.buffer);
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+	}
+
+	if (pixman_region32_not_empty(&surface->damage))
+		ps->content_serial++;
 }
 
 static void
@@ -589,18 +1356,151 @@ buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->content_serial++;
 
 	ps->buffer_destroy_listener.notify = NULL;
 }
 
+static void
+pixman_buffer_state_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct pixman_buffer_state *bs;
+
+	bs = container_of(listener, struct pixman_buffer_state,
+			  destroy_listener);
+
+	if (bs->image)
+		pixman_image_unref(bs->image);
+	free(bs);
+}
+
+/** Get the image of an shm buffer, from the cache if it is still valid
+ *
+ * The image stays owned by the cache. It is recreated when the format,
+ * size, stride or the mapping of the buffer changed, the latter when the
+ * client resized the shm pool.
+ */
+static pixman_image_t *
+get_buffer_image(struct weston_buffer *buffer, pixman_format_code_t format)
+{
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	struct pixman_buffer_state *bs;
+	struct wl_listener *listener;
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	void *data = wl_shm_buffer_get_data(shm_buffer);
+
+	listener = wl_signal_get(&buffer->destroy_signal,
+				 pixman_buffer_state_handle_destroy);
+	if (listener) {
+		bs = container_of(listener, struct pixman_buffer_state,
+				  destroy_listener);
+		if (bs->image && bs->format == format &&
+		    bs->width == buffer->width &&
+		    bs->height == buffer->height &&
+		    bs->stride == stride && bs->data == data)
+			return bs->image;
+
+		if (bs->image)
+			pixman_image_unref(bs->image);
+	} else {
+		bs = zalloc(sizeof *bs);
+		if (!bs)
+			return NULL;
+
+		bs->destroy_listener.notify =
+			pixman_buffer_state_handle_destroy;
+		wl_signal_add(&buffer->destroy_signal, &bs->destroy_listener);
+	}
+
+	bs->format = format;
+	bs->width = buffer->width;
+	bs->height = buffer->height;
+	bs->stride = stride;
+	bs->data = data;
+	bs->image = pixman_image_create_bits(format,
+					     buffer->width, buffer->height,
+					     data, stride);
+
+	return bs->image;
+}
+
+/* Only packed formats are taken from wl_shm. libwayland only checks that
+ * the pool covers stride * height bytes of a buffer, and has no way to
+ * tell the size of the pool, so the chroma planes of a planar format
+ * after the luma plane could lie outside of the mapping. */
+static bool
+yuv_format_from_shm(uint32_t shm_format, enum yuv_convert_format *format)
+{
+	switch (shm_format) {
+	case WL_SHM_FORMAT_YUYV:
+		*format = YUV_CONVERT_YUYV;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/** Attach a YUV shm buffer
+ *
+ * The converted image is kept across attaches of buffers of the same
+ * size, so that only the damage needs to be converted after the first
+ * one.
+ */
+static void
+pixman_renderer_attach_yuv(struct pixman_surface_state *ps,
+			   struct weston_buffer *buffer,
+			   struct wl_shm_buffer *shm_buffer,
+			   enum yuv_convert_format format)
+{
+	int32_t width = wl_shm_buffer_get_width(shm_buffer);
+	int32_t height = wl_shm_buffer_get_height(shm_buffer);
+	int32_t min_stride;
+
+	/* Chroma samples cover pixel pairs, also at an odd width. */
+	min_stride = (width + 1) & ~1;
+	if (format == YUV_CONVERT_YUYV)
+		min_stride *= 2;
+
+	if (wl_shm_buffer_get_stride(shm_buffer) < min_stride) {
+		weston_log("Stride too small for YUV SHM buffer\n");
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
+
+	buffer->shm_buffer = shm_buffer;
+	buffer->width = width;
+	buffer->height = height;
+
+	if (!ps->yuv_image ||
+	    pixman_image_get_width(ps->yuv_image) != width ||
+	    pixman_image_get_height(ps->yuv_image) != height) {
+		if (ps->yuv_image)
+			pixman_image_unref(ps->yuv_image);
+		ps->yuv_image = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							 width, height,
+							 NULL, 0);
+		if (!ps->yuv_image) {
+			weston_log("Failed to create image for YUV SHM buffer\n");
+			weston_buffer_reference(&ps->buffer_ref, NULL);
+			return;
+		}
+		ps->yuv_full_convert = true;
+	}
+
+	ps->yuv_format = format;
+	ps->image = pixman_image_ref(ps->yuv_image);
+}
+
 static void
 pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
-	struct wl_shm_buffer *shm_buffer;
+	struct wl_shm_buffer *shm_buffer = NULL;
 	pixman_format_code_t pixman_format;
+	enum yuv_convert_format yuv_format;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
+	ps->content_serial++;
 
 	if (ps->buffer_destroy_listener.notify) {
 		wl_list_remove(&ps->buffer_destroy_listener.link);
@@ -612,10 +1512,24 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		ps->image = NULL;
 	}
 
-	if (!buffer)
+	if (buffer)
+		shm_buffer = wl_shm_buffer_get(buffer->resource);
+
+	if (shm_buffer &&
+	    yuv_format_from_shm(wl_shm_buffer_get_format(shm_buffer),
+				&yuv_format)) {
+		pixman_renderer_attach_yuv(ps, buffer, shm_buffer, yuv_format);
 		return;
+	}
+
+	/* Whatever comes next, the converted image is out of date. */
+	if (ps->yuv_image) {
+		pixman_image_unref(ps->yuv_image);
+		ps->yuv_image = NULL;
+	}
 
-	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (!buffer)
+		return;
 
 	if (! shm_buffer) {
 		weston_log("Pixman renderer supports only SHM buffers\n");
@@ -644,10 +1558,13 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
 	buffer->height = wl_shm_buffer_get_height(shm_buffer);
 
-	ps->image = pixman_image_create_bits(pixman_format,
-		buffer->width, buffer->height,
-		wl_shm_buffer_get_data(shm_buffer),
-		wl_shm_buffer_get_stride(shm_buffer));
+	ps->image = get_buffer_image(buffer, pixman_format);
+	if (!ps->image) {
+		weston_log("Failed to create image for SHM buffer\n");
+		weston_buffer_reference(&ps->buffer_ref, NULL);
+		return;
+	}
+	pixman_image_ref(ps->image);
 
 	ps->buffer_destroy_listener.notify =
 		buffer_state_handle_buffer_destroy;
@@ -671,6 +1588,8 @@ pixman_renderer_surface_state_destroy(struct pixman_surface_state *ps)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	if (ps->yuv_image)
+		pixman_image_unref(ps->yuv_image);
 	weston_buffer_reference(&ps->buffer_ref, NULL);
 	free(ps);
 }
@@ -735,6 +1654,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
+	ps->color = color;
+	ps->content_serial++;
 
 	if (ps->image) {
 		pixman_image_unref(ps->image);
@@ -744,10 +1665,82 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
+static void
+pixman_renderer_stop_workers(struct pixman_renderer *pr)
+{
+	int i;
+
+	pthread_mutex_lock(&pr->job_mutex);
+	pr->quit = true;
+	pthread_cond_broadcast(&pr->job_cond);
+	pthread_mutex_unlock(&pr->job_mutex);
+
+	for (i = 0; i < pr->n_workers; i++)
+		pthread_join(pr->workers[i], NULL);
+
+	free(pr->workers);
+	pr->workers = NULL;
+	pr->n_workers = 0;
+}
+
+/** Start the threads that draw tiles together with the compositor thread
+ *
+ * \param n_threads Total number of threads to draw with.
+ */
+static void
+pixman_renderer_start_workers(struct pixman_renderer *pr, int n_threads)
+{
+	sigset_t mask, old_mask;
+	int i;
+
+	if (n_threads < 2)
+		return;
+
+	pr->workers = zalloc((n_threads - 1) * sizeof pr->workers[0]);
+	if (!pr->workers)
+		return;
+
+	/* Leave the signals to the event loop, except for faults: reading
+	 * a truncated shm buffer raises SIGBUS on the faulting thread,
+	 * which wl_shm_buffer_begin_access() handles. */
+	sigfillset(&mask);
+	sigdelset(&mask, SIGBUS);
+	sigdelset(&mask, SIGSEGV);
+	sigdelset(&mask, SIGFPE);
+	sigdelset(&mask, SIGILL);
+	pthread_sigmask(SIG_SETMASK, &mask, &old_mask);
+
+	for (i = 0; i < n_threads - 1; i++) {
+		if (pthread_create(&pr->workers[i], NULL,
+				   worker_thread, pr) != 0)
+			break;
+		pr->n_workers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	if (pr->n_workers == 0) {
+		free(pr->workers);
+		pr->workers = NULL;
+		return;
+	}
+
+	weston_log("Pixman renderer draws with %d threads.\n",
+		   pr->n_workers + 1);
+}
+
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
 	struct pixman_renderer *pr = get_renderer(ec);
+	struct pixman_view_state *vs, *next;
+
+	pixman_renderer_stop_workers(pr);
+	wl_list_for_each_safe(vs, next, &pr->view_state_list, link)
+		view_state_destroy(vs);
+	pthread_cond_destroy(&pr->done_cond);
+	pthread_cond_destroy(&pr->job_cond);
+	pthread_mutex_destroy(&pr->job_mutex);
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
@@ -813,11 +1806,7 @@ debug_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	pr->repaint_debug ^= 1;
 
 	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
+		pr->debug_color = pixman_image_create_solid_fill(&debug_red);
 	} else {
 		pixman_image_unref(pr->debug_color);
 		weston_compositor_damage_all(ec);
@@ -836,6 +1825,7 @@ pixman_renderer_init(struct weston_compositor *ec)
 	renderer->repaint_debug = 0;
 	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
+	renderer->base.read_pixels_async = pixman_renderer_read_pixels_async;
 	renderer->base.repaint_output = pixman_renderer_repaint_output;
 	renderer->base.flush_damage = pixman_renderer_flush_damage;
 	renderer->base.attach = pixman_renderer_attach;
@@ -855,9 +1845,19 @@ pixman_renderer_init(struct weston_compositor *ec)
 						    debug_binding, ec);
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_YUYV);
 
 	wl_signal_init(&renderer->destroy_signal);
 
+	pthread_mutex_init(&renderer->job_mutex, NULL);
+	pthread_cond_init(&renderer->job_cond, NULL);
+	pthread_cond_init(&renderer->done_cond, NULL);
+	pixman_renderer_start_workers(renderer, ec->pixman_threads);
+
+	wl_list_init(&renderer->view_state_list);
+	wl_list_init(&renderer->cache_lru);
+	renderer->cache_budget = ec->pixman_transform_cache_size;
+
 	return 0;
 }
 
@@ -866,6 +1866,8 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	finish_readbacks(output);
+
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 	po->hw_buffer = buffer;
@@ -907,6 +1909,8 @@ pixman_renderer_output_create(struct weston_output *output)
 		return -1;
 	}
 
+	wl_list_init(&po->readback_list);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -917,6 +1921,11 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	finish_readbacks(output);
+	free(po->readback_data);
+
+	drop_output_view_caches(get_renderer(output->compositor), output);
+
 	pixman_image_unref(po->shadow_image);
 
 	if (po->hw_buffer)
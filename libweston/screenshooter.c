@@ -41,6 +41,8 @@
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
+	struct weston_pixels_readback readback;
+	struct weston_output *output;
 	struct weston_buffer *buffer;
 	weston_screenshooter_done_func_t done;
 	void *data;
@@ -110,31 +112,12 @@ copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
 }
 
 static void
-screenshooter_frame_notify(struct wl_listener *listener, void *data)
+screenshooter_copy(struct screenshooter_frame_listener *l, uint8_t *pixels)
 {
-	struct screenshooter_frame_listener *l =
-		container_of(listener,
-			     struct screenshooter_frame_listener, listener);
-	struct weston_output *output = data;
+	struct weston_output *output = l->output;
 	struct weston_compositor *compositor = output->compositor;
 	int32_t stride;
-	uint8_t *pixels, *d, *s;
-
-	output->disable_planes--;
-	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
-
-	if (pixels == NULL) {
-		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
-		free(l);
-		return;
-	}
-
-	compositor->renderer->read_pixels(output,
-			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
+	uint8_t *d, *s;
 
 	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
 
@@ -163,6 +146,65 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	}
 
 	wl_shm_buffer_end_access(l->buffer->shm_buffer);
+}
+
+static void
+screenshooter_readback_done(struct weston_pixels_readback *readback,
+			    const void *pixels)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(readback,
+			     struct screenshooter_frame_listener, readback);
+
+	if (pixels) {
+		screenshooter_copy(l, (uint8_t *) pixels);
+		l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+	} else {
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+	}
+
+	free(l);
+}
+
+static void
+screenshooter_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct screenshooter_frame_listener *l =
+		container_of(listener,
+			     struct screenshooter_frame_listener, listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	int32_t stride;
+	uint8_t *pixels;
+
+	output->disable_planes--;
+	wl_list_remove(&listener->link);
+	l->output = output;
+
+	/* The copy is done when the renderer has the pixels, so that
+	 * the repaint does not wait for the GPU. */
+	if (weston_output_read_pixels_async(output, &l->readback,
+					    compositor->read_format,
+					    0, 0, output->current_mode->width,
+					    output->current_mode->height,
+					    screenshooter_readback_done) == 0)
+		return;
+
+	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+	pixels = malloc(stride * l->buffer->height);
+
+	if (pixels == NULL) {
+		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+		free(l);
+		return;
+	}
+
+	compositor->renderer->read_pixels(output,
+			     compositor->read_format, pixels,
+			     0, 0, output->current_mode->width,
+			     output->current_mode->height);
+
+	screenshooter_copy(l, pixels);
 
 	l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
 	free(pixels);
@@ -216,6 +258,14 @@ struct weston_recorder {
 	int fd;
 	struct wl_listener frame_listener;
 	int count, destroying;
+
+	/* The extents of the damage of a frame are read back in one go,
+	 * and encoded once the pixels arrive. */
+	struct weston_pixels_readback readback;
+	pixman_region32_t damage;
+	pixman_box32_t extents;
+	uint32_t msecs;
+	bool reading;
 };
 
 static uint32_t *
@@ -252,80 +302,64 @@ component_delta(uint32_t next, uint32_t prev)
 static void
 weston_recorder_destroy(struct weston_recorder *recorder);
 
+/* Row y of the output in the pixels read back for the damage extents. */
+static const uint32_t *
+recorder_row(struct weston_recorder *recorder, const uint32_t *pixels,
+	     int y, int do_yflip)
+{
+	const pixman_box32_t *e = &recorder->extents;
+	int row;
+
+	if (do_yflip)
+		row = e->y2 - 1 - y;
+	else
+		row = y - e->y1;
+
+	return pixels + (e->x2 - e->x1) * row;
+}
+
 static void
-weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+weston_recorder_write_frame(struct weston_recorder *recorder,
+			    const uint32_t *pixels)
 {
-	struct weston_recorder *recorder =
-		container_of(listener, struct weston_recorder, frame_listener);
-	struct weston_output *output = data;
-	struct weston_compositor *compositor = output->compositor;
-	uint32_t msecs = output->frame_time;
+	struct weston_compositor *compositor = recorder->output->compositor;
+	const pixman_box32_t *e = &recorder->extents;
 	pixman_box32_t *r;
-	pixman_region32_t damage, transformed_damage;
 	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
+	uint32_t delta, prev, *d, *p, next;
+	const uint32_t *s;
 	struct {
 		uint32_t msecs;
 		uint32_t nrects;
 	} header;
 	struct iovec v[2];
 	int do_yflip;
-	int y_orig;
-	uint32_t *outbuf;
+	uint32_t *outbuf = recorder->rect;
 
 	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
-
-	pixman_region32_init(&damage);
-	pixman_region32_init(&transformed_damage);
-	pixman_region32_intersect(&damage, &output->region,
-				  &output->previous_damage);
-	pixman_region32_translate(&damage, -output->x, -output->y);
-	weston_transformed_region(output->width, output->height,
-				 output->transform, output->current_scale,
-				 &damage, &transformed_damage);
-	pixman_region32_fini(&damage);
 
-	r = pixman_region32_rectangles(&transformed_damage, &n);
-	if (n == 0) {
-		pixman_region32_fini(&transformed_damage);
-		return;
-	}
+	r = pixman_region32_rectangles(&recorder->damage, &n);
 
-	header.msecs = msecs;
+	header.msecs = recorder->msecs;
 	header.nrects = n;
 	v[0].iov_base = &header;
 	v[0].iov_len = sizeof header;
 	v[1].iov_base = r;
 	v[1].iov_len = n * sizeof *r;
 	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
+	stride = recorder->output->current_mode->width;
 
 	for (i = 0; i < n; i++) {
 		width = r[i].x2 - r[i].x1;
 		height = r[i].y2 - r[i].y1;
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
-		else
-			y_orig = r[i].y1;
-
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
 		p = outbuf;
 		run = prev = 0; /* quiet gcc */
 		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				s = recorder->rect + width * j;
-			else
-				s = recorder->rect + width * (height - j - 1);
-			y_orig = r[i].y2 - j - 1;
-			d = recorder->frame + stride * y_orig + r[i].x1;
+			s = recorder_row(recorder, pixels, r[i].y2 - j - 1,
+					 do_yflip) + r[i].x1 - e->x1;
+			d = recorder->frame + stride * (r[i].y2 - j - 1) +
+			    r[i].x1;
 
 			for (k = 0; k < width; k++) {
 				next = *s++;
@@ -356,8 +390,79 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 #endif
 	}
 
-	pixman_region32_fini(&transformed_damage);
 	recorder->count++;
+}
+
+static void
+weston_recorder_readback_done(struct weston_pixels_readback *readback,
+			      const void *pixels)
+{
+	struct weston_recorder *recorder =
+		container_of(readback, struct weston_recorder, readback);
+
+	recorder->reading = false;
+	if (pixels)
+		weston_recorder_write_frame(recorder, pixels);
+
+	if (recorder->destroying)
+		weston_recorder_destroy(recorder);
+}
+
+static void
+weston_recorder_frame_notify(struct wl_listener *listener, void *data)
+{
+	struct weston_recorder *recorder =
+		container_of(listener, struct weston_recorder, frame_listener);
+	struct weston_output *output = data;
+	struct weston_compositor *compositor = output->compositor;
+	pixman_region32_t damage;
+	pixman_box32_t *e;
+	int do_yflip, y_orig, width, height;
+
+	/* Frames are written in order, the previous one must be done. */
+	if (recorder->reading)
+		return;
+
+	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	pixman_region32_init(&damage);
+	pixman_region32_intersect(&damage, &output->region,
+				  &output->previous_damage);
+	pixman_region32_translate(&damage, -output->x, -output->y);
+	weston_transformed_region(output->width, output->height,
+				 output->transform, output->current_scale,
+				 &damage, &recorder->damage);
+	pixman_region32_fini(&damage);
+
+	if (!pixman_region32_not_empty(&recorder->damage)) {
+		if (recorder->destroying)
+			weston_recorder_destroy(recorder);
+		return;
+	}
+
+	recorder->msecs = output->frame_time;
+	e = pixman_region32_extents(&recorder->damage);
+	recorder->extents = *e;
+	width = e->x2 - e->x1;
+	height = e->y2 - e->y1;
+
+	if (do_yflip)
+		y_orig = output->current_mode->height - e->y2;
+	else
+		y_orig = e->y1;
+
+	if (weston_output_read_pixels_async(output, &recorder->readback,
+					    compositor->read_format,
+					    e->x1, y_orig, width, height,
+					    weston_recorder_readback_done) == 0) {
+		recorder->reading = true;
+		return;
+	}
+
+	compositor->renderer->read_pixels(output,
+			compositor->read_format, recorder->tmpbuf,
+			e->x1, y_orig, width, height);
+	weston_recorder_write_frame(recorder, recorder->tmpbuf);
 
 	if (recorder->destroying)
 		weston_recorder_destroy(recorder);
@@ -369,6 +474,7 @@ weston_recorder_free(struct weston_recorder *recorder)
 	if (recorder == NULL)
 		return;
 
+	pixman_region32_fini(&recorder->damage);
 	free(recorder->tmpbuf);
 	free(recorder->rect);
 	free(recorder->frame);
@@ -382,9 +488,6 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	struct weston_recorder *recorder;
 	int stride, size;
 	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
@@ -392,6 +495,9 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		return NULL;
 	}
 
+	pixman_region32_init(&recorder->damage);
+	wl_list_init(&recorder->readback.link);
+
 	stride = output->current_mode->width;
 	size = stride * 4 * output->current_mode->height;
 	recorder->frame = zalloc(size);
@@ -403,12 +509,10 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		goto err_recorder;
 	}
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
-			weston_log("%s: out of memory\n", __func__);
-			goto err_recorder;
-		}
+	recorder->tmpbuf = malloc(size);
+	if (recorder->tmpbuf == NULL) {
+		weston_log("%s: out of memory\n", __func__);
+		goto err_recorder;
 	}
 
 	header.magic = WCAP_HEADER_MAGIC;
@@ -453,6 +557,7 @@ err_recorder:
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
+	weston_pixels_readback_cancel(&recorder->readback);
 	wl_list_remove(&recorder->frame_listener.link);
 	close(recorder->fd);
 	recorder->output->disable_planes--;
@@ -0,0 +1,303 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <wayland-util.h>
+
+#include "slab.h"
+#include "shared/helpers.h"
+#include "shared/zalloc.h"
+
+/* Chunks are aligned to their size, which puts the chunk header of any
+ * object at the object address rounded down. */
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_ALIGN 16
+
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+struct slab_free_slot {
+	struct slab_free_slot *next;
+};
+
+struct slab_chunk {
+	struct weston_slab *slab;
+	struct wl_list link;		/* weston_slab::partial or ::full */
+	struct slab_free_slot *free_list;
+	uint32_t used;
+	uint32_t fresh;			/* slots handed out at least once */
+};
+
+struct weston_slab {
+	char *name;
+	size_t object_size;
+	uint32_t per_chunk;
+
+	/* Chunks with free slots, the ones in use first so that empty
+	 * chunks drain and can be returned. */
+	struct wl_list partial;
+	struct wl_list full;
+	uint32_t empty_chunks;
+	bool destroyed;
+
+	struct weston_slab_stats stats;
+};
+
+#define CHUNK_HEADER_SIZE ALIGN_UP(sizeof(struct slab_chunk), SLAB_ALIGN)
+
+static void *
+chunk_slot(struct slab_chunk *chunk, uint32_t i)
+{
+	return (char *) chunk + CHUNK_HEADER_SIZE +
+		(size_t) i * chunk->slab->object_size;
+}
+
+static struct slab_chunk *
+chunk_from_object(void *object)
+{
+	return (struct slab_chunk *)
+		((uintptr_t) object & ~((uintptr_t) SLAB_CHUNK_SIZE - 1));
+}
+
+static struct slab_chunk *
+slab_add_chunk(struct weston_slab *slab)
+{
+	struct slab_chunk *chunk;
+
+	if (posix_memalign((void **) &chunk, SLAB_CHUNK_SIZE,
+			   SLAB_CHUNK_SIZE) != 0)
+		return NULL;
+
+	chunk->slab = slab;
+	chunk->free_list = NULL;
+	chunk->used = 0;
+	chunk->fresh = 0;
+	wl_list_insert(&slab->partial, &chunk->link);
+
+	slab->empty_chunks++;
+	slab->stats.chunks++;
+
+	return chunk;
+}
+
+static void
+slab_free_chunk(struct weston_slab *slab, struct slab_chunk *chunk)
+{
+	wl_list_remove(&chunk->link);
+	slab->stats.chunks--;
+	free(chunk);
+}
+
+static void
+slab_free_chunk_list(struct weston_slab *slab, struct wl_list *list)
+{
+	struct slab_chunk *chunk, *next;
+
+	wl_list_for_each_safe(chunk, next, list, link)
+		slab_free_chunk(slab, chunk);
+}
+
+static void
+slab_release(struct weston_slab *slab)
+{
+	slab_free_chunk_list(slab, &slab->partial);
+	slab_free_chunk_list(slab, &slab->full);
+	free(slab->name);
+	free(slab);
+}
+
+/** Create a slab for objects of a given size
+ *
+ * \param name Name used in statistics and logs.
+ * \param object_size Size of the objects, usually sizeof the struct.
+ * \return The new slab, or NULL on failure or if the objects are too
+ * big to be pooled.
+ */
+WL_EXPORT struct weston_slab *
+weston_slab_create(const char *name, size_t object_size)
+{
+	struct weston_slab *slab;
+	size_t size;
+
+	size = ALIGN_UP(object_size ? object_size : 1, SLAB_ALIGN);
+	if (size > SLAB_CHUNK_SIZE - CHUNK_HEADER_SIZE)
+		return NULL;
+
+	slab = zalloc(sizeof *slab);
+	if (!slab)
+		return NULL;
+
+	slab->name = strdup(name);
+	if (!slab->name) {
+		free(slab);
+		return NULL;
+	}
+
+	slab->object_size = size;
+	slab->per_chunk = (SLAB_CHUNK_SIZE - CHUNK_HEADER_SIZE) / size;
+	slab->stats.object_size = size;
+	wl_list_init(&slab->partial);
+	wl_list_init(&slab->full);
+
+	return slab;
+}
+
+/** Destroy a slab
+ *
+ * \param slab The slab, may be NULL.
+ *
+ * If objects are still allocated, the slab stays around until the last
+ * one is given back with weston_slab_free().
+ */
+WL_EXPORT void
+weston_slab_destroy(struct weston_slab *slab)
+{
+	struct slab_chunk *chunk, *next;
+
+	if (!slab)
+		return;
+
+	if (slab->stats.live == 0) {
+		slab_release(slab);
+		return;
+	}
+
+	slab->destroyed = true;
+	wl_list_for_each_safe(chunk, next, &slab->partial, link) {
+		if (chunk->used == 0)
+			slab_free_chunk(slab, chunk);
+	}
+	slab->empty_chunks = 0;
+}
+
+/** Allocate a zero-filled object
+ *
+ * \param slab The slab.
+ * \return The object, or NULL if out of memory.
+ */
+WL_EXPORT void *
+weston_slab_zalloc(struct weston_slab *slab)
+{
+	struct slab_chunk *chunk;
+	void *object;
+
+	assert(!slab->destroyed);
+
+	if (wl_list_empty(&slab->partial)) {
+		chunk = slab_add_chunk(slab);
+		if (!chunk)
+			return NULL;
+	} else {
+		chunk = container_of(slab->partial.next,
+				     struct slab_chunk, link);
+	}
+
+	if (chunk->used == 0)
+		slab->empty_chunks--;
+
+	if (chunk->free_list) {
+		object = chunk->free_list;
+		chunk->free_list = chunk->free_list->next;
+	} else {
+		object = chunk_slot(chunk, chunk->fresh++);
+	}
+
+	if (++chunk->used == slab->per_chunk) {
+		wl_list_remove(&chunk->link);
+		wl_list_insert(&slab->full, &chunk->link);
+	}
+
+	slab->stats.allocations++;
+	if (++slab->stats.live > slab->stats.peak)
+		slab->stats.peak = slab->stats.live;
+
+	memset(object, 0, slab->object_size);
+
+	return object;
+}
+
+/** Give an object back to its slab
+ *
+ * \param object An object from weston_slab_zalloc(), may be NULL.
+ *
+ * At most one empty chunk is kept for reuse, others are returned to the
+ * system.
+ */
+WL_EXPORT void
+weston_slab_free(void *object)
+{
+	struct slab_chunk *chunk;
+	struct weston_slab *slab;
+	struct slab_free_slot *slot = object;
+
+	if (!object)
+		return;
+
+	chunk = chunk_from_object(object);
+	slab = chunk->slab;
+
+	if (chunk->used == slab->per_chunk) {
+		wl_list_remove(&chunk->link);
+		wl_list_insert(&slab->partial, &chunk->link);
+	}
+
+	slot->next = chunk->free_list;
+	chunk->free_list = slot;
+	chunk->used--;
+	slab->stats.live--;
+
+	if (chunk->used == 0) {
+		if (slab->destroyed || slab->empty_chunks > 0) {
+			slab_free_chunk(slab, chunk);
+		} else {
+			/* Keep it, but behind the chunks still in use. */
+			wl_list_remove(&chunk->link);
+			wl_list_insert(slab->partial.prev, &chunk->link);
+			slab->empty_chunks++;
+		}
+	}
+
+	if (slab->destroyed && slab->stats.live == 0)
+		slab_release(slab);
+}
+
+WL_EXPORT const char *
+weston_slab_get_name(struct weston_slab *slab)
+{
+	return slab->name;
+}
+
+WL_EXPORT void
+weston_slab_get_stats(struct weston_slab *slab,
+		      struct weston_slab_stats *stats)
+{
+	*stats = slab->stats;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_SLAB_H
+#define WESTON_SLAB_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** A pool of equally sized objects
+ *
+ * Objects are carved out of aligned chunks, so weston_slab_free() finds
+ * the slab of an object from its address alone. This lets objects be
+ * freed after the owner of the slab is gone, as happens to client
+ * resources destroyed after the compositor. Not thread safe.
+ */
+struct weston_slab;
+
+struct weston_slab_stats {
+	uint32_t live;		/**< objects currently allocated */
+	uint32_t peak;		/**< highest value of live so far */
+	uint64_t allocations;	/**< total number of allocations */
+	uint32_t chunks;	/**< chunks currently held */
+	size_t object_size;	/**< size of a slot, after padding */
+};
+
+struct weston_slab *
+weston_slab_create(const char *name, size_t object_size);
+
+void
+weston_slab_destroy(struct weston_slab *slab);
+
+void *
+weston_slab_zalloc(struct weston_slab *slab);
+
+void
+weston_slab_free(void *object);
+
+const char *
+weston_slab_get_name(struct weston_slab *slab);
+
+void
+weston_slab_get_stats(struct weston_slab *slab,
+		      struct weston_slab_stats *stats);
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -107,6 +107,28 @@ typedef struct wl_buffer * (EGLAPIENTRYP PFNEGLCREATEWAYLANDBUFFERFROMIMAGEWL) (
 #define GL_UNPACK_SKIP_PIXELS_EXT                               0x0CF4
 #endif
 
+/* Tokens of GL_NV_pixel_buffer_object and GL_EXT_map_buffer_range, GLES 3
+ * has the same ones without suffix. */
+#ifndef GL_PIXEL_UNPACK_BUFFER_NV
+#define GL_PIXEL_PACK_BUFFER_NV                                 0x88EB
+#define GL_PIXEL_UNPACK_BUFFER_NV                               0x88EC
+#endif
+
+#ifndef GL_MAP_WRITE_BIT_EXT
+#define GL_MAP_READ_BIT_EXT                                     0x0001
+#define GL_MAP_WRITE_BIT_EXT                                    0x0002
+#define GL_MAP_INVALIDATE_BUFFER_BIT_EXT                        0x0008
+#endif
+
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ                                          0x88E1
+#endif
+
+#ifndef GL_OES_get_program_binary
+#define GL_PROGRAM_BINARY_LENGTH_OES                            0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES                       0x87FE
+#endif
+
 /* Define needed tokens from EGL_EXT_image_dma_buf_import extension
  * here to avoid having to add ifdefs everywhere.*/
 #ifndef EGL_EXT_image_dma_buf_import
@@ -0,0 +1,246 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "yuv-convert.h"
+
+/* BT.601 limited range in 8.8 fixed point:
+ *
+ *   R = 1.164 (Y - 16)                 + 1.596 (V - 128)
+ *   G = 1.164 (Y - 16) - 0.391 (U - 128) - 0.813 (V - 128)
+ *   B = 1.164 (Y - 16) + 2.018 (U - 128)
+ *
+ * All the products and sums fit into 32 bits with the inputs in 16 bits,
+ * which is what lets the SSE2 path use pmaddwd and still give the same
+ * result as the plain C code.
+ */
+#define COEF_Y   298
+#define COEF_RV  409
+#define COEF_GU  -100
+#define COEF_GV  -208
+#define COEF_BU  516
+
+static inline uint32_t
+clamp_u8(int32_t v)
+{
+	if (v < 0)
+		return 0;
+	if (v > 255)
+		return 255;
+	return v;
+}
+
+static inline uint32_t
+yuv_to_xrgb(int32_t y, int32_t u, int32_t v)
+{
+	int32_t c = (y - 16) * COEF_Y + 128;
+	int32_t d = u - 128;
+	int32_t e = v - 128;
+
+	return 0xff000000 |
+	       clamp_u8((c + COEF_RV * e) >> 8) << 16 |
+	       clamp_u8((c + COEF_GU * d + COEF_GV * e) >> 8) << 8 |
+	       clamp_u8((c + COEF_BU * d) >> 8);
+}
+
+void
+yuv_convert_source_init(struct yuv_convert_source *src,
+			enum yuv_convert_format format,
+			const void *data,
+			int32_t width, int32_t height, int32_t stride)
+{
+	memset(src, 0, sizeof *src);
+	src->format = format;
+	src->width = width;
+	src->height = height;
+	src->data = data;
+	src->stride = stride;
+}
+
+/* Converts pixels x0 to x1 - 1 of one row. */
+static void
+convert_row_c(const struct yuv_convert_source *src, int32_t row,
+	      int32_t x0, int32_t x1, uint32_t *dst)
+{
+	const uint8_t *y = src->data + row * src->stride;
+	int32_t x;
+
+	switch (src->format) {
+	case YUV_CONVERT_YUYV:
+		for (x = x0; x < x1; x++)
+			dst[x] = yuv_to_xrgb(y[x * 2], y[(x & ~1) * 2 + 1],
+					     y[(x & ~1) * 2 + 3]);
+		break;
+	}
+}
+
+#ifdef __SSE2__
+
+/* Multiplier pairs for pmaddwd, a goes with the even 16 bit lanes. */
+#define PAIR_EPI16(a, b) _mm_setr_epi16(a, b, a, b, a, b, a, b)
+
+/* Converts 8 pixels starting at an even x. y holds the 8 luma samples
+ * and uv the 4 chroma pairs u0 v0 u1 v1 ... as 16 bit values.
+ */
+static inline void
+convert8_sse2(__m128i y, __m128i uv, uint32_t *dst)
+{
+	const __m128i coef_r = PAIR_EPI16(COEF_Y, COEF_RV);
+	const __m128i coef_b = PAIR_EPI16(COEF_Y, COEF_BU);
+	const __m128i coef_gu = PAIR_EPI16(COEF_Y, COEF_GU);
+	const __m128i coef_gv = PAIR_EPI16(COEF_GV, 128);
+	const __m128i rounding = _mm_set1_epi32(128);
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i d, e, cd_lo, cd_hi, ce_lo, ce_hi, e1_lo, e1_hi;
+	__m128i r_lo, r_hi, g_lo, g_hi, b_lo, b_hi, r, g, b;
+	__m128i bg, ra;
+
+	y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+	uv = _mm_sub_epi16(uv, _mm_set1_epi16(128));
+
+	/* Repeat each chroma sample for the two pixels sharing it. */
+	d = _mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0));
+	d = _mm_shufflehi_epi16(d, _MM_SHUFFLE(2, 2, 0, 0));
+	e = _mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1));
+	e = _mm_shufflehi_epi16(e, _MM_SHUFFLE(3, 3, 1, 1));
+
+	cd_lo = _mm_unpacklo_epi16(y, d);
+	cd_hi = _mm_unpackhi_epi16(y, d);
+	ce_lo = _mm_unpacklo_epi16(y, e);
+	ce_hi = _mm_unpackhi_epi16(y, e);
+	e1_lo = _mm_unpacklo_epi16(e, one);
+	e1_hi = _mm_unpackhi_epi16(e, one);
+
+	r_lo = _mm_add_epi32(_mm_madd_epi16(ce_lo, coef_r), rounding);
+	r_hi = _mm_add_epi32(_mm_madd_epi16(ce_hi, coef_r), rounding);
+	b_lo = _mm_add_epi32(_mm_madd_epi16(cd_lo, coef_b), rounding);
+	b_hi = _mm_add_epi32(_mm_madd_epi16(cd_hi, coef_b), rounding);
+	g_lo = _mm_add_epi32(_mm_madd_epi16(cd_lo, coef_gu),
+			     _mm_madd_epi16(e1_lo, coef_gv));
+	g_hi = _mm_add_epi32(_mm_madd_epi16(cd_hi, coef_gu),
+			     _mm_madd_epi16(e1_hi, coef_gv));
+
+	/* The saturating packs do the clamping to 0..255. */
+	r = _mm_packs_epi32(_mm_srai_epi32(r_lo, 8), _mm_srai_epi32(r_hi, 8));
+	g = _mm_packs_epi32(_mm_srai_epi32(g_lo, 8), _mm_srai_epi32(g_hi, 8));
+	b = _mm_packs_epi32(_mm_srai_epi32(b_lo, 8), _mm_srai_epi32(b_hi, 8));
+	r = _mm_packus_epi16(r, r);
+	g = _mm_packus_epi16(g, g);
+	b = _mm_packus_epi16(b, b);
+
+	bg = _mm_unpacklo_epi8(b, g);
+	ra = _mm_unpacklo_epi8(r, _mm_set1_epi8(-1));
+	_mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *) (dst + 4), _mm_unpackhi_epi16(bg, ra));
+}
+
+static void
+convert_row_sse2(const struct yuv_convert_source *src, int32_t row,
+		 int32_t x0, int32_t x1, uint32_t *dst)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+	const uint8_t *y = src->data + row * src->stride;
+	__m128i packed;
+	int32_t x;
+
+	/* The vector loop needs to start on a chroma sample boundary. */
+	if (x0 & 1) {
+		convert_row_c(src, row, x0, x0 + 1, dst);
+		x0++;
+	}
+
+	switch (src->format) {
+	case YUV_CONVERT_YUYV:
+		for (x = x0; x + 8 <= x1; x += 8) {
+			packed = _mm_loadu_si128((const __m128i *) (y + x * 2));
+			convert8_sse2(_mm_and_si128(packed, low_bytes),
+				      _mm_srli_epi16(packed, 8), dst + x);
+		}
+		break;
+	default:
+		x = x0;
+		break;
+	}
+
+	convert_row_c(src, row, x, x1, dst);
+}
+
+#endif
+
+static void
+convert_rect(const struct yuv_convert_source *src,
+	     uint32_t *dst, int32_t dst_stride,
+	     int32_t x, int32_t y, int32_t width, int32_t height,
+	     void (*convert_row)(const struct yuv_convert_source *src,
+				 int32_t row, int32_t x0, int32_t x1,
+				 uint32_t *dst))
+{
+	int32_t x1 = x + width;
+	int32_t y1 = y + height;
+	int32_t row;
+
+	if (x < 0)
+		x = 0;
+	if (y < 0)
+		y = 0;
+	if (x1 > src->width)
+		x1 = src->width;
+	if (y1 > src->height)
+		y1 = src->height;
+
+	for (row = y; row < y1 && x < x1; row++)
+		convert_row(src, row, x, x1,
+			    (uint32_t *) ((uint8_t *) dst + row * dst_stride));
+}
+
+void
+yuv_convert_rect_c(const struct yuv_convert_source *src,
+		   uint32_t *dst, int32_t dst_stride,
+		   int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	convert_rect(src, dst, dst_stride, x, y, width, height,
+		     convert_row_c);
+}
+
+void
+yuv_convert_rect(const struct yuv_convert_source *src,
+		 uint32_t *dst, int32_t dst_stride,
+		 int32_t x, int32_t y, int32_t width, int32_t height)
+{
+#ifdef __SSE2__
+	convert_rect(src, dst, dst_stride, x, y, width, height,
+		     convert_row_sse2);
+#else
+	convert_rect(src, dst, dst_stride, x, y, width, height,
+		     convert_row_c);
+#endif
+}
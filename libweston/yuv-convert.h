@@ -0,0 +1,69 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_YUV_CONVERT_H
+#define WESTON_YUV_CONVERT_H
+
+#include <stdint.h>
+
+/* Only packed formats, see yuv_format_from_shm() in pixman-renderer.c. */
+enum yuv_convert_format {
+	YUV_CONVERT_YUYV,	/* packed Y0 U Y1 V, 2x1 subsampled */
+};
+
+/* A YUV image laid out in memory the way a wl_shm buffer of the same
+ * format is.
+ */
+struct yuv_convert_source {
+	enum yuv_convert_format format;
+	int32_t width, height;
+	const uint8_t *data;
+	int32_t stride;
+};
+
+void
+yuv_convert_source_init(struct yuv_convert_source *src,
+			enum yuv_convert_format format,
+			const void *data,
+			int32_t width, int32_t height, int32_t stride);
+
+/* Converts the given rectangle of src to XRGB8888 at the same position
+ * in dst, which must be at least as large as src. The colours are
+ * BT.601 limited range. The rectangle is clipped to the source.
+ */
+void
+yuv_convert_rect(const struct yuv_convert_source *src,
+		 uint32_t *dst, int32_t dst_stride,
+		 int32_t x, int32_t y, int32_t width, int32_t height);
+
+/* Same as yuv_convert_rect() but never uses SIMD, the vector paths
+ * produce exactly the same result.
+ */
+void
+yuv_convert_rect_c(const struct yuv_convert_source *src,
+		   uint32_t *dst, int32_t dst_stride,
+		   int32_t x, int32_t y, int32_t width, int32_t height);
+
+#endif
@@ -48,6 +48,21 @@
  *  3  7 11 15
  */
 
+/*
+ * Matrices built only with weston_matrix_translate(), _scale() and
+ * _rotate_xy() have a last row of 0 0 0 1, and their z axis is only
+ * scaled and translated. matrix->type tells which of these were used,
+ * which allows closed forms for the common cases.
+ */
+#define MATRIX_TYPE_AFFINE_XY (WESTON_MATRIX_TRANSFORM_TRANSLATE |	\
+			       WESTON_MATRIX_TRANSFORM_SCALE |		\
+			       WESTON_MATRIX_TRANSFORM_ROTATE)
+
+/* Same threshold as the pivots of the LU decomposition. */
+#define MATRIX_EPSILON 1e-9
+
+typedef float v4sf __attribute__ ((vector_size (16)));
+
 WL_EXPORT void
 weston_matrix_init(struct weston_matrix *matrix)
 {
@@ -118,17 +133,119 @@ WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
 	int i, j;
+	const float *d = matrix->d;
 	struct weston_vector t;
 
-	for (i = 0; i < 4; i++) {
-		t.f[i] = 0;
-		for (j = 0; j < 4; j++)
-			t.f[i] += v->f[j] * matrix->d[i + j * 4];
+	if (matrix->type == 0)
+		return;
+
+	if (!(matrix->type & ~(WESTON_MATRIX_TRANSFORM_TRANSLATE |
+			       WESTON_MATRIX_TRANSFORM_SCALE))) {
+		t.f[0] = v->f[0] * d[0] + v->f[3] * d[12];
+		t.f[1] = v->f[1] * d[5] + v->f[3] * d[13];
+		t.f[2] = v->f[2] * d[10] + v->f[3] * d[14];
+		t.f[3] = v->f[3];
+	} else if (!(matrix->type & ~MATRIX_TYPE_AFFINE_XY)) {
+		t.f[0] = v->f[0] * d[0] + v->f[1] * d[4] + v->f[3] * d[12];
+		t.f[1] = v->f[0] * d[1] + v->f[1] * d[5] + v->f[3] * d[13];
+		t.f[2] = v->f[2] * d[10] + v->f[3] * d[14];
+		t.f[3] = v->f[3];
+	} else {
+		for (i = 0; i < 4; i++) {
+			t.f[i] = 0;
+			for (j = 0; j < 4; j++)
+				t.f[i] += v->f[j] * d[i + j * 4];
+		}
 	}
 
 	*v = t;
 }
 
+static inline v4sf
+v4sf_load(const float *p)
+{
+	v4sf v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline void
+v4sf_store(float *p, v4sf v)
+{
+	memcpy(p, &v, sizeof v);
+}
+
+/** Transform points of the z = 0 plane
+ *
+ * \param matrix The transformation.
+ * \param x The x coordinates, replaced with the transformed ones.
+ * \param y The y coordinates, replaced with the transformed ones.
+ * \param n The number of points.
+ * \return 0 on success, -1 if the w of a point came out close to zero, in
+ * which case the point is set to 0, 0.
+ *
+ * Does the same as weston_matrix_transform() on (x, y, 0, 1) followed by
+ * the division by w, for polygons. Matrices without a perspective part
+ * are done four points at a time, with the vector unit the compiler
+ * targets.
+ */
+WL_EXPORT int
+weston_matrix_transform_xy(const struct weston_matrix *matrix,
+			   float *x, float *y, int n)
+{
+	const float *d = matrix->d;
+	float tx, ty, tw;
+	int i = 0, ret = 0;
+
+	if (matrix->type == 0)
+		return 0;
+
+	if (!(matrix->type & ~MATRIX_TYPE_AFFINE_XY)) {
+		v4sf m0 = { d[0], d[0], d[0], d[0] };
+		v4sf m1 = { d[1], d[1], d[1], d[1] };
+		v4sf m4 = { d[4], d[4], d[4], d[4] };
+		v4sf m5 = { d[5], d[5], d[5], d[5] };
+		v4sf m12 = { d[12], d[12], d[12], d[12] };
+		v4sf m13 = { d[13], d[13], d[13], d[13] };
+		v4sf vx, vy;
+
+		for (; i + 4 <= n; i += 4) {
+			vx = v4sf_load(&x[i]);
+			vy = v4sf_load(&y[i]);
+			v4sf_store(&x[i], vx * m0 + vy * m4 + m12);
+			v4sf_store(&y[i], vx * m1 + vy * m5 + m13);
+		}
+
+		for (; i < n; i++) {
+			tx = x[i] * d[0] + y[i] * d[4] + d[12];
+			ty = x[i] * d[1] + y[i] * d[5] + d[13];
+			x[i] = tx;
+			y[i] = ty;
+		}
+
+		return 0;
+	}
+
+	for (; i < n; i++) {
+		tx = x[i] * d[0] + y[i] * d[4] + d[12];
+		ty = x[i] * d[1] + y[i] * d[5] + d[13];
+		tw = x[i] * d[3] + y[i] * d[7] + d[15];
+
+		if (fabsf(tw) < 1e-6) {
+			x[i] = 0;
+			y[i] = 0;
+			ret = -1;
+			continue;
+		}
+
+		x[i] = tx / tw;
+		y[i] = ty / tw;
+	}
+
+	return ret;
+}
+
 static inline void
 swap_rows(double *a, double *b)
 {
@@ -256,6 +373,65 @@ inverse_transform(const double *LU, const unsigned *p, float *v)
 		v[j] = b[j];
 }
 
+/* Inverse of a matrix of MATRIX_TYPE_AFFINE_XY, in closed form:
+ * the 2x2 upper left block, the z scale, then the translation.
+ * Rejects the same matrices as the LU decomposition would. */
+static int
+matrix_invert_affine_xy(struct weston_matrix *inverse,
+			const struct weston_matrix *matrix)
+{
+	const float *d = matrix->d;
+	double a = d[0], b = d[1], c = d[4], e = d[5];
+	double sz = d[10], tx = d[12], ty = d[13], tz = d[14];
+	double det, pivot;
+	struct weston_matrix r;
+
+	pivot = fmax(fabs(a), fabs(b));
+	det = a * e - b * c;
+	if (pivot < MATRIX_EPSILON || fabs(det) / pivot < MATRIX_EPSILON ||
+	    fabs(sz) < MATRIX_EPSILON)
+		return -1;
+
+	weston_matrix_init(&r);
+	r.d[0] = e / det;
+	r.d[1] = -b / det;
+	r.d[4] = -c / det;
+	r.d[5] = a / det;
+	r.d[10] = 1.0 / sz;
+	r.d[12] = -(e * tx - c * ty) / det;
+	r.d[13] = -(a * ty - b * tx) / det;
+	r.d[14] = -tz / sz;
+	r.type = matrix->type;
+
+	*inverse = r;
+
+	return 0;
+}
+
+static int
+matrix_invert_scale(struct weston_matrix *inverse,
+		    const struct weston_matrix *matrix)
+{
+	const float *d = matrix->d;
+	struct weston_matrix r;
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (fabs(d[i * 5]) < MATRIX_EPSILON)
+			return -1;
+
+	weston_matrix_init(&r);
+	for (i = 0; i < 3; i++) {
+		r.d[i * 5] = 1.0 / d[i * 5];
+		r.d[12 + i] = -(double) d[12 + i] / d[i * 5];
+	}
+	r.type = matrix->type;
+
+	*inverse = r;
+
+	return 0;
+}
+
 WL_EXPORT int
 weston_matrix_invert(struct weston_matrix *inverse,
 		     const struct weston_matrix *matrix)
@@ -264,6 +440,25 @@ weston_matrix_invert(struct weston_matrix *inverse,
 	unsigned perm[4];	/* permutation */
 	unsigned c;
 
+	switch (matrix->type) {
+	case 0:
+		weston_matrix_init(inverse);
+		return 0;
+	case WESTON_MATRIX_TRANSFORM_TRANSLATE:
+		*inverse = *matrix;
+		inverse->d[12] = -matrix->d[12];
+		inverse->d[13] = -matrix->d[13];
+		inverse->d[14] = -matrix->d[14];
+		return 0;
+	case WESTON_MATRIX_TRANSFORM_SCALE:
+	case WESTON_MATRIX_TRANSFORM_SCALE | WESTON_MATRIX_TRANSFORM_TRANSLATE:
+		return matrix_invert_scale(inverse, matrix);
+	default:
+		if (!(matrix->type & ~MATRIX_TYPE_AFFINE_XY))
+			return matrix_invert_affine_xy(inverse, matrix);
+		break;
+	}
+
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
 
@@ -34,6 +34,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
+
 #include "os-compatibility.h"
 
 int
@@ -195,6 +199,36 @@ os_create_anonymous_file(off_t size)
 	return fd;
 }
 
+/*
+ * Create a file of the given size in memory, for sharing with processes
+ * that do not talk Wayland. The name only shows up in /proc/<pid>/fd,
+ * where other processes of the same user can open the file.
+ *
+ * The size of the file is sealed where memfd_create() is supported, so
+ * that nobody can shrink it under the mappings of the others. Otherwise
+ * this falls back to os_create_anonymous_file().
+ */
+int
+os_create_memfd(const char *name, off_t size)
+{
+#ifdef HAVE_MEMFD_CREATE
+	int fd;
+
+	fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		if (ftruncate(fd, size) < 0 ||
+		    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+#endif
+
+	return os_create_anonymous_file(size);
+}
+
 #ifndef HAVE_STRCHRNUL
 char *
 strchrnul(const char *s, int c)
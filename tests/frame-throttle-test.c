@@ -0,0 +1,148 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* Repaints a covered surface over many throttling periods, then uncovers
+ * it, and checks that its throttling state, which the timeline records,
+ * changes with its visibility only. */
+
+#define PERIOD_MSEC 20
+#define TICK_MSEC 5
+#define COVERED_TICKS 40
+#define UNCOVERED_TICKS 20
+
+struct throttle_test {
+	struct weston_compositor *compositor;
+	struct weston_layer layer;
+	struct wl_event_source *timer;
+
+	struct weston_surface *cover;
+	struct weston_surface *hidden;
+	struct weston_view *cover_view;
+
+	int ticks;
+	int changes;
+	bool throttled;
+};
+
+static struct weston_view *
+add_surface(struct throttle_test *test, struct weston_surface **surface,
+	    int x, int y, int width, int height, bool opaque)
+{
+	struct weston_view *view;
+
+	*surface = weston_surface_create(test->compositor);
+	assert(*surface);
+	view = weston_view_create(*surface);
+	assert(view);
+
+	(*surface)->width = width;
+	(*surface)->height = height;
+	if (opaque) {
+		pixman_region32_fini(&(*surface)->opaque);
+		pixman_region32_init_rect(&(*surface)->opaque, 0, 0,
+					  width, height);
+	}
+
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&test->layer.view_list, &view->layer_link);
+
+	return view;
+}
+
+static int
+throttle_timer_handler(void *data)
+{
+	struct throttle_test *test = data;
+
+	if (test->hidden->frame_throttled != test->throttled) {
+		test->throttled = test->hidden->frame_throttled;
+		test->changes++;
+	}
+
+	test->ticks++;
+	if (test->ticks == COVERED_TICKS) {
+		/* Many periods have passed, it only got throttled once. */
+		assert(test->throttled);
+		assert(test->changes == 1);
+
+		weston_view_set_position(test->cover_view, -1000, -1000);
+	}
+
+	if (test->ticks < COVERED_TICKS + UNCOVERED_TICKS) {
+		weston_surface_damage(test->hidden);
+		wl_event_source_timer_update(test->timer, TICK_MSEC);
+		return 0;
+	}
+
+	assert(!test->throttled);
+	assert(test->changes == 2);
+
+	weston_surface_destroy(test->cover);
+	weston_surface_destroy(test->hidden);
+
+	wl_event_source_remove(test->timer);
+	wl_list_remove(&test->layer.link);
+	wl_display_terminate(test->compositor->wl_display);
+	free(test);
+
+	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct throttle_test *test;
+
+	test = zalloc(sizeof *test);
+	assert(test);
+	test->compositor = compositor;
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	compositor->occluded_frame_msec = PERIOD_MSEC;
+
+	/* Bottom to top. */
+	add_surface(test, &test->hidden, 50, 50, 100, 100, false);
+	test->cover_view = add_surface(test, &test->cover, 0, 0, 200, 200,
+				       true);
+
+	weston_compositor_schedule_repaint(compositor);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	test->timer = wl_event_loop_add_timer(loop, throttle_timer_handler,
+					      test);
+	wl_event_source_timer_update(test->timer, TICK_MSEC);
+
+	return 0;
+}
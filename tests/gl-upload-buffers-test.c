@@ -0,0 +1,194 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "shared/helpers.h"
+#include "weston-test-client-helper.h"
+#include "weston-stats-client-protocol.h"
+
+/* gl-upload-buffers.ini turns the upload buffers on. The other renderers
+ * upload nothing, so the test only runs on a backend using GL. */
+
+struct upload_sample {
+	uint64_t upload_bytes;
+	bool done;
+};
+
+static void
+report_compositor(void *data, struct weston_stats_report *report,
+		  uint32_t upload_bytes_hi, uint32_t upload_bytes_lo,
+		  uint32_t commits)
+{
+	struct upload_sample *sample = data;
+
+	sample->upload_bytes = (uint64_t) upload_bytes_hi << 32 |
+			       upload_bytes_lo;
+}
+
+static void
+report_output(void *data, struct weston_stats_report *report,
+	      const char *name, int32_t refresh, uint32_t repaints,
+	      uint32_t frames_presented, uint32_t vblanks_missed,
+	      uint32_t views, uint32_t plane_views,
+	      uint32_t plane_cache_hits, uint32_t plane_cache_misses,
+	      struct wl_array *histogram)
+{
+}
+
+static void
+report_client(void *data, struct weston_stats_report *report,
+	      int32_t pid, uint32_t commits)
+{
+}
+
+static void
+report_done(void *data, struct weston_stats_report *report)
+{
+	struct upload_sample *sample = data;
+
+	sample->done = true;
+}
+
+static const struct weston_stats_report_listener report_listener = {
+	report_compositor,
+	report_output,
+	report_client,
+	report_done
+};
+
+static struct weston_stats *
+get_stats(struct client *client)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, weston_stats_interface.name) == 0)
+			return wl_registry_bind(client->wl_registry, g->name,
+						&weston_stats_interface, 1);
+	}
+
+	assert(0 && "no weston_stats, is performance-stats set?");
+	return NULL;
+}
+
+static uint64_t
+sample_upload_bytes(struct client *client, struct weston_stats *stats)
+{
+	struct weston_stats_report *report;
+	struct upload_sample sample = { 0, false };
+
+	report = weston_stats_sample(stats);
+	weston_stats_report_add_listener(report, &report_listener, &sample);
+	while (!sample.done)
+		assert(wl_display_dispatch(client->wl_display) >= 0);
+
+	/* The compositor destroys the report after done. */
+	weston_stats_report_destroy(report);
+
+	return sample.upload_bytes;
+}
+
+static void
+fill_rect(struct buffer *buffer, int x, int y, int width, int height,
+	  uint32_t argb)
+{
+	pixman_color_t color;
+	pixman_image_t *solid;
+
+	color.alpha = ((argb >> 24) & 0xff) * 0x101;
+	color.red = ((argb >> 16) & 0xff) * 0x101;
+	color.green = ((argb >> 8) & 0xff) * 0x101;
+	color.blue = (argb & 0xff) * 0x101;
+
+	solid = pixman_image_create_solid_fill(&color);
+	pixman_image_composite32(PIXMAN_OP_SRC, solid, NULL, buffer->image,
+				 0, 0, 0, 0, x, y, width, height);
+	pixman_image_unref(solid);
+}
+
+static uint32_t
+screen_pixel(struct client *client, int x, int y)
+{
+	struct buffer *screenshot;
+	uint32_t *pixels;
+	uint32_t pixel;
+	int stride;
+
+	screenshot = capture_screenshot_of_output(client);
+	pixels = pixman_image_get_data(screenshot->image);
+	stride = pixman_image_get_stride(screenshot->image);
+	pixel = pixels[y * stride / 4 + x] & 0xffffff;
+	buffer_destroy(screenshot);
+
+	return pixel;
+}
+
+TEST(shm_damage_through_upload_buffers)
+{
+	struct client *client;
+	struct surface *surface;
+	struct weston_stats *stats;
+	uint64_t before, after;
+	int i, done;
+
+	client = create_client_and_test_surface(0, 0, 64, 64);
+	assert(client);
+	surface = client->surface;
+	stats = get_stats(client);
+
+	fill_rect(surface->buffer, 0, 0, 64, 64, 0xff0000ff);
+	move_client(client, 0, 0);
+
+	before = sample_upload_bytes(client, stats);
+	if (before == 0)
+		skip("the renderer does not upload wl_shm buffers\n");
+
+	/* More commits than upload buffers, so that the ring wraps. */
+	for (i = 0; i < 6; i++) {
+		fill_rect(surface->buffer, 8 * i, 8, 8, 16, 0xff00ff00);
+		wl_surface_attach(surface->wl_surface, surface->buffer->proxy,
+				  0, 0);
+		wl_surface_damage(surface->wl_surface, 8 * i, 8, 8, 16);
+		frame_callback_set(surface->wl_surface, &done);
+		wl_surface_commit(surface->wl_surface);
+		frame_callback_wait(client, &done);
+	}
+
+	after = sample_upload_bytes(client, stats);
+	assert(after - before >= 6 * 8 * 16 * 4);
+
+	/* The damage made it to the texture, the rest stayed. */
+	assert(screen_pixel(client, 4, 12) == 0x00ff00);
+	assert(screen_pixel(client, 44, 20) == 0x00ff00);
+	assert(screen_pixel(client, 52, 12) == 0x0000ff);
+	assert(screen_pixel(client, 4, 40) == 0x0000ff);
+
+	weston_stats_destroy(stats);
+}
@@ -31,7 +31,10 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <assert.h>
+#include <string.h>
 
+#include "shared/helpers.h"
 #include "shared/matrix.h"
 
 struct inverse_matrix {
@@ -182,6 +185,173 @@ randomize_matrix(struct weston_matrix *m)
 #else
 		m->d[i] = frand();
 #endif
+	m->type = WESTON_MATRIX_TRANSFORM_OTHER;
+}
+
+/* A random matrix built with the operations named in type, so that
+ * weston_matrix_invert() and _transform() take their fast paths. */
+static void
+randomize_typed_matrix(struct weston_matrix *m, unsigned type)
+{
+	double a;
+
+	weston_matrix_init(m);
+
+	if (type & WESTON_MATRIX_TRANSFORM_SCALE)
+		weston_matrix_scale(m, (0.25 + 4.0 * fabs(frand())) *
+					(random() & 1 ? 1 : -1),
+				    0.25 + 4.0 * fabs(frand()),
+				    0.25 + 4.0 * fabs(frand()));
+	if (type & WESTON_MATRIX_TRANSFORM_ROTATE) {
+		a = M_PI * frand();
+		weston_matrix_rotate_xy(m, cos(a), sin(a));
+	}
+	if (type & WESTON_MATRIX_TRANSFORM_TRANSLATE)
+		weston_matrix_translate(m, 2000.0 * frand(), 2000.0 * frand(),
+					10.0 * frand());
+}
+
+static const unsigned matrix_types[] = {
+	WESTON_MATRIX_TRANSFORM_TRANSLATE,
+	WESTON_MATRIX_TRANSFORM_SCALE,
+	WESTON_MATRIX_TRANSFORM_SCALE | WESTON_MATRIX_TRANSFORM_TRANSLATE,
+	WESTON_MATRIX_TRANSFORM_ROTATE | WESTON_MATRIX_TRANSFORM_TRANSLATE,
+	WESTON_MATRIX_TRANSFORM_SCALE | WESTON_MATRIX_TRANSFORM_ROTATE |
+		WESTON_MATRIX_TRANSFORM_TRANSLATE,
+	WESTON_MATRIX_TRANSFORM_OTHER,
+};
+
+static const char *
+matrix_type_name(unsigned type)
+{
+	static char name[32];
+
+	if (type & WESTON_MATRIX_TRANSFORM_OTHER)
+		return "general";
+
+	snprintf(name, sizeof name, "%s%s%s",
+		 type & WESTON_MATRIX_TRANSFORM_TRANSLATE ? "T" : "",
+		 type & WESTON_MATRIX_TRANSFORM_SCALE ? "S" : "",
+		 type & WESTON_MATRIX_TRANSFORM_ROTATE ? "R" : "");
+
+	return name;
+}
+
+/* weston_matrix_transform() without the fast paths. */
+static void
+reference_transform(const struct weston_matrix *m, struct weston_vector *v)
+{
+	struct weston_vector t;
+	int i, j;
+
+	for (i = 0; i < 4; i++) {
+		t.f[i] = 0;
+		for (j = 0; j < 4; j++)
+			t.f[i] += v->f[j] * m->d[i + j * 4];
+	}
+
+	*v = t;
+}
+
+/* weston_matrix_invert() without the fast paths. */
+static int
+reference_invert(struct weston_matrix *inverse,
+		 const struct weston_matrix *m)
+{
+	struct inverse_matrix q;
+	unsigned c;
+
+	if (matrix_invert(q.LU, q.perm, m) < 0)
+		return -1;
+
+	weston_matrix_init(inverse);
+	for (c = 0; c < 4; ++c)
+		inverse_transform(q.LU, q.perm, &inverse->d[c * 4]);
+	inverse->type = m->type;
+
+	return 0;
+}
+
+static double
+relative_error(double value, double reference)
+{
+	return fabs(value - reference) / fmax(1.0, fabs(reference));
+}
+
+/* Compare the fast paths against the generic code, return the number of
+ * matrix types that do not match. */
+static int
+test_fast_paths(void)
+{
+	struct weston_matrix m, inv, ref;
+	struct weston_vector v, w;
+	float x[8], y[8], rx[8], ry[8];
+	double err_inv, err_tf, err_xy;
+	int failed = 0;
+	unsigned t, i, k;
+
+	printf("\nComparing type specific paths to the generic ones...\n");
+
+	for (t = 0; t < ARRAY_LENGTH(matrix_types); t++) {
+		err_inv = err_tf = err_xy = 0.0;
+
+		for (i = 0; i < 100000; i++) {
+			if (matrix_types[t] & WESTON_MATRIX_TRANSFORM_OTHER)
+				randomize_matrix(&m);
+			else
+				randomize_typed_matrix(&m, matrix_types[t]);
+
+			if (reference_invert(&ref, &m) == 0) {
+				assert(weston_matrix_invert(&inv, &m) == 0);
+				for (k = 0; k < 16; k++)
+					err_inv = fmax(err_inv,
+						relative_error(inv.d[k],
+							       ref.d[k]));
+			}
+
+			for (k = 0; k < 4; k++)
+				v.f[k] = 1000.0 * frand();
+			w = v;
+			weston_matrix_transform(&m, &v);
+			reference_transform(&m, &w);
+			for (k = 0; k < 4; k++)
+				err_tf = fmax(err_tf,
+					      relative_error(v.f[k], w.f[k]));
+
+			if (matrix_types[t] & WESTON_MATRIX_TRANSFORM_OTHER)
+				continue;
+
+			for (k = 0; k < ARRAY_LENGTH(x); k++) {
+				x[k] = 1000.0 * frand();
+				y[k] = 1000.0 * frand();
+
+				w.f[0] = x[k];
+				w.f[1] = y[k];
+				w.f[2] = 0.0f;
+				w.f[3] = 1.0f;
+				reference_transform(&m, &w);
+				rx[k] = w.f[0] / w.f[3];
+				ry[k] = w.f[1] / w.f[3];
+			}
+
+			weston_matrix_transform_xy(&m, x, y, ARRAY_LENGTH(x));
+			for (k = 0; k < ARRAY_LENGTH(x); k++) {
+				err_xy = fmax(err_xy, relative_error(x[k], rx[k]));
+				err_xy = fmax(err_xy, relative_error(y[k], ry[k]));
+			}
+		}
+
+		printf("%8s: invert error %g, transform error %g, "
+		       "polygon error %g\n", matrix_type_name(matrix_types[t]),
+		       err_inv, err_tf, err_xy);
+
+		if (err_inv > 1e-5 || err_tf > 1e-5 || err_xy > 1e-5) {
+			printf("test fail\n");
+			failed++;
+		}
+	}
+
+	return failed;
 }
 
 /* Take a matrix, compute inverse, multiply together
@@ -243,7 +413,7 @@ test(void)
 	return TEST_FAIL;
 }
 
-static int running;
+static volatile sig_atomic_t running;
 static void
 stopme(int n)
 {
@@ -274,18 +444,21 @@ static void __attribute__((noinline))
 test_loop_speed_matrixvector(void)
 {
 	struct weston_matrix m;
-	struct weston_vector v = { { 0.5, 0.5, 0.5, 1.0 } };
+	const struct weston_vector v0 = { { 0.5, 0.5, 0.5, 1.0 } };
+	struct weston_vector v;
 	unsigned long count = 0;
 	double t;
 
 	printf("\nRunning 3 s test on weston_matrix_transform()...\n");
 
-	weston_matrix_init(&m);
+	/* A general matrix; identity would only time the early return. */
+	randomize_matrix(&m);
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
+		v = v0;
 		weston_matrix_transform(&m, &v);
 		count++;
 	}
@@ -300,19 +473,22 @@ test_loop_speed_inversetransform(void)
 {
 	struct weston_matrix m;
 	struct inverse_matrix inv;
-	struct weston_vector v = { { 0.5, 0.5, 0.5, 1.0 } };
+	const struct weston_vector v0 = { { 0.5, 0.5, 0.5, 1.0 } };
+	struct weston_vector v;
 	unsigned long count = 0;
 	double t;
 
 	printf("\nRunning 3 s test on inverse_transform()...\n");
 
-	weston_matrix_init(&m);
-	matrix_invert(inv.LU, inv.perm, &m);
+	do
+		randomize_matrix(&m);
+	while (matrix_invert(inv.LU, inv.perm, &m) < 0);
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
+		v = v0;
 		inverse_transform(inv.LU, inv.perm, v.f);
 		count++;
 	}
@@ -332,7 +508,7 @@ test_loop_speed_invert(void)
 
 	printf("\nRunning 3 s test on matrix_invert()...\n");
 
-	weston_matrix_init(&m);
+	randomize_matrix(&m);
 
 	running = 1;
 	alarm(3);
@@ -350,19 +526,19 @@ test_loop_speed_invert(void)
 static void __attribute__((noinline))
 test_loop_speed_invert_explicit(void)
 {
-	struct weston_matrix m;
+	struct weston_matrix m, inv;
 	unsigned long count = 0;
 	double t;
 
 	printf("\nRunning 3 s test on weston_matrix_invert()...\n");
 
-	weston_matrix_init(&m);
+	randomize_matrix(&m);
 
 	running = 1;
 	alarm(3);
 	reset_timer();
 	while (running) {
-		weston_matrix_invert(&m, &m);
+		weston_matrix_invert(&inv, &m);
 		count++;
 	}
 	t = read_timer();
@@ -371,11 +547,103 @@ test_loop_speed_invert_explicit(void)
 	       count, t, 1e9 * t / count);
 }
 
+static void __attribute__((noinline))
+test_loop_speed_typed(unsigned type)
+{
+	struct weston_matrix m, inv;
+	const struct weston_vector v0 = { { 0.5, 0.5, 0.5, 1.0 } };
+	struct weston_vector v;
+	unsigned long count;
+	double t_inv, t_tf;
+
+	if (type & WESTON_MATRIX_TRANSFORM_OTHER)
+		randomize_matrix(&m);
+	else
+		randomize_typed_matrix(&m, type);
+
+	running = 1;
+	count = 0;
+	alarm(1);
+	reset_timer();
+	while (running) {
+		weston_matrix_invert(&inv, &m);
+		count++;
+	}
+	t_inv = 1e9 * read_timer() / count;
+
+	running = 1;
+	count = 0;
+	alarm(1);
+	reset_timer();
+	while (running) {
+		/* Start over, so the values do not drift into denormals. */
+		v = v0;
+		weston_matrix_transform(&m, &v);
+		count++;
+	}
+	t_tf = 1e9 * read_timer() / count;
+
+	printf("%8s: invert %.1f ns, transform %.1f ns\n",
+	       matrix_type_name(type), t_inv, t_tf);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_polygon(unsigned type)
+{
+	struct weston_matrix m;
+	struct weston_vector v;
+	float x0[8], y0[8], x[8], y[8];
+	unsigned long count;
+	double t_batch, t_single;
+	int i;
+
+	randomize_typed_matrix(&m, type);
+	for (i = 0; i < 8; i++) {
+		x0[i] = 100.0f * i;
+		y0[i] = 50.0f * i;
+	}
+
+	running = 1;
+	count = 0;
+	alarm(1);
+	reset_timer();
+	while (running) {
+		memcpy(x, x0, sizeof x);
+		memcpy(y, y0, sizeof y);
+		weston_matrix_transform_xy(&m, x, y, 8);
+		count++;
+	}
+	t_batch = 1e9 * read_timer() / count;
+
+	/* What the renderer did before, point by point. */
+	running = 1;
+	count = 0;
+	alarm(1);
+	reset_timer();
+	while (running) {
+		for (i = 0; i < 8; i++) {
+			v.f[0] = x0[i];
+			v.f[1] = y0[i];
+			v.f[2] = 0.0f;
+			v.f[3] = 1.0f;
+			reference_transform(&m, &v);
+			x[i] = v.f[0] / v.f[3];
+			y[i] = v.f[1] / v.f[3];
+		}
+		count++;
+	}
+	t_single = 1e9 * read_timer() / count;
+
+	printf("%8s: 8 vertex polygon %.1f ns, point by point %.1f ns\n",
+	       matrix_type_name(type), t_batch, t_single);
+}
+
 int main(void)
 {
 	struct sigaction ding;
 	struct weston_matrix M;
 	struct inverse_matrix Q;
+	unsigned i;
 	int ret;
 	double errsup;
 	double det;
@@ -414,11 +682,22 @@ int main(void)
 	print_matrix(&M);
 	printf("max abs error: %g, original determinant %g\n", errsup, det);
 
+	if (test_fast_paths() != 0)
+		return 1;
+
 	test_loop_precision();
 	test_loop_speed_matrixvector();
 	test_loop_speed_inversetransform();
 	test_loop_speed_invert();
 	test_loop_speed_invert_explicit();
 
+	printf("\nRunning 1 s tests per matrix type...\n");
+	for (i = 0; i < ARRAY_LENGTH(matrix_types); i++)
+		test_loop_speed_typed(matrix_types[i]);
+	test_loop_speed_polygon(WESTON_MATRIX_TRANSFORM_TRANSLATE);
+	test_loop_speed_polygon(WESTON_MATRIX_TRANSFORM_SCALE |
+				WESTON_MATRIX_TRANSFORM_ROTATE |
+				WESTON_MATRIX_TRANSFORM_TRANSLATE);
+
 	return 0;
 }
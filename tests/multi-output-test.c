@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2014 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "shared/helpers.h"
+#include "shared/xalloc.h"
+#include "weston-test-client-helper.h"
+
+/* The outputs themselves are configured in multi-output.ini. */
+char *server_parameters = "--output-count=3";
+
+struct test_output {
+	struct wl_list link;
+	uint32_t global;
+	struct wl_output *wl_output;
+	int x, y;
+	int width, height;	/* current mode */
+	int scale;
+	int transform;
+};
+
+struct outputs {
+	struct wl_registry *registry;
+	struct wl_list list;
+};
+
+static void
+output_handle_geometry(void *data, struct wl_output *wl_output,
+		       int x, int y, int physical_width, int physical_height,
+		       int subpixel, const char *make, const char *model,
+		       int transform)
+{
+	struct test_output *output = data;
+
+	output->x = x;
+	output->y = y;
+	output->transform = transform;
+}
+
+static void
+output_handle_mode(void *data, struct wl_output *wl_output, uint32_t flags,
+		   int width, int height, int refresh)
+{
+	struct test_output *output = data;
+
+	if (flags & WL_OUTPUT_MODE_CURRENT) {
+		output->width = width;
+		output->height = height;
+	}
+}
+
+static void
+output_handle_done(void *data, struct wl_output *wl_output)
+{
+}
+
+static void
+output_handle_scale(void *data, struct wl_output *wl_output, int scale)
+{
+	struct test_output *output = data;
+
+	output->scale = scale;
+}
+
+static const struct wl_output_listener output_listener = {
+	output_handle_geometry,
+	output_handle_mode,
+	output_handle_done,
+	output_handle_scale,
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry,
+	      uint32_t id, const char *interface, uint32_t version)
+{
+	struct outputs *outputs = data;
+	struct test_output *output;
+
+	if (strcmp(interface, "wl_output") != 0)
+		return;
+
+	output = xzalloc(sizeof *output);
+	output->global = id;
+	output->scale = 1;
+	output->wl_output = wl_registry_bind(registry, id,
+					     &wl_output_interface, 2);
+	wl_output_add_listener(output->wl_output, &output_listener, output);
+	wl_list_insert(outputs->list.prev, &output->link);
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t id)
+{
+	struct outputs *outputs = data;
+	struct test_output *output;
+
+	wl_list_for_each(output, &outputs->list, link) {
+		if (output->global == id) {
+			wl_output_destroy(output->wl_output);
+			wl_list_remove(&output->link);
+			free(output);
+			return;
+		}
+	}
+}
+
+static const struct wl_registry_listener registry_listener = {
+	handle_global,
+	handle_global_remove
+};
+
+static struct outputs *
+outputs_create(struct client *client)
+{
+	struct outputs *outputs;
+
+	outputs = xzalloc(sizeof *outputs);
+	wl_list_init(&outputs->list);
+	outputs->registry = wl_display_get_registry(client->wl_display);
+	wl_registry_add_listener(outputs->registry, &registry_listener,
+				 outputs);
+
+	/* One roundtrip for the globals, one for the output events. */
+	client_roundtrip(client);
+	client_roundtrip(client);
+
+	return outputs;
+}
+
+static struct test_output *
+output_at(struct outputs *outputs, int x)
+{
+	struct test_output *output;
+
+	wl_list_for_each(output, &outputs->list, link)
+		if (output->x == x && output->y == 0)
+			return output;
+
+	return NULL;
+}
+
+static void
+assert_output(struct outputs *outputs, int x, int width, int height,
+	      int scale, int transform)
+{
+	struct test_output *output = output_at(outputs, x);
+
+	assert(output);
+	assert(output->width == width);
+	assert(output->height == height);
+	assert(output->scale == scale);
+	assert(output->transform == transform);
+}
+
+TEST(multi_output_startup)
+{
+	struct client *client;
+	struct outputs *outputs;
+
+	client = create_client();
+	outputs = outputs_create(client);
+
+	/* Outputs are laid out left to right in logical pixels. */
+	assert(wl_list_length(&outputs->list) == 3);
+	assert_output(outputs, 0, 640, 480, 1, WL_OUTPUT_TRANSFORM_NORMAL);
+	assert_output(outputs, 640, 640, 480, 2, WL_OUTPUT_TRANSFORM_NORMAL);
+	assert_output(outputs, 960, 300, 200, 1, WL_OUTPUT_TRANSFORM_90);
+}
+
+TEST(multi_output_hotplug)
+{
+	struct client *client;
+	struct outputs *outputs;
+
+	client = create_client();
+	outputs = outputs_create(client);
+	assert(wl_list_length(&outputs->list) == 3);
+
+	weston_test_output_add(client->test->weston_test, "headless-hotplug");
+	client_roundtrip(client);
+	client_roundtrip(client);
+	assert(wl_list_length(&outputs->list) == 4);
+	assert_output(outputs, 1160, 100, 100, 1, WL_OUTPUT_TRANSFORM_NORMAL);
+
+	/* The outputs right of an unplugged one move over. */
+	weston_test_output_remove(client->test->weston_test, "headless1");
+	client_roundtrip(client);
+	client_roundtrip(client);
+	assert(wl_list_length(&outputs->list) == 3);
+	assert_output(outputs, 640, 300, 200, 1, WL_OUTPUT_TRANSFORM_90);
+	assert_output(outputs, 840, 100, 100, 1, WL_OUTPUT_TRANSFORM_NORMAL);
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdbool.h>
+
+#include "weston-test-client-helper.h"
+
+/* The default no-op renderer keeps no buffer references of its own, so
+ * the core reference decides when a wl_buffer is released. It is dropped
+ * once the damage has been flushed to the renderer, and held while the
+ * upload is deferred. */
+
+struct cover {
+	struct wl_surface *wl_surface;
+	struct buffer *buffer;
+};
+
+static void
+buffer_release_handler(void *data, struct wl_buffer *buffer)
+{
+	bool *released = data;
+
+	*released = true;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release_handler
+};
+
+static void
+fill(struct buffer *buffer, uint32_t argb)
+{
+	pixman_color_t color;
+	pixman_image_t *solid;
+
+	color.alpha = ((argb >> 24) & 0xff) * 0x101;
+	color.red = ((argb >> 16) & 0xff) * 0x101;
+	color.green = ((argb >> 8) & 0xff) * 0x101;
+	color.blue = (argb & 0xff) * 0x101;
+
+	solid = pixman_image_create_solid_fill(&color);
+	pixman_image_composite32(PIXMAN_OP_SRC, solid, NULL, buffer->image,
+				 0, 0, 0, 0, 0, 0,
+				 pixman_image_get_width(buffer->image),
+				 pixman_image_get_height(buffer->image));
+	pixman_image_unref(solid);
+}
+
+/* Moves the cover, and waits for a repaint that has seen every commit
+ * made before. */
+static void
+move_cover(struct client *client, struct cover *cover, int x, int y)
+{
+	int done;
+
+	weston_test_move_surface(client->test->weston_test, cover->wl_surface,
+				 x, y);
+	wl_surface_attach(cover->wl_surface, cover->buffer->proxy, 0, 0);
+	wl_surface_damage(cover->wl_surface, 0, 0, 200, 200);
+	frame_callback_set(cover->wl_surface, &done);
+	wl_surface_commit(cover->wl_surface);
+	frame_callback_wait(client, &done);
+}
+
+TEST(occluded_shm_upload_is_deferred)
+{
+	struct client *client;
+	struct surface *surface;
+	struct cover cover;
+	struct wl_region *region;
+	struct buffer *buffer;
+	bool released = false;
+
+	client = create_client_and_test_surface(50, 50, 100, 100);
+	assert(client);
+	surface = client->surface;
+
+	/* An opaque cover above the whole test surface. */
+	cover.wl_surface = wl_compositor_create_surface(client->wl_compositor);
+	cover.buffer = create_shm_buffer_a8r8g8b8(client, 200, 200);
+	fill(cover.buffer, 0xff0000ff);
+	region = wl_compositor_create_region(client->wl_compositor);
+	wl_region_add(region, 0, 0, 200, 200);
+	wl_surface_set_opaque_region(cover.wl_surface, region);
+	wl_region_destroy(region);
+	move_cover(client, &cover, 0, 0);
+
+	/* Commit new content, and more damage, while covered. */
+	buffer = create_shm_buffer_a8r8g8b8(client, 100, 100);
+	wl_buffer_add_listener(buffer->proxy, &buffer_listener, &released);
+	fill(buffer, 0xff00ff00);
+	wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0, 100, 100);
+	wl_surface_commit(surface->wl_surface);
+	move_cover(client, &cover, 0, 0);
+
+	wl_surface_damage(surface->wl_surface, 10, 10, 20, 20);
+	wl_surface_commit(surface->wl_surface);
+	move_cover(client, &cover, 0, 0);
+	wl_display_roundtrip(client->wl_display);
+
+	/* Not flushed: the core still holds the buffer. */
+	assert(!released);
+
+	/* Uncovering repaints the surface, and flushes the damage. */
+	move_cover(client, &cover, 300, 300);
+	wl_display_roundtrip(client->wl_display);
+	assert(released);
+
+	/* Now visible, later commits are flushed right away. */
+	released = false;
+	wl_surface_attach(surface->wl_surface, buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, 0, 0, 100, 100);
+	wl_surface_commit(surface->wl_surface);
+	move_cover(client, &cover, 300, 300);
+	wl_display_roundtrip(client->wl_display);
+	assert(released);
+}
+
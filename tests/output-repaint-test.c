@@ -0,0 +1,305 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "windowed-output-api.h"
+#include "shared/helpers.h"
+
+/* Adds headless outputs next to the default one, stacks many views on the
+ * first output and a single view on each of the others, then checks and
+ * times the per-output view lists while the outputs repaint.
+ */
+
+#define EXTRA_OUTPUTS 3
+#define MAX_OUTPUTS (EXTRA_OUTPUTS + 1)
+#define VIEW_COUNT 4000
+#define FRAMES 60
+
+struct bench_output {
+	struct weston_output *output;
+	int (*repaint)(struct weston_output *output,
+		       pixman_region32_t *damage);
+	int frames;
+	double repaint_ns;
+	double visible_walk_ns;
+	double full_walk_ns;
+};
+
+struct repaint_bench {
+	struct weston_compositor *compositor;
+	struct weston_layer layer;
+	struct wl_event_source *timer;
+
+	struct weston_surface *surfaces[VIEW_COUNT + MAX_OUTPUTS];
+	int surface_count;
+
+	struct bench_output outputs[MAX_OUTPUTS];
+	int output_count;
+};
+
+static struct repaint_bench *bench;
+
+static double
+timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1e9 + (a->tv_nsec - b->tv_nsec);
+}
+
+static struct bench_output *
+bench_output_get(struct weston_output *output)
+{
+	int i;
+
+	for (i = 0; i < bench->output_count; i++)
+		if (bench->outputs[i].output == output)
+			return &bench->outputs[i];
+
+	assert(0);
+	return NULL;
+}
+
+static bool
+view_is_on(struct weston_view *view, struct weston_output *output)
+{
+	return (view->output_mask & (1u << output->id)) ||
+		view->output == output;
+}
+
+/* The visible view list must be the view list filtered by output. */
+static void
+check_visible_views(struct weston_output *output)
+{
+	struct weston_view *view, **slot;
+	size_t i = 0, count;
+
+	slot = output->visible_views.data;
+	count = output->visible_views.size / sizeof *slot;
+	wl_list_for_each(view, &output->compositor->view_list, link) {
+		if (!view_is_on(view, output))
+			continue;
+
+		assert(i < count);
+		assert(slot[i] == view);
+		i++;
+	}
+
+	assert(i == count);
+}
+
+/* What the renderer and the frame callback collection walk per repaint,
+ * with and without the per-output list. */
+static int
+walk_visible(struct weston_output *output)
+{
+	struct weston_view **view;
+	int n = 0;
+
+	wl_array_for_each(view, &output->visible_views)
+		if ((*view)->plane == &output->compositor->primary_plane)
+			n++;
+
+	return n;
+}
+
+static int
+walk_full(struct weston_output *output)
+{
+	struct weston_view *view;
+	int n = 0;
+
+	wl_list_for_each_reverse(view, &output->compositor->view_list, link)
+		if (view_is_on(view, output) &&
+		    view->plane == &output->compositor->primary_plane)
+			n++;
+
+	return n;
+}
+
+static int
+bench_repaint(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct bench_output *bo = bench_output_get(output);
+	struct timespec t0, t1, t2;
+	int r;
+
+	check_visible_views(output);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	r = walk_visible(output);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	assert(walk_full(output) == r);
+	clock_gettime(CLOCK_MONOTONIC, &t2);
+
+	bo->visible_walk_ns += timespec_diff_ns(&t1, &t0);
+	bo->full_walk_ns += timespec_diff_ns(&t2, &t1);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	r = bo->repaint(output, damage);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	bo->repaint_ns += timespec_diff_ns(&t1, &t0);
+	bo->frames++;
+
+	return r;
+}
+
+static void
+bench_add_view(int x, int y, int width, int height)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(bench->compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+
+	surface->width = width;
+	surface->height = height;
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&bench->layer.view_list, &view->layer_link);
+
+	bench->surfaces[bench->surface_count++] = surface;
+}
+
+static void
+bench_populate(void)
+{
+	struct weston_output *output, *first;
+	int i;
+
+	first = container_of(bench->compositor->output_list.next,
+			     struct weston_output, link);
+
+	for (i = 0; i < VIEW_COUNT; i++)
+		bench_add_view(first->x + random() % (first->width - 64),
+			       first->y + random() % (first->height - 64),
+			       16 + random() % 48, 16 + random() % 48);
+
+	wl_list_for_each(output, &bench->compositor->output_list, link) {
+		if (output != first)
+			bench_add_view(output->x + 10, output->y + 10, 64, 64);
+	}
+}
+
+static void
+bench_finish(void)
+{
+	struct bench_output *bo;
+	int i;
+
+	for (i = 0; i < bench->output_count; i++) {
+		bo = &bench->outputs[i];
+		bo->output->repaint = bo->repaint;
+
+		fprintf(stderr, "output %s: %zu views, repaint %.1f us, "
+			"view walk %.1f us, full list walk %.1f us\n",
+			bo->output->name,
+			bo->output->visible_views.size /
+			sizeof(struct weston_view *),
+			bo->repaint_ns / bo->frames / 1000.0,
+			bo->visible_walk_ns / bo->frames / 1000.0,
+			bo->full_walk_ns / bo->frames / 1000.0);
+	}
+
+	for (i = 0; i < bench->surface_count; i++)
+		weston_surface_destroy(bench->surfaces[i]);
+
+	wl_event_source_remove(bench->timer);
+	wl_list_remove(&bench->layer.link);
+	wl_display_terminate(bench->compositor->wl_display);
+	free(bench);
+	bench = NULL;
+}
+
+static int
+bench_timer_handler(void *data)
+{
+	int i;
+
+	for (i = 0; i < bench->output_count; i++)
+		if (bench->outputs[i].frames < FRAMES)
+			break;
+
+	if (i == bench->output_count) {
+		bench_finish();
+		return 0;
+	}
+
+	weston_compositor_damage_all(bench->compositor);
+	wl_event_source_timer_update(bench->timer, 20);
+
+	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	const struct weston_windowed_output_api *api;
+	struct weston_output *output;
+	struct wl_event_loop *loop;
+	char name[32];
+	int i;
+
+	api = weston_windowed_output_get_api(compositor);
+	assert(api);
+
+	for (i = 0; i < EXTRA_OUTPUTS; i++) {
+		snprintf(name, sizeof name, "bench-%d", i + 1);
+		assert(api->output_create(compositor, name) == 0);
+	}
+
+	bench = zalloc(sizeof *bench);
+	assert(bench);
+	bench->compositor = compositor;
+	weston_layer_init(&bench->layer, &compositor->cursor_layer.link);
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		assert(bench->output_count < MAX_OUTPUTS);
+		bench->outputs[bench->output_count].output = output;
+		bench->outputs[bench->output_count].repaint = output->repaint;
+		output->repaint = bench_repaint;
+		bench->output_count++;
+	}
+	assert(bench->output_count == MAX_OUTPUTS);
+
+	srandom(7);
+	bench_populate();
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	bench->timer = wl_event_loop_add_timer(loop, bench_timer_handler,
+					       NULL);
+	wl_event_source_timer_update(bench->timer, 1);
+
+	return 0;
+}
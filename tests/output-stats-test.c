@@ -0,0 +1,146 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* Checks the performance counters of an output over a number of
+ * repaints of a few damaged views. */
+
+#define VIEW_COUNT 3
+#define REPAINTS 10
+
+struct stats_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct wl_event_source *timer;
+
+	struct weston_surface *surfaces[VIEW_COUNT];
+	struct weston_output_stats base;
+	uint64_t base_repaints;
+};
+
+static void
+check_stats(struct stats_test *test)
+{
+	struct weston_output *output = test->output;
+	struct weston_output_stats *stats = &output->stats;
+	uint64_t repaints = output->repaint_timing.repaints;
+	uint64_t binned = 0;
+	int i;
+
+	for (i = 0; i < WESTON_REPAINT_HISTOGRAM_BUCKETS; i++)
+		binned += stats->repaint_histogram[i];
+	assert(binned == repaints);
+
+	/* The last repaint may still be on its way to the screen. */
+	assert(stats->frames_presented == repaints ||
+	       stats->frames_presented + 1 == repaints);
+	assert(stats->vblanks_missed <= stats->frames_presented);
+
+	assert(stats->views - test->base.views >=
+	       VIEW_COUNT * (repaints - test->base_repaints));
+	/* Headless has no planes. */
+	assert(stats->plane_views == 0);
+}
+
+static int
+stats_timer_handler(void *data)
+{
+	struct stats_test *test = data;
+	int i;
+
+	if (test->output->repaint_timing.repaints <
+	    test->base_repaints + REPAINTS) {
+		for (i = 0; i < VIEW_COUNT; i++)
+			weston_surface_damage(test->surfaces[i]);
+		wl_event_source_timer_update(test->timer, 5);
+		return 0;
+	}
+
+	check_stats(test);
+
+	for (i = 0; i < VIEW_COUNT; i++)
+		weston_surface_destroy(test->surfaces[i]);
+
+	wl_event_source_remove(test->timer);
+	wl_list_remove(&test->layer.link);
+	wl_display_terminate(test->compositor->wl_display);
+	free(test);
+
+	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct stats_test *test;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	int i;
+
+	assert(!wl_list_empty(&compositor->output_list));
+
+	test = zalloc(sizeof *test);
+	assert(test);
+	test->compositor = compositor;
+	test->output = container_of(compositor->output_list.next,
+				    struct weston_output, link);
+	test->base = test->output->stats;
+	test->base_repaints = test->output->repaint_timing.repaints;
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	for (i = 0; i < VIEW_COUNT; i++) {
+		surface = weston_surface_create(compositor);
+		assert(surface);
+		view = weston_view_create(surface);
+		assert(view);
+
+		surface->width = 100;
+		surface->height = 100;
+		weston_view_set_position(view, test->output->x + i * 50,
+					 test->output->y + i * 50);
+		weston_layer_entry_insert(&test->layer.view_list,
+					  &view->layer_link);
+		test->surfaces[i] = surface;
+	}
+
+	weston_compositor_schedule_repaint(compositor);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	test->timer = wl_event_loop_add_timer(loop, stats_timer_handler,
+					      test);
+	wl_event_source_timer_update(test->timer, 1);
+
+	return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "drm-plane-cache.h"
+
+/* Each kind of plane takes one view per repaint, like the cursor and
+ * scanout planes of a DRM output with a single overlay. */
+struct mock_view {
+	uint32_t accept;	/* mask of the kinds the view fits */
+	uint32_t serial;
+	bool overlapped;
+	enum drm_plane_kind kind;
+};
+
+struct mock_repaint {
+	uint32_t taken;
+	struct mock_view *view;
+	int tries;
+};
+
+#define KIND_MASK(kind) (1u << (kind))
+
+static bool
+mock_try_plane(void *data, enum drm_plane_kind kind)
+{
+	struct mock_repaint *repaint = data;
+
+	assert(kind != DRM_PLANE_KIND_PRIMARY);
+	repaint->tries++;
+
+	if (!(repaint->view->accept & KIND_MASK(kind)) ||
+	    (repaint->taken & KIND_MASK(kind)))
+		return false;
+
+	repaint->taken |= KIND_MASK(kind);
+	return true;
+}
+
+/* Assigns the views, top first, and returns the number of tries. */
+static int
+repaint(struct drm_plane_cache *cache, struct mock_view *views, int count)
+{
+	struct mock_repaint repaint = { 0 };
+	struct drm_plane_cache_key key;
+	int i;
+
+	drm_plane_cache_begin(cache);
+	for (i = 0; i < count; i++) {
+		memset(&key, 0, sizeof key);
+		key.view = &views[i];
+		key.transform_serial = views[i].serial;
+		key.alpha = 1.0f;
+		key.overlapped = views[i].overlapped;
+
+		repaint.view = &views[i];
+		views[i].kind = drm_plane_cache_assign(cache, &key,
+						       mock_try_plane,
+						       &repaint);
+	}
+	drm_plane_cache_end(cache);
+
+	return repaint.tries;
+}
+
+TEST(plane_cache_reuses_primary)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[3] = { { 0 } };
+	int tries;
+
+	drm_plane_cache_init(&cache);
+
+	tries = repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(tries == 3 * 3);
+	assert(cache.hits == 0 && cache.misses == 3);
+
+	/* Views that fit no plane are not checked again. */
+	tries = repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(tries == 0);
+	assert(cache.hits == 3 && cache.misses == 0);
+	assert(views[0].kind == DRM_PLANE_KIND_PRIMARY);
+
+	drm_plane_cache_release(&cache);
+}
+
+TEST(plane_cache_reuses_planes)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[3] = {
+		{ .accept = KIND_MASK(DRM_PLANE_KIND_CURSOR) },
+		{ .accept = KIND_MASK(DRM_PLANE_KIND_OVERLAY) },
+		{ .accept = KIND_MASK(DRM_PLANE_KIND_OVERLAY) },
+	};
+	int tries;
+
+	drm_plane_cache_init(&cache);
+
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(views[0].kind == DRM_PLANE_KIND_CURSOR);
+	assert(views[1].kind == DRM_PLANE_KIND_OVERLAY);
+	assert(views[2].kind == DRM_PLANE_KIND_PRIMARY);
+
+	/* Only the cached planes are tried. */
+	tries = repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(tries == 2);
+	assert(cache.hits == 3);
+	assert(views[0].kind == DRM_PLANE_KIND_CURSOR);
+	assert(views[1].kind == DRM_PLANE_KIND_OVERLAY);
+	assert(views[2].kind == DRM_PLANE_KIND_PRIMARY);
+
+	drm_plane_cache_release(&cache);
+}
+
+TEST(plane_cache_key_change)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[3] = { { 0 } };
+
+	drm_plane_cache_init(&cache);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+
+	/* The views below a changed one search again, the ones above
+	 * keep their plane. */
+	views[1].serial++;
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.hits == 1 && cache.misses == 2);
+
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.hits == 3 && cache.misses == 0);
+
+	drm_plane_cache_release(&cache);
+}
+
+TEST(plane_cache_plane_lost)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[2] = {
+		{ .accept = KIND_MASK(DRM_PLANE_KIND_SCANOUT) |
+			    KIND_MASK(DRM_PLANE_KIND_OVERLAY) },
+		{ 0 },
+	};
+	int tries;
+
+	drm_plane_cache_init(&cache);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(views[0].kind == DRM_PLANE_KIND_SCANOUT);
+
+	/* Say the new buffer of the view cannot be scanned out any more,
+	 * the key does not tell. The view finds the overlay instead. */
+	views[0].accept = KIND_MASK(DRM_PLANE_KIND_OVERLAY);
+	tries = repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(views[0].kind == DRM_PLANE_KIND_OVERLAY);
+	assert(tries == 1 + 3 + 3);
+	assert(cache.hits == 0 && cache.misses == 2);
+
+	drm_plane_cache_release(&cache);
+}
+
+TEST(plane_cache_overlapped)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[2] = {
+		{ 0 },
+		{ .accept = KIND_MASK(DRM_PLANE_KIND_OVERLAY),
+		  .overlapped = true },
+	};
+	int tries;
+
+	drm_plane_cache_init(&cache);
+
+	tries = repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(tries == 3);
+	assert(views[1].kind == DRM_PLANE_KIND_PRIMARY);
+
+	views[1].overlapped = false;
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(views[1].kind == DRM_PLANE_KIND_OVERLAY);
+	assert(cache.hits == 1 && cache.misses == 1);
+
+	drm_plane_cache_release(&cache);
+}
+
+TEST(plane_cache_full_search)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[2] = { { 0 } };
+	int i;
+
+	drm_plane_cache_init(&cache);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+
+	/* Out of every DRM_PLANE_CACHE_MAX_AGE repaints, the first one
+	 * searches. */
+	for (i = 0; i < DRM_PLANE_CACHE_MAX_AGE - 2; i++) {
+		repaint(&cache, views, ARRAY_LENGTH(views));
+		assert(cache.misses == 0);
+	}
+
+	/* Every so often, views get a chance to move to a plane. */
+	views[0].accept = KIND_MASK(DRM_PLANE_KIND_CURSOR);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.misses == 0);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.misses == 2);
+	assert(views[0].kind == DRM_PLANE_KIND_CURSOR);
+
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.hits == 2);
+
+	drm_plane_cache_release(&cache);
+}
+
+TEST(plane_cache_invalidate)
+{
+	struct drm_plane_cache cache;
+	struct mock_view views[2] = { { 0 } };
+
+	drm_plane_cache_init(&cache);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+
+	drm_plane_cache_invalidate(&cache);
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.hits == 0 && cache.misses == 2);
+
+	repaint(&cache, views, ARRAY_LENGTH(views));
+	assert(cache.hits == 2);
+
+	drm_plane_cache_release(&cache);
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* Drives repaints with the adaptive repaint window on and checks what
+ * weston_output_get_repaint_stats() reports about them. */
+
+#define REPAINTS (WESTON_REPAINT_HISTORY + 8)
+#define MARGIN_MSEC 3
+
+struct repaint_test {
+	struct weston_compositor *compositor;
+	struct weston_output *output;
+	struct weston_layer layer;
+	struct wl_event_source *timer;
+
+	struct weston_surface *surface;
+	uint64_t base_repaints;
+};
+
+static void
+check_stats(struct repaint_test *test)
+{
+	struct weston_repaint_stats stats;
+
+	weston_output_get_repaint_stats(test->output, &stats);
+
+	assert(stats.repaints == test->output->repaint_timing.repaints);
+	assert(stats.repaints - test->base_repaints >= REPAINTS);
+	assert(stats.samples == WESTON_REPAINT_HISTORY);
+	assert(stats.late <= stats.repaints);
+
+	assert(stats.min_usec <= stats.avg_usec);
+	assert(stats.avg_usec <= stats.max_usec);
+
+	/* The window is sized from whole milliseconds of the history at
+	 * the last vblank. Samples taken since may have pushed its longest
+	 * repaint out, so it cannot be compared with max_usec. */
+	assert(stats.window_usec % 1000 == 0);
+	assert(stats.window_usec >= MARGIN_MSEC * 1000);
+}
+
+static int
+repaint_timer_handler(void *data)
+{
+	struct repaint_test *test = data;
+
+	if (test->output->repaint_timing.repaints <
+	    test->base_repaints + REPAINTS) {
+		weston_surface_damage(test->surface);
+		wl_event_source_timer_update(test->timer, 5);
+		return 0;
+	}
+
+	check_stats(test);
+
+	weston_surface_destroy(test->surface);
+	wl_event_source_remove(test->timer);
+	wl_list_remove(&test->layer.link);
+	wl_display_terminate(test->compositor->wl_display);
+	free(test);
+
+	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct repaint_test *test;
+	struct weston_view *view;
+
+	assert(!wl_list_empty(&compositor->output_list));
+
+	test = zalloc(sizeof *test);
+	assert(test);
+	test->compositor = compositor;
+	test->output = container_of(compositor->output_list.next,
+				    struct weston_output, link);
+	test->base_repaints = test->output->repaint_timing.repaints;
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	compositor->repaint_adaptive = true;
+	compositor->repaint_margin_msec = MARGIN_MSEC;
+
+	test->surface = weston_surface_create(compositor);
+	assert(test->surface);
+	view = weston_view_create(test->surface);
+	assert(view);
+	test->surface->width = 100;
+	test->surface->height = 100;
+	weston_view_set_position(view, test->output->x, test->output->y);
+	weston_layer_entry_insert(&test->layer.view_list, &view->layer_link);
+
+	weston_compositor_schedule_repaint(compositor);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	test->timer = wl_event_loop_add_timer(loop, repaint_timer_handler,
+					      test);
+	wl_event_source_timer_update(test->timer, 1);
+
+	return 0;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "weston-test-client-helper.h"
+#include "headless-framebuffer.h"
+
+char *server_parameters = "--use-pixman --width=320 --height=240 "
+			  "--shm-buffers=3";
+
+/* The test client is started by the compositor, so the framebuffer is
+ * among the files of our parent. */
+static struct weston_headless_fb_header *
+map_framebuffer(size_t *size)
+{
+	struct weston_headless_fb_header *header = NULL;
+	char dir[64], path[320], target[256];
+	struct dirent *entry;
+	struct stat st;
+	ssize_t len;
+	DIR *d;
+	int fd;
+
+	snprintf(dir, sizeof dir, "/proc/%d/fd", getppid());
+	d = opendir(dir);
+	assert(d);
+
+	while ((entry = readdir(d))) {
+		snprintf(path, sizeof path, "%s/%s", dir, entry->d_name);
+		len = readlink(path, target, sizeof target - 1);
+		if (len < 0)
+			continue;
+		target[len] = '\0';
+		if (strstr(target, "memfd:weston-headless-"))
+			break;
+	}
+	closedir(d);
+
+	if (!entry)
+		skip("no memfd framebuffer found\n");
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	assert(fd >= 0);
+	assert(fstat(fd, &st) == 0);
+	*size = st.st_size;
+	header = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	assert(header != MAP_FAILED);
+	close(fd);
+
+	return header;
+}
+
+static uint32_t
+read_pixel(struct weston_headless_fb_header *header, uint64_t seq,
+	   int x, int y)
+{
+	uint32_t i = seq % header->buffer_count;
+	char *buffer;
+	uint32_t pixel;
+
+	assert(__atomic_load_n(&header->frames[i].seq, __ATOMIC_ACQUIRE) ==
+	       seq);
+	buffer = (char *)header + header->buffer_offset + i * header->buffer_size;
+	pixel = *(uint32_t *)(buffer + y * header->stride + x * 4);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	assert(__atomic_load_n(&header->frames[i].seq, __ATOMIC_RELAXED) ==
+	       seq);
+
+	return pixel & 0xffffff;
+}
+
+static void
+draw_rect(struct client *client, uint32_t color,
+	  int x, int y, int width, int height)
+{
+	struct surface *surface = client->surface;
+	pixman_color_t c = {
+		.red = (color >> 16 & 0xff) * 0x101,
+		.green = (color >> 8 & 0xff) * 0x101,
+		.blue = (color & 0xff) * 0x101,
+		.alpha = 0xffff,
+	};
+	pixman_image_t *solid;
+	int done;
+
+	solid = pixman_image_create_solid_fill(&c);
+	pixman_image_composite32(PIXMAN_OP_SRC, solid, NULL,
+				 surface->buffer->image,
+				 0, 0, 0, 0, x, y, width, height);
+	pixman_image_unref(solid);
+
+	wl_surface_attach(surface->wl_surface, surface->buffer->proxy, 0, 0);
+	wl_surface_damage(surface->wl_surface, x, y, width, height);
+	frame_callback_set(surface->wl_surface, &done);
+	wl_surface_commit(surface->wl_surface);
+	frame_callback_wait(client, &done);
+}
+
+static void
+draw(struct client *client, uint32_t color)
+{
+	draw_rect(client, color, 0, 0,
+		  client->surface->width, client->surface->height);
+}
+
+TEST(shm_framebuffer_frames)
+{
+	struct weston_headless_fb_header *header;
+	struct weston_headless_fb_frame *frame;
+	struct client *client;
+	uint64_t seq, prev;
+	size_t size;
+	int i;
+
+	client = create_client_and_test_surface(100, 50, 64, 64);
+	header = map_framebuffer(&size);
+
+	assert(header->magic == WESTON_HEADLESS_FB_MAGIC);
+	assert(header->version == WESTON_HEADLESS_FB_VERSION);
+	assert(header->width == 320);
+	assert(header->height == 240);
+	assert(header->buffer_count == 3);
+	assert(header->format == WL_SHM_FORMAT_XRGB8888);
+	assert(header->buffer_offset + header->buffer_count *
+	       header->buffer_size <= size);
+
+	prev = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+	assert(prev > 0);
+
+	/* Go around the ring a few times, every buffer has to show the
+	 * latest content. The shell may draw frames of its own in between,
+	 * so the damage can only be checked against the output. */
+	for (i = 0; i < 7; i++) {
+		uint32_t color = i % 2 ? 0x00ff00 : 0x0000ff;
+
+		draw(client, color);
+
+		seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+		assert(seq > prev);
+		assert(read_pixel(header, seq, 110, 60) == color);
+		assert(read_pixel(header, seq, 163, 113) == color);
+
+		frame = &header->frames[seq % header->buffer_count];
+		assert(frame->damage_width > 0 && frame->damage_height > 0);
+		assert(frame->damage_x >= 0 && frame->damage_y >= 0);
+		assert(frame->damage_x + frame->damage_width <= 320);
+		assert(frame->damage_y + frame->damage_height <= 240);
+
+		prev = seq;
+	}
+
+	munmap(header, size);
+}
+
+TEST(shm_framebuffer_partial_damage)
+{
+	struct weston_headless_fb_header *header;
+	struct client *client;
+	uint64_t seq, full_seq;
+	bool reused = false;
+	size_t size;
+	int i;
+
+	client = create_client_and_test_surface(100, 50, 64, 64);
+	header = map_framebuffer(&size);
+
+	/* Leave other colors in every buffer of the ring. */
+	for (i = 0; i < (int) header->buffer_count; i++)
+		draw(client, i % 2 ? 0x00ff00 : 0x0000ff);
+
+	draw(client, 0xff0000);
+	full_seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+
+	/* Only the left half changes now. The right half of a buffer that
+	 * was last drawn before the red frame must be caught up with it,
+	 * not left with the color it had then. */
+	for (i = 0; i < 4; i++) {
+		uint32_t color = i % 2 ? 0xffff00 : 0xff00ff;
+
+		draw_rect(client, color, 0, 0, 32, 64);
+
+		seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+		if ((seq - full_seq) % header->buffer_count != 0)
+			reused = true;
+
+		assert(read_pixel(header, seq, 110, 60) == color);
+		assert(read_pixel(header, seq, 150, 100) == 0xff0000);
+	}
+
+	/* Frames from the shell could in theory have lined the ring up
+	 * with the red frame every time. */
+	assert(reused);
+
+	munmap(header, size);
+}
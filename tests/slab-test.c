@@ -0,0 +1,149 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "slab.h"
+
+struct thing {
+	uint64_t a;
+	char name[40];
+};
+
+#define MANY 5000
+
+static void
+check_stats(struct weston_slab *slab, uint32_t live, uint32_t peak)
+{
+	struct weston_slab_stats stats;
+
+	weston_slab_get_stats(slab, &stats);
+	assert(stats.live == live);
+	assert(stats.peak == peak);
+}
+
+TEST(slab_zalloc_and_free)
+{
+	struct weston_slab *slab;
+	struct thing *t;
+
+	slab = weston_slab_create("thing", sizeof *t);
+	assert(slab);
+	assert(strcmp(weston_slab_get_name(slab), "thing") == 0);
+
+	t = weston_slab_zalloc(slab);
+	assert(t);
+	assert(t->a == 0 && t->name[0] == 0 && t->name[39] == 0);
+	assert(((uintptr_t) t & 15) == 0);
+	check_stats(slab, 1, 1);
+
+	memset(t, 0xff, sizeof *t);
+	weston_slab_free(t);
+	check_stats(slab, 0, 1);
+
+	/* Reused slots come back zeroed too. */
+	t = weston_slab_zalloc(slab);
+	assert(t->a == 0 && t->name[39] == 0);
+	weston_slab_free(t);
+
+	weston_slab_free(NULL);
+	weston_slab_destroy(slab);
+}
+
+TEST(slab_many_objects)
+{
+	static struct thing *things[MANY];
+	struct weston_slab *slab;
+	struct weston_slab_stats stats;
+	int i, j;
+
+	slab = weston_slab_create("thing", sizeof(struct thing));
+	assert(slab);
+
+	for (i = 0; i < MANY; i++) {
+		things[i] = weston_slab_zalloc(slab);
+		assert(things[i]);
+		things[i]->a = i;
+		for (j = 0; j < i && j < 64; j++)
+			assert(things[j] != things[i]);
+	}
+	check_stats(slab, MANY, MANY);
+
+	weston_slab_get_stats(slab, &stats);
+	assert(stats.chunks > 1);
+	assert(stats.allocations == MANY);
+
+	/* Free every other one, then refill the holes. */
+	for (i = 0; i < MANY; i += 2)
+		weston_slab_free(things[i]);
+	check_stats(slab, MANY / 2, MANY);
+
+	for (i = 1; i < MANY; i += 2)
+		assert(things[i]->a == (uint64_t) i);
+
+	for (i = 0; i < MANY; i += 2)
+		things[i] = weston_slab_zalloc(slab);
+	check_stats(slab, MANY, MANY);
+
+	for (i = 0; i < MANY; i++)
+		weston_slab_free(things[i]);
+	check_stats(slab, 0, MANY);
+
+	/* No more than one empty chunk is kept. */
+	weston_slab_get_stats(slab, &stats);
+	assert(stats.chunks <= 1);
+
+	weston_slab_destroy(slab);
+}
+
+TEST(slab_free_after_destroy)
+{
+	struct weston_slab *slab;
+	struct thing *a, *b;
+
+	slab = weston_slab_create("thing", sizeof *a);
+	assert(slab);
+
+	a = weston_slab_zalloc(slab);
+	b = weston_slab_zalloc(slab);
+	assert(a && b);
+
+	/* The slab lives on until its last object is freed. */
+	weston_slab_destroy(slab);
+	weston_slab_free(a);
+	weston_slab_free(b);
+}
+
+TEST(slab_too_big)
+{
+	assert(weston_slab_create("huge", 1 << 20) == NULL);
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* Checks that a repaint marks surfaces as occluded exactly when opaque
+ * views above hide all of them, or when they are off all outputs. */
+
+struct occlusion_test {
+	struct weston_compositor *compositor;
+	struct weston_layer layer;
+	struct wl_event_source *timer;
+
+	struct weston_surface *cover;
+	struct weston_surface *hidden;
+	struct weston_surface *peeking;
+	struct weston_surface *offscreen;
+};
+
+static struct weston_surface *
+add_surface(struct occlusion_test *test, int x, int y, int width,
+	    int height, bool opaque)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(test->compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+
+	surface->width = width;
+	surface->height = height;
+	if (opaque) {
+		pixman_region32_fini(&surface->opaque);
+		pixman_region32_init_rect(&surface->opaque, 0, 0,
+					  width, height);
+	}
+
+	weston_view_set_position(view, x, y);
+	weston_layer_entry_insert(&test->layer.view_list, &view->layer_link);
+
+	return surface;
+}
+
+static struct weston_view *
+first_view(struct weston_surface *surface)
+{
+	return container_of(surface->views.next, struct weston_view,
+			    surface_link);
+}
+
+static int
+occlusion_timer_handler(void *data)
+{
+	struct occlusion_test *test = data;
+
+	/* Wait until a repaint has gone through our views. */
+	if (wl_list_empty(&first_view(test->cover)->link)) {
+		wl_event_source_timer_update(test->timer, 1);
+		return 0;
+	}
+
+	assert(!test->cover->occluded);
+	assert(test->hidden->occluded);
+	assert(!test->peeking->occluded);
+	assert(test->offscreen->occluded);
+
+	weston_surface_destroy(test->cover);
+	weston_surface_destroy(test->hidden);
+	weston_surface_destroy(test->peeking);
+	weston_surface_destroy(test->offscreen);
+
+	wl_event_source_remove(test->timer);
+	wl_list_remove(&test->layer.link);
+	wl_display_terminate(test->compositor->wl_display);
+	free(test);
+
+	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct occlusion_test *test;
+
+	test = zalloc(sizeof *test);
+	assert(test);
+	test->compositor = compositor;
+	weston_layer_init(&test->layer, &compositor->cursor_layer.link);
+
+	/* Bottom to top. */
+	test->offscreen = add_surface(test, -500, -500, 100, 100, false);
+	test->hidden = add_surface(test, 50, 50, 100, 100, false);
+	test->peeking = add_surface(test, 150, 150, 100, 100, false);
+	test->cover = add_surface(test, 0, 0, 200, 200, true);
+
+	weston_compositor_schedule_repaint(compositor);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	test->timer = wl_event_loop_add_timer(loop, occlusion_timer_handler,
+					      test);
+	wl_event_source_timer_update(test->timer, 1);
+
+	return 0;
+}
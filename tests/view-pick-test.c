@@ -0,0 +1,294 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+
+/* Checks weston_compositor_pick_view() against a plain walk of the view
+ * list and reports the cost per pick for a growing number of views.
+ */
+
+#define AREA_WIDTH 1920
+#define AREA_HEIGHT 1080
+#define VERIFY_PICKS 2000
+#define TIMED_PICKS 100000
+#define MOVES 1000
+
+static const int view_counts[] = { 1000, 10000 };
+
+struct pick_bench {
+	struct weston_compositor *compositor;
+	struct weston_layer layer;
+	struct wl_event_source *timer;
+
+	struct weston_surface **surfaces;
+	struct weston_view **views;
+	int count;
+	unsigned step;
+};
+
+static double
+timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1e9 + (a->tv_nsec - b->tv_nsec);
+}
+
+static void
+random_point(wl_fixed_t *x, wl_fixed_t *y)
+{
+	*x = wl_fixed_from_int(random() % AREA_WIDTH);
+	*y = wl_fixed_from_int(random() % AREA_HEIGHT);
+}
+
+/* The pre-index behaviour of weston_compositor_pick_view(). */
+static struct weston_view *
+reference_pick(struct weston_compositor *compositor,
+	       wl_fixed_t x, wl_fixed_t y)
+{
+	struct weston_view *view;
+	wl_fixed_t vx, vy;
+	int ix = wl_fixed_to_int(x);
+	int iy = wl_fixed_to_int(y);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!pixman_region32_contains_point(
+				&view->transform.boundingbox, ix, iy, NULL))
+			continue;
+
+		weston_view_from_global_fixed(view, x, y, &vx, &vy);
+		if (!pixman_region32_contains_point(&view->surface->input,
+						    wl_fixed_to_int(vx),
+						    wl_fixed_to_int(vy), NULL))
+			continue;
+
+		if (view->geometry.scissor_enabled &&
+		    !pixman_region32_contains_point(&view->geometry.scissor,
+						    wl_fixed_to_int(vx),
+						    wl_fixed_to_int(vy), NULL))
+			continue;
+
+		return view;
+	}
+
+	return NULL;
+}
+
+static void
+bench_populate(struct pick_bench *bench, int count)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+	int i;
+
+	bench->count = count;
+	bench->surfaces = zalloc(count * sizeof bench->surfaces[0]);
+	bench->views = zalloc(count * sizeof bench->views[0]);
+	assert(bench->surfaces && bench->views);
+
+	for (i = 0; i < count; i++) {
+		surface = weston_surface_create(bench->compositor);
+		assert(surface);
+		view = weston_view_create(surface);
+		assert(view);
+
+		surface->width = 16 + random() % 112;
+		surface->height = 16 + random() % 112;
+
+		/* Exercise input regions and scissors on some of them. */
+		if (i % 7 == 0)
+			pixman_region32_clear(&surface->input);
+		else if (i % 5 == 0 && (bench->compositor->capabilities &
+					       WESTON_CAP_VIEW_CLIP_MASK))
+			weston_view_set_mask(view, 0, 0, surface->width / 2,
+					     surface->height / 2);
+
+		weston_view_set_position(view,
+					 random() % AREA_WIDTH - 64,
+					 random() % AREA_HEIGHT - 64);
+		weston_layer_entry_insert(&bench->layer.view_list,
+					  &view->layer_link);
+
+		bench->surfaces[i] = surface;
+		bench->views[i] = view;
+	}
+
+	weston_compositor_schedule_repaint(bench->compositor);
+}
+
+static void
+bench_clear(struct pick_bench *bench)
+{
+	int i;
+
+	for (i = 0; i < bench->count; i++)
+		weston_surface_destroy(bench->surfaces[i]);
+
+	free(bench->surfaces);
+	free(bench->views);
+	bench->surfaces = NULL;
+	bench->views = NULL;
+	bench->count = 0;
+}
+
+static int
+verify_picks(struct weston_compositor *compositor, double *ref_ns)
+{
+	struct weston_view *view;
+	struct timespec t0, t1;
+	wl_fixed_t x, y, vx, vy;
+	int i, hits = 0;
+
+	for (i = 0; i < VERIFY_PICKS; i++) {
+		random_point(&x, &y);
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		view = reference_pick(compositor, x, y);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		*ref_ns += timespec_diff_ns(&t1, &t0);
+
+		assert(weston_compositor_pick_view(compositor, x, y,
+						   &vx, &vy) == view);
+		if (view)
+			hits++;
+	}
+
+	return hits;
+}
+
+/* Moves views around within the area, as a dragged window would, so the
+ * index gets updated instead of rebuilt. Returns the cost per move. */
+static double
+bench_move(struct pick_bench *bench)
+{
+	struct weston_view *view;
+	struct timespec t0, t1;
+	double ns = 0.0;
+	int i;
+
+	for (i = 0; i < MOVES; i++) {
+		view = bench->views[random() % bench->count];
+
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		weston_view_set_position(view,
+					 random() % (AREA_WIDTH - 128),
+					 random() % (AREA_HEIGHT - 128));
+		weston_view_update_transform(view);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		ns += timespec_diff_ns(&t1, &t0);
+	}
+
+	return ns / MOVES;
+}
+
+static void
+bench_run(struct pick_bench *bench)
+{
+	struct weston_compositor *compositor = bench->compositor;
+	struct timespec t0, t1;
+	wl_fixed_t x, y, vx, vy;
+	double rebuild_ns, pick_ns, move_ns, ref_ns = 0.0;
+	int i, hits;
+
+	/* The first pick after the repaint rebuilds the index. */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	weston_compositor_pick_view(compositor, 0, 0, &vx, &vy);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	rebuild_ns = timespec_diff_ns(&t1, &t0);
+
+	hits = verify_picks(compositor, &ref_ns);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TIMED_PICKS; i++) {
+		random_point(&x, &y);
+		weston_compositor_pick_view(compositor, x, y, &vx, &vy);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	pick_ns = timespec_diff_ns(&t1, &t0) / TIMED_PICKS;
+
+	move_ns = bench_move(bench);
+	hits += verify_picks(compositor, &ref_ns);
+
+	fprintf(stderr, "%d views: %d/%d hits verified, rebuild %.1f us, "
+		"move %.1f ns, pick %.1f ns, linear walk %.1f ns\n",
+		bench->count, hits, 2 * VERIFY_PICKS, rebuild_ns / 1000.0,
+		move_ns, pick_ns, ref_ns / (2 * VERIFY_PICKS));
+}
+
+static int
+bench_timer_handler(void *data)
+{
+	struct pick_bench *bench = data;
+
+	/* Wait until a repaint has put our views into the view list. */
+	if (wl_list_empty(&bench->views[0]->link)) {
+		wl_event_source_timer_update(bench->timer, 1);
+		return 0;
+	}
+
+	bench_run(bench);
+	bench_clear(bench);
+
+	if (++bench->step < ARRAY_LENGTH(view_counts)) {
+		bench_populate(bench, view_counts[bench->step]);
+		wl_event_source_timer_update(bench->timer, 1);
+		return 0;
+	}
+
+	wl_event_source_remove(bench->timer);
+	wl_list_remove(&bench->layer.link);
+	wl_display_terminate(bench->compositor->wl_display);
+	free(bench);
+
+	return 0;
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+	struct pick_bench *bench;
+
+	bench = zalloc(sizeof *bench);
+	assert(bench);
+	bench->compositor = compositor;
+	weston_layer_init(&bench->layer, &compositor->cursor_layer.link);
+
+	srandom(13);
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	bench->timer = wl_event_loop_add_timer(loop, bench_timer_handler,
+					       bench);
+	bench_populate(bench, view_counts[0]);
+	wl_event_source_timer_update(bench->timer, 1);
+
+	return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+#include "weston-test-client-helper.h"
+#include "presentation-time-client-protocol.h"
+
+/* 50 Hz, so that a refresh period is a whole number of nanoseconds. */
+char *server_parameters = "--virtual-clock --refresh=50000";
+
+#define REFRESH_NSEC 20000000
+#define CLOCK_START_NSEC 1000000000
+
+struct feedback {
+	bool presented;
+	uint64_t seq;
+	struct timespec time;
+	uint32_t refresh_nsec;
+	uint32_t flags;
+};
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi,
+		   uint32_t tv_sec_lo,
+		   uint32_t tv_nsec,
+		   uint32_t refresh_nsec,
+		   uint32_t seq_hi,
+		   uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct feedback *fb = data;
+
+	fb->presented = true;
+	fb->seq = ((uint64_t)seq_hi << 32) + seq_lo;
+	fb->time.tv_sec = ((uint64_t)tv_sec_hi << 32) + tv_sec_lo;
+	fb->time.tv_nsec = tv_nsec;
+	fb->refresh_nsec = refresh_nsec;
+	fb->flags = flags;
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	assert(0 && "frame discarded");
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static struct wp_presentation *
+get_presentation(struct client *client)
+{
+	struct global *g;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, wp_presentation_interface.name) == 0)
+			return wl_registry_bind(client->wl_registry, g->name,
+						&wp_presentation_interface, 1);
+	}
+
+	assert(0 && "no presentation found");
+	return NULL;
+}
+
+/* Commits a frame and steps the clock until it is presented. The frame
+ * is drawn at the next vblank, or at the one after if the output was
+ * busy with another frame, so it takes at most two steps. */
+static int
+present_frame(struct client *client, struct wp_presentation *pres,
+	      struct wl_surface *surface, struct buffer *buffer,
+	      struct feedback *fb)
+{
+	struct wp_presentation_feedback *obj;
+	int steps = 0;
+
+	memset(fb, 0, sizeof *fb);
+	wl_surface_attach(surface, buffer->proxy, 0, 0);
+	wl_surface_damage(surface, 0, 0, 64, 64);
+	obj = wp_presentation_feedback(pres, surface);
+	wp_presentation_feedback_add_listener(obj, &feedback_listener, fb);
+	wl_surface_commit(surface);
+	client_roundtrip(client);
+
+	while (!fb->presented) {
+		assert(steps < 2);
+		weston_test_step_frames(client->test->weston_test, 1);
+		client_roundtrip(client);
+		steps++;
+	}
+
+	wp_presentation_feedback_destroy(obj);
+
+	return steps;
+}
+
+static void
+check_vblank(const struct feedback *fb)
+{
+	assert(fb->refresh_nsec == REFRESH_NSEC);
+	assert(fb->flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+	assert(timespec_to_nsec(&fb->time) ==
+	       CLOCK_START_NSEC + (int64_t)fb->seq * REFRESH_NSEC);
+}
+
+TEST(virtual_clock_frames)
+{
+	struct client *client;
+	struct wp_presentation *pres;
+	struct wl_surface *surface;
+	struct buffer *buffer;
+	struct feedback fb, prev;
+	int i, steps;
+
+	client = create_client();
+	pres = get_presentation(client);
+	surface = wl_compositor_create_surface(client->wl_compositor);
+	buffer = create_shm_buffer_a8r8g8b8(client, 64, 64);
+	weston_test_move_surface(client->test->weston_test, surface, 10, 10);
+
+	present_frame(client, pres, surface, buffer, &prev);
+	check_vblank(&prev);
+
+	for (i = 0; i < 10; i++) {
+		steps = present_frame(client, pres, surface, buffer, &fb);
+		check_vblank(&fb);
+		assert(fb.seq == prev.seq + steps);
+		prev = fb;
+	}
+}
+
+TEST(virtual_clock_idle_vblanks)
+{
+	struct client *client;
+	struct wp_presentation *pres;
+	struct wl_surface *surface;
+	struct buffer *buffer;
+	struct feedback fb, prev;
+	int steps;
+
+	client = create_client();
+	pres = get_presentation(client);
+	surface = wl_compositor_create_surface(client->wl_compositor);
+	buffer = create_shm_buffer_a8r8g8b8(client, 64, 64);
+	weston_test_move_surface(client->test->weston_test, surface, 10, 10);
+
+	present_frame(client, pres, surface, buffer, &prev);
+
+	/* The clock keeps counting vblanks while nothing is drawn. */
+	weston_test_step_frames(client->test->weston_test, 5);
+	client_roundtrip(client);
+
+	steps = present_frame(client, pres, surface, buffer, &fb);
+	check_vblank(&fb);
+	assert(fb.seq == prev.seq + 5 + steps);
+}
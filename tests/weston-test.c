@@ -34,6 +34,8 @@
 
 #include "compositor.h"
 #include "compositor/weston.h"
+#include "compositor-headless.h"
+#include "windowed-output-api.h"
 #include "weston-test-server-protocol.h"
 
 #ifdef ENABLE_EGL
@@ -527,6 +529,57 @@ capture_screenshot(struct wl_client *client,
 				     capture_screenshot_done, resource);
 }
 
+static void
+step_frames(struct wl_client *client, struct wl_resource *resource,
+	    uint32_t count)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	const struct weston_headless_output_api *api =
+		weston_headless_output_get_api(test->compositor);
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		if (!api || api->step_frame(test->compositor) < 0) {
+			wl_resource_post_error(resource,
+					       WESTON_TEST_ERROR_NO_VIRTUAL_CLOCK,
+					       "the backend has no virtual clock");
+			return;
+		}
+	}
+}
+
+static void
+output_add(struct wl_client *client, struct wl_resource *resource,
+	   const char *name)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	const struct weston_windowed_output_api *api =
+		weston_windowed_output_get_api(test->compositor);
+
+	if (!api || api->output_create(test->compositor, name) < 0)
+		wl_resource_post_error(resource,
+				       WESTON_TEST_ERROR_INVALID_OUTPUT,
+				       "cannot create output \"%s\"", name);
+}
+
+static void
+output_remove(struct wl_client *client, struct wl_resource *resource,
+	      const char *name)
+{
+	struct weston_test *test = wl_resource_get_user_data(resource);
+	struct weston_output *output;
+
+	wl_list_for_each(output, &test->compositor->output_list, link) {
+		if (strcmp(output->name, name) == 0) {
+			output->destroy(output);
+			return;
+		}
+	}
+
+	wl_resource_post_error(resource, WESTON_TEST_ERROR_INVALID_OUTPUT,
+			       "no output \"%s\"", name);
+}
+
 static const struct weston_test_interface test_implementation = {
 	move_surface,
 	move_pointer,
@@ -537,6 +590,9 @@ static const struct weston_test_interface test_implementation = {
 	device_add,
 	get_n_buffers,
 	capture_screenshot,
+	step_frames,
+	output_add,
+	output_remove,
 };
 
 static void
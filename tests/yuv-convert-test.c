@@ -0,0 +1,211 @@
+/*
+ * Copyright © 2016 Collabora, Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "weston-test-runner.h"
+
+#include "shared/helpers.h"
+#include "yuv-convert.h"
+
+static const struct {
+	enum yuv_convert_format format;
+	const char *name;
+} formats[] = {
+	{ YUV_CONVERT_YUYV, "YUYV" },
+};
+
+struct test_image {
+	struct yuv_convert_source src;
+	uint8_t *data;
+	uint32_t *dst;
+	uint32_t *ref;
+	int32_t dst_stride;
+};
+
+/* Allocates a source filled with random samples and two destinations.
+ * The strides are padded a bit to catch mixups with the width.
+ */
+static void
+test_image_init(struct test_image *img, enum yuv_convert_format format,
+		int32_t width, int32_t height)
+{
+	int32_t stride, size, i;
+
+	stride = ((width + 1) & ~1) * 2 + 8;
+	size = stride * height;
+
+	img->data = malloc(size);
+	assert(img->data);
+	for (i = 0; i < size; i++)
+		img->data[i] = random();
+
+	yuv_convert_source_init(&img->src, format, img->data,
+				width, height, stride);
+
+	img->dst_stride = width * 4 + 12;
+	img->dst = calloc(height, img->dst_stride);
+	img->ref = calloc(height, img->dst_stride);
+	assert(img->dst && img->ref);
+}
+
+static void
+test_image_release(struct test_image *img)
+{
+	free(img->data);
+	free(img->dst);
+	free(img->ref);
+}
+
+static void
+convert_both(struct test_image *img,
+	     int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	yuv_convert_rect(&img->src, img->dst, img->dst_stride,
+			 x, y, width, height);
+	yuv_convert_rect_c(&img->src, img->ref, img->dst_stride,
+			   x, y, width, height);
+}
+
+static double
+timespec_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1e3 + (a->tv_nsec - b->tv_nsec) / 1e6;
+}
+
+TEST(yuv_convert_known_colors)
+{
+	/* Two pixels of YUYV: white, then black with the same chroma,
+	 * then a pure red pair. */
+	static const uint8_t yuyv[] = {
+		235, 128, 16, 128,
+		81, 90, 81, 240,
+	};
+	struct yuv_convert_source src;
+	uint32_t dst[4];
+
+	yuv_convert_source_init(&src, YUV_CONVERT_YUYV, yuyv, 4, 1,
+				sizeof yuyv);
+	yuv_convert_rect(&src, dst, sizeof dst, 0, 0, 4, 1);
+
+	assert(dst[0] == 0xffffffff);
+	assert(dst[1] == 0xff000000);
+	assert(dst[2] == 0xffff0000);
+	assert(dst[3] == dst[2]);
+}
+
+TEST(yuv_convert_matches_c)
+{
+	struct test_image img;
+	unsigned f;
+	int i, x, y, w, h;
+
+	srandom(7);
+
+	for (f = 0; f < ARRAY_LENGTH(formats); f++) {
+		test_image_init(&img, formats[f].format, 101, 37);
+
+		/* Whole image, then random rectangles including odd
+		 * origins and ones reaching over the edges. */
+		convert_both(&img, 0, 0, 101, 37);
+		for (i = 0; i < 200; i++) {
+			x = random() % 110 - 4;
+			y = random() % 40 - 2;
+			w = random() % 60;
+			h = random() % 20;
+			convert_both(&img, x, y, w, h);
+		}
+
+		assert(memcmp(img.dst, img.ref, 37 * img.dst_stride) == 0);
+		test_image_release(&img);
+	}
+}
+
+TEST(yuv_convert_clips_to_source)
+{
+	struct test_image img;
+	uint8_t *row;
+	int32_t y;
+
+	test_image_init(&img, YUV_CONVERT_YUYV, 16, 8);
+	yuv_convert_rect(&img.src, img.dst, img.dst_stride, -8, -8, 100, 100);
+
+	/* The padding at the end of each destination row stays clear. */
+	for (y = 0; y < 8; y++) {
+		row = (uint8_t *) img.dst + y * img.dst_stride;
+		assert(((uint32_t *) row)[15] != 0);
+		assert(row[16 * 4] == 0 && row[img.dst_stride - 1] == 0);
+	}
+
+	test_image_release(&img);
+}
+
+/* Not a correctness test: reports the cost of a full frame conversion. */
+TEST(yuv_convert_benchmark)
+{
+	static const int32_t sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+	struct test_image img;
+	struct timespec t0, t1, t2;
+	unsigned f, s;
+	int i, rounds;
+
+	for (s = 0; s < ARRAY_LENGTH(sizes); s++) {
+		rounds = s == 0 ? 20 : 5;
+
+		for (f = 0; f < ARRAY_LENGTH(formats); f++) {
+			test_image_init(&img, formats[f].format,
+					sizes[s][0], sizes[s][1]);
+
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			for (i = 0; i < rounds; i++)
+				yuv_convert_rect(&img.src, img.dst,
+						 img.dst_stride, 0, 0,
+						 sizes[s][0], sizes[s][1]);
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			for (i = 0; i < rounds; i++)
+				yuv_convert_rect_c(&img.src, img.ref,
+						   img.dst_stride, 0, 0,
+						   sizes[s][0], sizes[s][1]);
+			clock_gettime(CLOCK_MONOTONIC, &t2);
+
+			fprintf(stderr, "%dx%d %s: %.2f ms per frame, "
+				"plain C %.2f ms\n",
+				sizes[s][0], sizes[s][1], formats[f].name,
+				timespec_diff_ms(&t1, &t0) / rounds,
+				timespec_diff_ms(&t2, &t1) / rounds);
+
+			assert(memcmp(img.dst, img.ref,
+				      sizes[s][1] * img.dst_stride) == 0);
+			test_image_release(&img);
+		}
+	}
+}